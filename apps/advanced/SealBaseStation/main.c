@@ -22,7 +22,7 @@
  */
 
 #include "stdmansos.h"
-#include "net/seal_comm.h"
+#include "net/seal_networking.h"
 
 #define COMMAND_TO_SEND 17
 #define SEQNUM_TO_SEND 3
@@ -31,7 +31,7 @@
 void appMainSimpleCommand(void)
 {
     for (;;) {
-        sealCommSendCommand(COMMAND_TO_SEND);
+        sealNetSendCommand(COMMAND_TO_SEND);
         mdelay(5000);
     }
 }
@@ -48,10 +48,10 @@ void appMainPacket(void)
     MyPacket_t myPacket;
 
     for (;;) {
-        sealCommPacketStart((SealPacket_t *)&myPacket);
-        sealCommPacketAddField(PACKET_FIELD_ID_COMMAND, COMMAND_TO_SEND);
-        sealCommPacketAddField(PACKET_FIELD_ID_SEQNUM, SEQNUM_TO_SEND);
-        sealCommPacketFinish();
+        sealNetPacketStart((SealPacket_t *)&myPacket);
+        sealNetPacketAddField(PACKET_FIELD_ID_COMMAND, COMMAND_TO_SEND);
+        sealNetPacketAddField(PACKET_FIELD_ID_SEQNUM, SEQNUM_TO_SEND);
+        sealNetPacketFinish();
 
         mdelay(5000);
     }
@@ -67,7 +67,7 @@ void appMain(void)
     // register interest to all kind of SEAL packets
     uint16_t i;
     for (i = 0; i < 31; ++i) {
-        sealCommRegisterInterest(i, valueRxCallback);
+        sealNetRegisterInterest(i, valueRxCallback);
     }
 
 //  appMainSimpleCommand();
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Many alarms with random timeouts, rescheduled and removed at random.
+// Checks that every alarm fires within [time, time + slack], and never
+// when removed. Useful to compare alarm implementations (USE_ALARM_WHEEL).
+// Set MAX_SLACK to 0 to require exact firing times.
+//
+
+#include "stdmansos.h"
+#include <random.h>
+#include <lib/energy.h>
+
+#define NUM_ALARMS 64
+
+#ifndef MAX_SLACK
+#define MAX_SLACK 200
+#endif
+
+static Alarm_t alarms[NUM_ALARMS];
+static uint32_t expected[NUM_ALARMS];
+static uint16_t slack[NUM_ALARMS];
+static bool active[NUM_ALARMS];
+static uint32_t fired, late, spurious;
+
+static uint32_t randomTimeout(void)
+{
+    // mostly short timeouts, some long ones
+    switch (randomNumberBounded(8)) {
+    case 0: return 0;
+    case 1: return (uint32_t) randomNumberBounded(2000) * 1000;
+    case 2: return randomNumberBounded(60000);
+    default: return randomNumberBounded(1000);
+    }
+}
+
+static void start(uint16_t i)
+{
+    uint32_t timeout = randomTimeout();
+    expected[i] = (uint32_t) getJiffies() + timeout;
+    slack[i] = MAX_SLACK ? randomNumberBounded(MAX_SLACK + 1) : 0;
+    active[i] = true;
+    alarmScheduleWithSlack(&alarms[i], timeout, slack[i]);
+}
+
+static void onAlarm(void *param)
+{
+    uint16_t i = (uint16_t) (uintptr_t) param;
+    uint32_t now = (uint32_t) getJiffies();
+
+    if (!active[i]) spurious++;
+    else if (now - expected[i] > slack[i]) late++;
+    active[i] = false;
+    fired++;
+
+    // reschedule this one, and disturb another
+    start(i);
+    i = randomNumberBounded(NUM_ALARMS);
+    if (randomNumberBounded(2)) {
+        alarmRemove(&alarms[i]);
+        active[i] = false;
+    } else {
+        start(i);
+    }
+}
+
+void appMain(void)
+{
+    uint16_t i;
+    for (i = 0; i < NUM_ALARMS; ++i) {
+        alarmInit(&alarms[i], onAlarm, (void *) (uintptr_t) i);
+        start(i);
+    }
+
+    for (;;) {
+        msleep(10000);
+        PRINTF("%lu: %lu alarms fired, %lu late, %lu spurious\n",
+                (unsigned long) getJiffies(), (unsigned long) fired,
+                (unsigned long) late, (unsigned long) spurious);
+#if USE_ENERGY_STATS
+        PRINTF("  %lu wakeups\n", (unsigned long) energyWakeups);
+#endif
+    }
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//  CSMA MAC with ACKs, link statistics test for the pc simulator (USE_PC_SIM).
+//  Mote 1 sends and forwards packets towards a root through mote 2, its
+//  parent, the way the network stack does. At the end both check that the ACKs were counted
+//  for the right neighbor: received ones for the parent, sent ones for the
+//  child. Mote 1 also checks that the ETX quality of the link to its parent,
+//  computed from these counts, stays perfect.
+//-----------------------------------------------------------------------------
+
+#include "stdmansos.h"
+#include <net/mac.h>
+#include <net/net_stats.h>
+#include <net/radio_packet_buffer.h>
+#include <net/routing.h>
+
+#define SEND_INTERVAL 1000 // ms
+#define PACKET_COUNT  20
+#define TEST_TIME     ((PACKET_COUNT + 5) * SEND_INTERVAL)
+
+#define CHILD       1
+#define PARENT      2
+// not in the simulation
+#define GRANDCHILD  0x0003
+#define ROOT        0x0100
+
+// needed by the MAC, normally in networking.c
+void fillLocalAddress(MosAddr *result)
+{
+    intToAddr(result[0], localAddress);
+}
+
+static Alarm_t sendAlarm;
+static Alarm_t endAlarm;
+static uint16_t counter;
+static uint16_t received;
+static uint8_t outQuality;
+static uint8_t minOutQuality = 255;
+static uint32_t lastSent;
+static uint32_t lastAcked;
+
+static void recvCb(MacInfo_t *mi, uint8_t *data, uint16_t len)
+{
+    received++;
+}
+
+// what the kernel does with threads: read the frame, then let the MAC see it
+static void radioRecvCb(void)
+{
+    if (isRadioPacketReceived()) {
+        radioDiscard();
+        return;
+    }
+    radioPacketBuffer->receivedLength = radioRecv(
+            radioPacketBuffer->buffer, radioPacketBuffer->bufferLength);
+    macProtocol.poll();
+}
+
+static LinkQuality_t *findLink(MosShortAddr addr)
+{
+    uint8_t i;
+    for (i = 0; i < linqNeighborCount; i++) {
+        if (linq[i].addr == addr) return &linq[i];
+    }
+    return NULL;
+}
+
+// what ETX routing does with the link to its parent
+static void updateOutQuality(void)
+{
+    LinkQuality_t *parent = findLink(PARENT);
+    if (!parent || parent->sent - lastSent < 4) return;
+    outQuality = etxOutQuality(outQuality,
+            parent->sent - lastSent, parent->recvAck - lastAcked);
+    lastSent = parent->sent;
+    lastAcked = parent->recvAck;
+    if (outQuality < minOutQuality) minOutQuality = outQuality;
+}
+
+static void sendTimerCallback(void *param)
+{
+    MacInfo_t macInfo, *mi = &macInfo;
+    updateOutQuality();
+    memset(mi, 0, sizeof(*mi));
+    // every other packet is forwarded for a child of this mote
+    mi->originalSrc.shortAddr = counter & 1 ? GRANDCHILD : localAddress;
+    mi->originalDst.shortAddr = ROOT;
+    mi->immedSrc.shortAddr = localAddress;
+    mi->immedDst.shortAddr = PARENT;
+    if (mi->originalSrc.shortAddr == localAddress) {
+        mi->flags |= MI_FLAG_LOCALLY_ORIGINATED;
+    }
+    // as networking.c does
+    INC_NETSTAT(NETSTAT_PACKETS_SENT, getNexthop(mi));
+    macSendEx(mi, (uint8_t *) &counter, sizeof(counter));
+
+    if (++counter < PACKET_COUNT) {
+        alarmSchedule(&sendAlarm, SEND_INTERVAL);
+    }
+}
+
+static void check(const char *what, bool ok)
+{
+    PRINTF("%#04x: %s: %s\n", localAddress, what, ok ? "OK" : "FAILED");
+}
+
+static void endTimerCallback(void *param)
+{
+    LinkQuality_t *parent = findLink(PARENT);
+    LinkQuality_t *child = findLink(CHILD);
+
+    PRINT_LINQ();
+    if (localAddress == CHILD) {
+        check("ACKs counted for the parent", parent
+                && parent->sent == PACKET_COUNT
+                && parent->recvAck == PACKET_COUNT);
+        check("no ACKs counted for others",
+                (!child || !child->recvAck) && !findLink(ROOT)
+                && !findLink(GRANDCHILD));
+        updateOutQuality();
+        PRINTF("%#04x: link quality to the parent %u, lowest %u\n",
+                localAddress, outQuality, minOutQuality);
+        check("ETX link quality", outQuality == 255 && minOutQuality == 255);
+    } else if (localAddress == PARENT) {
+        check("packets received", received == PACKET_COUNT);
+        check("ACKs counted for the child", child
+                && child->sentAck == PACKET_COUNT);
+        check("no ACKs counted for others", !findLink(ROOT)
+                && !findLink(GRANDCHILD) && (!parent || !parent->sentAck));
+    }
+}
+
+void appMain(void)
+{
+    radioSetReceiveHandle(radioRecvCb);
+    macProtocol.init(recvCb);
+
+    alarmInit(&endAlarm, endTimerCallback, NULL);
+    alarmSchedule(&endAlarm, TEST_TIME);
+    if (localAddress == CHILD) {
+        alarmInit(&sendAlarm, sendTimerCallback, NULL);
+        alarmSchedule(&sendAlarm, SEND_INTERVAL);
+    }
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//  Low-power listening MAC test for the pc simulator (USE_PC_SIM).
+//  Mote 1 sends a counter to mote 2 every second, as unicast and then as
+//  broadcast; mote 2 counts what it gets. At the end both check that:
+//  - every packet got through the strobes while the receiver was asleep
+//    most of the time;
+//  - unicast trains were cut short by early ACKs;
+//  - repeated strobes were not passed up more than once.
+//-----------------------------------------------------------------------------
+
+#include "stdmansos.h"
+#include <net/mac.h>
+#include <net/net_stats.h>
+#include <net/radio_packet_buffer.h>
+
+#define SEND_INTERVAL 1000 // ms
+#define PACKET_COUNT  20   // of each kind
+#define TEST_TIME     ((2 * PACKET_COUNT + 10) * SEND_INTERVAL)
+
+#define SENDER    1
+#define RECEIVER  2
+
+// needed by the MAC, normally in networking.c
+void fillLocalAddress(MosAddr *result)
+{
+    intToAddr(result[0], localAddress);
+}
+
+static Alarm_t sendAlarm;
+static Alarm_t endAlarm;
+static uint16_t counter;
+static uint16_t received;
+static uint16_t duplicates;
+static uint16_t lastCounter = 0xffff;
+static uint32_t unicastStrobes;
+
+static void recvCb(MacInfo_t *mi, uint8_t *data, uint16_t len)
+{
+    uint16_t c;
+    if (len < sizeof(c)) return;
+    memcpy(&c, data, sizeof(c));
+    if (c == lastCounter) duplicates++;
+    else received++;
+    lastCounter = c;
+}
+
+// what the kernel does with threads: read the frame, then let the MAC see it
+static void radioRecvCb(void)
+{
+    if (isRadioPacketReceived()) {
+        radioDiscard();
+        return;
+    }
+    radioPacketBuffer->receivedLength = radioRecv(
+            radioPacketBuffer->buffer, radioPacketBuffer->bufferLength);
+    macProtocol.poll();
+}
+
+static void sendTimerCallback(void *param)
+{
+    MacInfo_t mi;
+    if (counter == PACKET_COUNT) {
+        // the unicasts are done
+        unicastStrobes = netstats[NETSTAT_RADIO_TX];
+    }
+    memset(&mi, 0, sizeof(mi));
+    mi.originalSrc.shortAddr = localAddress;
+    mi.originalDst.shortAddr = counter < PACKET_COUNT ?
+            RECEIVER : MOS_ADDR_BROADCAST;
+    mi.flags |= MI_FLAG_LOCALLY_ORIGINATED;
+    macSendEx(&mi, (uint8_t *) &counter, sizeof(counter));
+
+    if (++counter < 2 * PACKET_COUNT) {
+        alarmSchedule(&sendAlarm, SEND_INTERVAL);
+    }
+}
+
+static void check(const char *what, bool ok)
+{
+    PRINTF("%#04x: %s: %s\n", localAddress, what, ok ? "OK" : "FAILED");
+}
+
+static void endTimerCallback(void *param)
+{
+    uint32_t onTime = macLplRadioOnTime();
+    // a train lasts a whole wake interval, unless an ACK ends it
+    const uint32_t fullTrain = (MAC_LPL_WAKE_INTERVAL + MAC_LPL_LISTEN_TIME)
+            / MAC_LPL_STROBE_GAP;
+
+    PRINTF("%#04x: radio on %lu of %lu ms\n", localAddress,
+            onTime, (uint32_t) getTimeMs());
+    if (localAddress == SENDER) {
+        uint32_t acks = netstats[NETSTAT_PACKETS_ACK_RX];
+        PRINTF("%#04x: %lu strobes for %u unicasts, %lu ACKs; %lu strobes for %u broadcasts\n",
+                localAddress, unicastStrobes, PACKET_COUNT, acks,
+                netstats[NETSTAT_RADIO_TX] - unicastStrobes, PACKET_COUNT);
+        check("unicasts ACKed", acks >= PACKET_COUNT);
+        // a train that was not ended early is sent again
+        check("early ACK", netstats[NETSTAT_PACKETS_RTX] == 0
+                && unicastStrobes < PACKET_COUNT * fullTrain);
+    } else if (localAddress == RECEIVER) {
+        PRINTF("%#04x: received %u of %u, %u duplicates, %lu frames heard\n",
+                localAddress, received, 2 * PACKET_COUNT, duplicates,
+                netstats[NETSTAT_RADIO_RX]);
+        check("strobes received", received == 2 * PACKET_COUNT);
+        check("duplicates suppressed", duplicates == 0
+                && netstats[NETSTAT_RADIO_RX] > received);
+        check("duty cycle", onTime < getTimeMs() / 4);
+    }
+}
+
+void appMain(void)
+{
+    radioSetReceiveHandle(radioRecvCb);
+    macProtocol.init(recvCb);
+
+    alarmInit(&endAlarm, endTimerCallback, NULL);
+    alarmSchedule(&endAlarm, TEST_TIME);
+    if (localAddress == SENDER) {
+        alarmInit(&sendAlarm, sendTimerCallback, NULL);
+        alarmSchedule(&sendAlarm, SEND_INTERVAL);
+    }
+}
@@ -0,0 +1,63 @@
+//
+// Low-power listening MAC test: a mote sends a counter to the base station
+// every few seconds, and both print how long their radio has been on.
+//
+
+#include "stdmansos.h"
+#include <net/socket.h>
+#include <net/routing.h>
+
+enum { DATA_PORT  = 123 };
+#define SLEEP_TIME_MS 5000
+
+static void printRadioOnTime(void)
+{
+    uint32_t now = getTimeMs();
+    uint32_t onTime = macLplRadioOnTime();
+    PRINTF("radio on %lu of %lu ms (%lu.%lu%%)\n", onTime, now,
+            onTime * 100 / now, onTime * 1000 / now % 10);
+}
+
+#if USE_ROLE_BASE_STATION
+
+static void recvData(Socket_t *socket, uint8_t *data, uint16_t len)
+{
+    PRINTF("got %d bytes from 0x%04x (0x%02x)\n",
+            len, socket->recvMacInfo->originalSrc.shortAddr, *data);
+    redLedToggle();
+}
+
+void appMain(void)
+{
+    Socket_t socket;
+    socketOpen(&socket, recvData);
+    socketBind(&socket, DATA_PORT);
+
+    for (;;) {
+        msleep(SLEEP_TIME_MS);
+        printRadioOnTime();
+    }
+}
+
+#else
+
+void appMain(void)
+{
+    Socket_t socket;
+    socketOpen(&socket, NULL);
+    socketBind(&socket, DATA_PORT);
+    socketSetDstAddress(&socket, MOS_ADDR_ROOT);
+
+    uint16_t counter = 0;
+    for (;;) {
+        msleep(SLEEP_TIME_MS);
+        PRINTF("sending counter %u\n", counter);
+        if (socketSend(&socket, &counter, sizeof(counter))) {
+            PRINTF("socketSend failed\n");
+        }
+        ++counter;
+        printRadioOnTime();
+    }
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Random allocations and frees of mixed sizes. Each block is filled
+// with its index and checked before it is freed, to catch overlapping
+// blocks. Set USE_MEMORY_POOLS=n to compare with the plain heap.
+// With USE_MEMORY_PROFILE=y, run on pc with MANSOS_MEM_TRACE=<file>
+// to record a trace for tools/memreplay.
+//
+
+#include "stdmansos.h"
+#include <random.h>
+#include <dynamic_memory.h>
+
+#define NUM_BLOCKS 48
+#define ROUNDS     20000
+
+static uint32_t heap[4096 / sizeof(uint32_t)];
+static uint8_t *blocks[NUM_BLOCKS];
+static uint16_t sizes[NUM_BLOCKS];
+
+static uint16_t randomSize(void)
+{
+    // mostly small, packet-sized blocks
+    if (randomNumberBounded(8) == 0) return 100 + randomNumberBounded(200);
+    return 1 + randomNumberBounded(64);
+}
+
+static bool check(uint16_t i)
+{
+    uint16_t j;
+    for (j = 0; j < sizes[i]; ++j) {
+        if (blocks[i][j] != (uint8_t) i) return false;
+    }
+    return true;
+}
+
+void appMain(void)
+{
+    uint32_t round, corrupt = 0, failed = 0;
+    uint32_t start = (uint32_t) getJiffies();
+
+    memoryInit(heap, sizeof(heap));
+
+    for (round = 0; round < ROUNDS; ++round) {
+        uint16_t i = randomNumberBounded(NUM_BLOCKS);
+        if (blocks[i]) {
+            if (!check(i)) corrupt++;
+            memoryFree(blocks[i]);
+            blocks[i] = NULL;
+        } else {
+            sizes[i] = randomSize();
+            blocks[i] = memoryAlloc(sizes[i]);
+            if (blocks[i]) memset(blocks[i], i, sizes[i]);
+            else failed++;
+        }
+    }
+
+    PRINTF("%lu rounds in %lu ms: %lu corrupt, %lu out of memory\n",
+            (unsigned long) ROUNDS, (unsigned long) getJiffies() - start,
+            (unsigned long) corrupt, (unsigned long) failed);
+#if USE_MEMORY_PROFILE
+    memoryProfileDump();
+#else
+    memoryStatsDump();
+#endif
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//  Test for the pc simulator of many motes (USE_PC_SIM).
+//  Each mote broadcasts its counter every second, counts the packets
+//  it hears, and periodically prints the statistics.
+//-----------------------------------------------------------------------------
+
+#include "stdmansos.h"
+#include <random.h>
+
+#define SEND_INTERVAL   1000 // ms
+#define REPORT_INTERVAL 10 // in send intervals
+
+static Alarm_t sendAlarm;
+static uint16_t counter;
+static uint16_t received;
+
+static void sendTimerCallback(void *param)
+{
+    radioSend(&counter, sizeof(counter));
+    ++counter;
+    if (counter % REPORT_INTERVAL == 0) {
+        PRINTF("%#04x: %u packets heard in %u s\n",
+                localAddress, received, counter);
+    }
+    // add some jitter so that the motes do not transmit all at once
+    alarmSchedule(&sendAlarm, SEND_INTERVAL - 50 + randomNumber() % 100);
+}
+
+static void recvCounter(void)
+{
+    uint16_t buffer[4];
+    if (radioRecv(buffer, sizeof(buffer)) > 0) {
+        received++;
+    }
+}
+
+void appMain(void)
+{
+    radioSetReceiveHandle(recvCounter);
+    radioOn();
+
+    alarmInit(&sendAlarm, sendTimerCallback, NULL);
+    alarmSchedule(&sendAlarm, randomNumber() % SEND_INTERVAL);
+}
@@ -31,6 +31,7 @@
 // Comments may start with COMMENT_CHAR and stop at the end of line.
 
 #include "adc_hal.h"
+#include <platform.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/types.h>
@@ -57,8 +58,8 @@ typedef enum {
 // indicates whether ADC value file was successfully red
 static bool adcOk = false;
 
-// array with cached values
-static uint16_t values[PC_ADC_CHANNEL_COUNT][ADC_VALUE_COUNT_FOR_CH];
+// array with cached values (read from the same file by all motes)
+static uint16_t values[PC_ADC_CHANNEL_COUNT][ADC_VALUE_COUNT_FOR_CH] PC_SIM_SHARED;
 
 // currently cached values for each channel
 static uint16_t valueCount[PC_ADC_CHANNEL_COUNT];
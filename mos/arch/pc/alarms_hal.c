@@ -47,6 +47,10 @@ static uint32_t getPcTime(void)
 //----------------------------------------------------------
 
 void *alarmIntHandler(void *dummy) {
+#ifdef USE_ADDRESSING
+    // in virtual time alarms are processed by the sleeping main thread
+    if (pcVirtualTime) return 0;
+#endif
     uint32_t lastTime = getPcTime();
     while (1) {
         usleep(10000);
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PC_CLOUD_PROTOCOL_H
+#define PC_CLOUD_PROTOCOL_H
+
+//
+// Wire format used between "pc" platform motes and the pc-cloud.
+// Shared by the mote side (net_hal.c, radio_hal.c) and by tools/pc-cloud,
+// so it must not depend on any other MansOS headers.
+//
+// Each frame on the TCP stream is a PcRadioPackSize_t length
+// (in host byte order) followed by exactly that many bytes:
+// a PcCloudHeader_t and the frame payload.
+//
+
+#include <stdint.h>
+
+enum {
+    PROXY_SERVER_PORT = 6293, // TCP port where sockets subscribe to cloud
+    MAX_PACKET_SIZE = 1024,
+};
+
+typedef uint16_t PcRadioPackSize_t;
+
+typedef struct PcCloudHeader_s {
+    uint8_t type;     // one of PC_CLOUD_* frame types
+    uint8_t channel;  // radio channel
+    int8_t rssi;      // signal strength at the receiver (cloud -> mote only)
+    uint8_t lqi;      // link quality at the receiver (cloud -> mote only)
+} PcCloudHeader_t;
+
+// frame types
+enum {
+    // a radio packet; payload: the packet
+    PC_CLOUD_DATA = 1,
+    // mote -> cloud, sent once after connecting;
+    // payload: the uint16_t address of the mote
+    PC_CLOUD_HELLO,
+    // mote -> cloud, the mote has switched to the channel in the header;
+    // no payload
+    PC_CLOUD_SET_CHANNEL,
+    // cloud -> mote, a transmission can be heard on the channel;
+    // payload: uint32_t transmission duration in microseconds
+    PC_CLOUD_CARRIER,
+
+    // Virtual time (pc-cloud -s). A mote runs only when told to; time
+    // does not pass while any mote is running.
+
+    // cloud -> mote, the virtual clock is now at the uint64_t payload
+    // (microseconds); always sent before the frames delivered at that time
+    PC_CLOUD_CLOCK,
+    // cloud -> mote, run until idle; no payload
+    PC_CLOUD_RUN,
+    // mote -> cloud, the mote has nothing to do until the uint64_t
+    // payload time (microseconds), unless it receives a packet
+    PC_CLOUD_IDLE,
+};
+
+#endif
@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <poll.h>
 #include <fcntl.h>
@@ -35,6 +36,9 @@
 #include <pthread.h>
 #include "sem_hal.h"
 #include <unistd.h>
+#include <stdlib.h>
+#include "vtime_hal.h"
+#include "shm_hal.h"
 
 //----------------------------------------------------------
 // constants
@@ -99,6 +103,18 @@ static pthread_t intThread;
 
 // simulate interrupt handler in separate thread
 void *intHandler(void *dummy) {
+    if (pcShmConnect()) {
+        // no sockets: frames are passed through shared memory
+        const char *addrString = getenv("MANSOS_ADDRESS");
+        localAddress = addrString ? strtol(addrString, NULL, 0) : getpid();
+        PRINTF("set local address to 0x%04x\n", localAddress);
+        pcRadioSendFrame(PC_CLOUD_HELLO, NULL, 0,
+                &localAddress, sizeof(localAddress));
+        pcShmReceiveLoop();
+        if (pcVirtualTime) exit(1);
+        return NULL;
+    }
+
     if (makeSocketPair() != 0) {
         PRINTF("cannot create outgoing socket pair!\n");
         return NULL;
@@ -108,9 +124,20 @@ void *intHandler(void *dummy) {
     // do not break job, when cannot connect to cloud
     // alarms should still work just fine
     // if (cloudSock <= 0) return NULL;
+    if (cloudSock == -1 && pcVirtualTime) {
+        // ...but virtual time cannot go on without the cloud
+        PRINTF("virtual time is not possible without the cloud\n");
+        exit(1);
+    }
 
-    // setup local address (use local port number for the moment)
-    if (cloudSock != -1) {
+    // setup local address: either given in the environment
+    // (needed to place the mote in a pc-cloud topology),
+    // or the local port number
+    const char *addrString = getenv("MANSOS_ADDRESS");
+    if (addrString) {
+        localAddress = strtol(addrString, NULL, 0);
+        PRINTF("set local address to 0x%04x\n", localAddress);
+    } else if (cloudSock != -1) {
         struct sockaddr_in saddr;
         socklen_t slen = sizeof(saddr);
         if (getsockname(cloudSock, (struct sockaddr *) &saddr, &slen) == 0) {
@@ -118,6 +145,11 @@ void *intHandler(void *dummy) {
             PRINTF("set local address to port number: 0x%04x\n", localAddress);
         }
     }
+    if (cloudSock != -1) {
+        // introduce ourselves to the cloud
+        pcRadioSendFrame(PC_CLOUD_HELLO, NULL, 0,
+                &localAddress, sizeof(localAddress));
+    }
 
     // poll for incoming data. outgoing data also treated as "incoming", because
     // it comes from the socket pair
@@ -139,7 +171,7 @@ void *intHandler(void *dummy) {
                     return NULL;
                 }
                 pcRadioBufLen = l;
-                if (pcRadioIsOn && pcRadioCallback) {
+                if (pcRadioProcessFrame() && pcRadioIsOn && pcRadioCallback) {
                     pcRadioCallback();
                 }
             }
@@ -148,8 +180,10 @@ void *intHandler(void *dummy) {
                 int16_t l = pcRadioRecvPack(mosSendPairSock, mosOutBuf,
                         sizeof(mosOutBuf));
                 if (l > 0) {
-                    // start polling cloud for data write only
+                    // start polling cloud for data write only;
+                    // do not take the next frame until this one is sent
                     pollFd[0].events = POLLOUT;
+                    pollFd[1].events = 0;
                     mosOutBufOffset = 0;
                     mosOutBufLen = l;
                 } else if (l < 0) {
@@ -166,6 +200,7 @@ void *intHandler(void *dummy) {
                     if (mosOutBufLen == 0) {
                         // all data sent, stop write-polling
                         pollFd[0].events = POLLIN;
+                        pollFd[1].events = POLLIN;
                         // TODO - post a semaphore to notify radioSend caller?
                     } else {
                         // some bytes left to send, update offset
@@ -196,23 +231,33 @@ int16_t pcRadioRecvPack(int sock, void *buf, uint16_t bufLen) {
     if (readExactly(sock, buf, sizeof(PcRadioPackSize_t))
             != sizeof(PcRadioPackSize_t)) return -1;
     PcRadioPackSize_t len = *((PcRadioPackSize_t *) buf);
+    if (len > bufLen - sizeof(PcRadioPackSize_t)) {
+        PRINTF("socket %i: packet too long (%u bytes)\n", sock, len);
+        return -1;
+    }
     int16_t r = readExactly(sock, buf + sizeof(PcRadioPackSize_t), len);
     return r > 0 ? r + sizeof(PcRadioPackSize_t) : r;
 }
 
 // read until exactly len bytes from socket
-// return len + sizeof(PcRadioPackSize_t) or -1 on error
+// (a stream socket may return a packet in several pieces)
+// return len or -1 on error
 int16_t readExactly(int sock, void *buf, uint16_t len) {
-    if (len == 0) return 0;
-    int16_t l = read(sock, buf, len);
-    if (l == 0) {
-        PRINTF("socket %i disconnected\n", sock);
-        return -1;
-    }
-    if (l < 0) {
-        PRINTF("socket %i reading error: %s\n", sock, strerror(errno));
+    uint16_t done = 0;
+    while (done < len) {
+        int16_t l = read(sock, (unsigned char *) buf + done, len - done);
+        if (l == 0) {
+            PRINTF("socket %i disconnected\n", sock);
+            return -1;
+        }
+        if (l < 0) {
+            if (errno == EINTR) continue;
+            PRINTF("socket %i reading error: %s\n", sock, strerror(errno));
+            return -1;
+        }
+        done += l;
     }
-    return l;
+    return done;
 }
 
 int16_t pcRadioSend(int sock, const void *buf, uint16_t bufLen) {
@@ -257,6 +302,8 @@ int connectSock(unsigned port) {
         close(sock);
         return -1;
     }
+    // frames are small and latency matters (especially in virtual time)
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
     return sock;
 }
 
@@ -284,4 +331,7 @@ void networkingInitArch(void)
     // create it even, when threads are turned off
     pthread_create(&intThread, NULL, intHandler, NULL);
     // initialization of alarmIntHandler moved to alarms_hal.c
+
+    // in virtual time, start the application when the cloud says so
+    if (pcVirtualTime) pcVirtualTimeWaitRun();
 }
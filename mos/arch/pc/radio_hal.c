@@ -25,10 +25,19 @@
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
 #include <sem_hal.h>
 #include <fcntl.h>
 #include <radio.h>
 #include <print.h>
+#include "vtime_hal.h"
+#include "shm_hal.h"
+
+// offset of the radio packet in a received frame
+#define PC_RADIO_DATA_OFFSET (sizeof(PcRadioPackSize_t) + sizeof(PcCloudHeader_t))
+
+// RSSI reported when nothing is heard on the channel
+#define PC_RADIO_NOISE_FLOOR -100
 
 RadioRecvFunction pcRadioCallback;
 unsigned char pcRadioBuf[MAX_PACKET_SIZE];
@@ -36,12 +45,31 @@ uint16_t pcRadioBufLen;
 bool pcRadioIsOn = false;
 pthread_mutex_t pcRadioSendMutex;
 bool pcRadioInitialized;
+uint8_t pcRadioChannel = RADIO_CHANNEL;
+
+// signal of the last received packet
+static int8_t pcRadioLastRssi;
+static uint8_t pcRadioLastLqi;
+// the channel is busy until this time (in microseconds), as told by the cloud
+static uint64_t pcRadioBusyUntil;
+static int8_t pcRadioCarrierRssi;
 
 // TODO: remake this;
 // at the moment it's here only so that USE_RADIO on PC
 // can be enabled witout enabling USE_NET.
 int mosSendSock = -1;
 
+static uint64_t pcRadioTimeUs(void) {
+#if USE_PC_SIM
+    return pcSimTimeUs();
+#elif defined USE_ADDRESSING
+    if (pcVirtualTime) return pcVirtualTimeUs();
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 void pcRadioInit(void) {
     if (pcRadioInitialized) return;
     pcRadioInitialized = true;
@@ -53,40 +81,127 @@ void pcRadioReinit(void) {
     // do nothing
 }
 
-int8_t pcRadioSendHeader(const void *header, uint16_t headerLength,
-                       const void *data, uint16_t dataLength) {
-    // first byte(s) in the packet is packet size
+// send a frame to the cloud (through the interrupt handler thread)
+int8_t pcRadioSendFrame(uint8_t type, const void *header, uint16_t headerLength,
+                        const void *data, uint16_t dataLength) {
+    // first byte(s) in the packet is packet size, followed by cloud header
     union {
         unsigned char buf[MAX_PACKET_SIZE + sizeof(PcRadioPackSize_t)];
         PcRadioPackSize_t msgLength;
     } tmpBuf;
+    PcCloudHeader_t cloudHeader;
     uint16_t len, done;
 
+    if (sizeof(cloudHeader) + headerLength + dataLength > MAX_PACKET_SIZE) {
+        return -1;
+    }
+    cloudHeader.type = type;
+    cloudHeader.channel = pcRadioChannel;
+    cloudHeader.rssi = 0;
+    cloudHeader.lqi = 0;
+
+#if defined USE_ADDRESSING && !USE_PC_SIM
+    if (pcShmConnected) {
+        // written straight to the shared ring, no intermediate copies
+        const void *pieces[3] = { &cloudHeader, header, data };
+        unsigned lengths[3] = { sizeof(cloudHeader), headerLength, dataLength };
+        int8_t result;
+        pthread_mutex_lock(&pcRadioSendMutex);
+        result = pcShmSendFrame(pieces, lengths, 3);
+        pthread_mutex_unlock(&pcRadioSendMutex);
+        return result;
+    }
+#endif
+#if !USE_PC_SIM
     if (mosSendSock < 0) return -1;
+#endif
 
     // only one can send at a time
     pthread_mutex_lock(&pcRadioSendMutex);
 
     // set length in first byte(s)
-    tmpBuf.msgLength = headerLength + dataLength;
+    tmpBuf.msgLength = sizeof(cloudHeader) + headerLength + dataLength;
+    len = sizeof(PcRadioPackSize_t);
+    memcpy(tmpBuf.buf + len, &cloudHeader, sizeof(cloudHeader));
+    len += sizeof(cloudHeader);
     // copy msg
     if (headerLength) {
-        memcpy(tmpBuf.buf + sizeof(PcRadioPackSize_t), header, headerLength);
+        memcpy(tmpBuf.buf + len, header, headerLength);
+        len += headerLength;
     }
-    memcpy(tmpBuf.buf + headerLength + sizeof(PcRadioPackSize_t), data, dataLength);
-    
+    if (dataLength) {
+        memcpy(tmpBuf.buf + len, data, dataLength);
+        len += dataLength;
+    }
+
+#if USE_PC_SIM
+    // delivered in memory
+    (void) done;
+    pthread_mutex_unlock(&pcRadioSendMutex);
+    return pcSimSendFrame(tmpBuf.buf, len);
+#else
     // send until done
-    len = sizeof(PcRadioPackSize_t) + headerLength + dataLength;
     done = 0;
-
-    int16_t l = write(mosSendSock, tmpBuf.buf + done, len - done);
-    if (l < 0) {
-        perror("radioSendHeader write");
-    } else if (l == 0) {
-        PRINTF("radioSendHeader: EOF on socket\n");
+    while (done < len) {
+        int16_t l = write(mosSendSock, tmpBuf.buf + done, len - done);
+        if (l < 0) {
+            if (errno == EINTR) continue;
+            perror("radioSendHeader write");
+            break;
+        } else if (l == 0) {
+            PRINTF("radioSendHeader: EOF on socket\n");
+            break;
+        }
+        done += l;
     }
     pthread_mutex_unlock(&pcRadioSendMutex);
     return 0;
+#endif
+}
+
+int8_t pcRadioSendHeader(const void *header, uint16_t headerLength,
+                       const void *data, uint16_t dataLength) {
+    if (!pcRadioIsChannelClear()) return -EBUSY;
+    return pcRadioSendFrame(PC_CLOUD_DATA, header, headerLength,
+            data, dataLength);
+}
+
+// called from the interrupt handler thread with a frame received from the cloud;
+// return true if it contains a radio packet
+bool pcRadioProcessFrame(void) {
+    PcCloudHeader_t cloudHeader;
+    uint32_t duration;
+
+    if (pcRadioBufLen < PC_RADIO_DATA_OFFSET) return false;
+    memcpy(&cloudHeader, pcRadioBuf + sizeof(PcRadioPackSize_t),
+            sizeof(cloudHeader));
+
+    switch (cloudHeader.type) {
+    case PC_CLOUD_DATA:
+        pcRadioLastRssi = cloudHeader.rssi;
+        pcRadioLastLqi = cloudHeader.lqi;
+        return true;
+    case PC_CLOUD_CARRIER:
+        if (pcRadioBufLen < PC_RADIO_DATA_OFFSET + sizeof(duration)) break;
+        memcpy(&duration, pcRadioBuf + PC_RADIO_DATA_OFFSET, sizeof(duration));
+        pcRadioBusyUntil = pcRadioTimeUs() + duration;
+        pcRadioCarrierRssi = cloudHeader.rssi;
+        break;
+#if defined USE_ADDRESSING && !USE_PC_SIM
+    case PC_CLOUD_CLOCK: {
+        uint64_t time;
+        if (pcRadioBufLen < PC_RADIO_DATA_OFFSET + sizeof(time)) break;
+        memcpy(&time, pcRadioBuf + PC_RADIO_DATA_OFFSET, sizeof(time));
+        pcVirtualTimeSet(time);
+        break;
+    }
+    case PC_CLOUD_RUN:
+        pcVirtualTimeRun();
+        break;
+#endif
+    }
+    pcRadioBufLen = 0;
+    return false;
 }
 
 int16_t pcRadioRecv(void *buffer, uint16_t buffLen) {
@@ -95,12 +210,12 @@ int16_t pcRadioRecv(void *buffer, uint16_t buffLen) {
         return 0;
     }
 
-    if (pcRadioBufLen <= sizeof(PcRadioPackSize_t)) return 0;
+    if (pcRadioBufLen <= PC_RADIO_DATA_OFFSET) return 0;
 
     // copy min(bufLen, redBytes) from pcRadio buffer to dst buffer
-    uint16_t len = pcRadioBufLen - sizeof(PcRadioPackSize_t);
+    uint16_t len = pcRadioBufLen - PC_RADIO_DATA_OFFSET;
     if (len > buffLen) len = buffLen;
-    memcpy(buffer, pcRadioBuf + sizeof(PcRadioPackSize_t), len);
+    memcpy(buffer, pcRadioBuf + PC_RADIO_DATA_OFFSET, len);
     pcRadioBufLen = 0;
     return len;
 }
@@ -125,19 +240,24 @@ void pcRadioOff(void) {
 }
 
 int pcRadioGetRSSI(void) {
-    return 0;
+    if (pcRadioIsChannelClear()) return PC_RADIO_NOISE_FLOOR;
+    return pcRadioCarrierRssi;
 }
 
 int8_t pcRadioGetLastRSSI(void) {
-    return 0;
+    return pcRadioLastRssi;
 }
 
 uint8_t pcRadioGetLastLQI(void) {
-    return 0;
+    return pcRadioLastLqi;
 }
 
 void pcRadioSetChannel(int channel) {
-    return;
+    if (pcRadioChannel == channel) return;
+    pcRadioChannel = channel;
+    pcRadioBusyUntil = 0;
+    // the cloud delivers only packets sent on the same channel
+    pcRadioSendFrame(PC_CLOUD_SET_CHANNEL, NULL, 0, NULL, 0);
 }
 
 void pcRadioSetTxPower(uint8_t power) {
@@ -145,5 +265,5 @@ void pcRadioSetTxPower(uint8_t power) {
 }
 
 bool pcRadioIsChannelClear(void) {
-    return true;
+    return pcRadioTimeUs() >= pcRadioBusyUntil;
 }
@@ -42,4 +42,9 @@ void pcRadioSetChannel(int channel);
 void pcRadioSetTxPower(uint8_t power);
 bool pcRadioIsChannelClear(void);
 
+// internal: used by the cloud communication code in net_hal.c
+int8_t pcRadioSendFrame(uint8_t type, const void *header, uint16_t headerLength,
+                        const void *data, uint16_t dataLength);
+bool pcRadioProcessFrame(void);
+
 #endif
@@ -41,94 +41,95 @@
 
 static const uint8_t zeroSector[SDCARD_SECTOR_SIZE];
 
+// the image is kept open instead of being reopened for each access
+static int imageFd = -1;
+
+static bool openImage(void)
+{
+    if (imageFd < 0) {
+        imageFd = open(FILENAME, O_RDWR);
+    }
+    return imageFd >= 0;
+}
+
+static bool readImage(uint32_t addr, void *buffer, uint32_t len)
+{
+    ASSERT(addr + len <= SDCARD_SIZE);
+    if (!openImage()) return false;
+    return pread(imageFd, buffer, len, addr) == (ssize_t) len;
+}
+
+static bool writeImage(uint32_t addr, const void *buffer, uint32_t len)
+{
+    ASSERT(addr + len <= SDCARD_SIZE);
+    if (!openImage()) return false;
+    return pwrite(imageFd, buffer, len, addr) == (ssize_t) len;
+}
+
 bool sdcardInit(void)
 {
     PRINTF("Opening SDCARD image `" FILENAME "'...\n");
 
-    int data = open(FILENAME, O_RDONLY);
-    if (data < 0) {
+    if (!openImage()) {
         sdcardBulkErase();
     }
-    close(data);
-    return true;
+    return openImage();
 }
 
 bool sdcardReadBlock(uint32_t addr, void* buffer)
 {
-    ASSERT(addr + SDCARD_SECTOR_SIZE <= SDCARD_SIZE);
-
-    int data = open(FILENAME, O_RDONLY);
-    if (data < 0) return false;
-    lseek(data, addr, SEEK_SET);
-    size_t ret = read(data, buffer, SDCARD_SECTOR_SIZE);
-    close(data);
-    return ret == SDCARD_SECTOR_SIZE;
+    return readImage(addr, buffer, SDCARD_SECTOR_SIZE);
 }
 
 bool sdcardWriteBlock(uint32_t addr, const void *buffer)
 {
-    ASSERT(addr + SDCARD_SECTOR_SIZE <= SDCARD_SIZE);
-
-    int data = open(FILENAME, O_WRONLY);
-    if (data < 0) return false;
-    lseek(data, addr, SEEK_SET);
-    int ret = write(data, buffer, SDCARD_SECTOR_SIZE);
-    close(data);
-    return ret == SDCARD_SECTOR_SIZE;
+    return writeImage(addr, buffer, SDCARD_SECTOR_SIZE);
+}
+
+bool sdcardReadBlocks(uint32_t addr, void* buffer, uint16_t count)
+{
+    return readImage(addr, buffer, (uint32_t) count * SDCARD_SECTOR_SIZE);
+}
+
+bool sdcardWriteBlocks(uint32_t addr, const void *buffer, uint16_t count)
+{
+    return writeImage(addr, buffer, (uint32_t) count * SDCARD_SECTOR_SIZE);
 }
 
 void sdcardBulkErase(void)
 {
-    int data = creat(FILENAME, 0644);
-    ASSERT(data > 0);
+    if (imageFd >= 0) close(imageFd);
+    imageFd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT(imageFd >= 0);
     uint16_t i;
     for (i = 0; i < SDCARD_SECTOR_COUNT; ++i) {
-        int r = write(data, zeroSector, sizeof(zeroSector));
+        int r = write(imageFd, zeroSector, sizeof(zeroSector));
         (void) r;
     }
 }
 
 void sdcardEraseSector(uint32_t address)
 {
-    int data = open(FILENAME, O_WRONLY);
-    if (data < 0) return;
-    lseek(data, address, SEEK_SET);
-    int r = write(data, zeroSector, sizeof(zeroSector));
-    (void) r;
+    writeImage(address & ~(SDCARD_SECTOR_SIZE - 1), zeroSector, sizeof(zeroSector));
 }
 
-void sdcardRead(uint32_t addr, void *buf, uint16_t len)
+bool sdcardRead(uint32_t addr, void *buf, uint16_t len)
 {
-    ASSERT(addr + len <= SDCARD_SIZE);
-
-    int data = open(FILENAME, O_RDONLY);
-    if (data < 0) return;
-    int ret = lseek(data, addr, SEEK_SET);
-    size_t ret2 = read(data, buf, len);
-    ASSERT(ret == 0 && ret2 == len);
-    close(data);
+    return readImage(addr, buf, len);
 }
 
-void sdcardWrite(uint32_t addr, const void *buf, uint16_t len)
+bool sdcardWrite(uint32_t addr, const void *buf, uint16_t len)
 {
-    ASSERT(addr + len <= SDCARD_SIZE);
-
-    int data = open(FILENAME, O_WRONLY);
-    if (data < 0) return;
-
-    lseek(data, addr, SEEK_SET);
-    int r = write(data, buf, len);
-    (void) r;
-    close(data);
+    return writeImage(addr, buf, len);
 }
 
-void sdcardFlush(void)
+bool sdcardFlush(void)
 {
     // nothing
+    return true;
 }
 
 uint32_t sdcardGetSize(void)
 {
     return SDCARD_SECTOR_COUNT;
 }
- 
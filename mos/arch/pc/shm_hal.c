@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <radio.h>
+#include <print.h>
+#include "shm_ring.h"
+#include "shm_hal.h"
+
+bool pcShmConnected;
+unsigned long pcShmFramesDropped;
+
+// how long the sender waits for space in a full ring, in microseconds
+#define PC_SHM_SEND_POLL    100
+
+static PcShmRegion_t *region;
+static int cloudSock = -1;
+static int moteBell = -1;  // rung by the cloud
+static int cloudBell = -1; // rung by the mote
+
+extern RadioRecvFunction pcRadioCallback;
+extern unsigned char pcRadioBuf[MAX_PACKET_SIZE];
+extern uint16_t pcRadioBufLen;
+extern bool pcRadioIsOn;
+
+static void ringBell(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) {
+        PRINTF("shm: doorbell error: %s\n", strerror(errno));
+    }
+}
+
+// pass the region and the doorbells to the cloud
+static bool sendDescriptors(int memFd) {
+    int fds[3] = { memFd, moteBell, cloudBell };
+    char control[CMSG_SPACE(sizeof(fds))];
+    char dummy = 0;
+    struct iovec iov = { &dummy, sizeof(dummy) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(cloudSock, &msg, 0) == sizeof(dummy);
+}
+
+bool pcShmConnect(void) {
+    const char *env = getenv("MANSOS_SHM");
+    if (!env || !atoi(env)) return false;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, PC_CLOUD_SHM_PATH, sizeof(addr.sun_path) - 1);
+    cloudSock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (cloudSock < 0
+            || connect(cloudSock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        PRINTF("shm: cannot connect to cloud: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    int memFd = memfd_create("mansos-radio", 0);
+    if (memFd < 0 || ftruncate(memFd, sizeof(PcShmRegion_t)) < 0) {
+        PRINTF("shm: cannot create shared memory: %s\n", strerror(errno));
+        if (memFd >= 0) close(memFd);
+        goto fail;
+    }
+    region = mmap(NULL, sizeof(PcShmRegion_t), PROT_READ | PROT_WRITE,
+            MAP_SHARED, memFd, 0);
+    moteBell = eventfd(0, 0);
+    cloudBell = eventfd(0, EFD_NONBLOCK);
+    if (region == MAP_FAILED || moteBell < 0 || cloudBell < 0
+            || !sendDescriptors(memFd)) {
+        PRINTF("shm: setup failed: %s\n", strerror(errno));
+        close(memFd);
+        goto fail;
+    }
+    // the cloud has its own references now
+    close(memFd);
+    pcShmConnected = true;
+    PRINTF("connected to cloud through shared memory\n");
+    return true;
+
+  fail:
+    if (cloudSock >= 0) close(cloudSock);
+    cloudSock = -1;
+    return false;
+}
+
+int8_t pcShmSendFrame(const void *const *pieces, const unsigned *lengths,
+                      unsigned count) {
+    PcShmRing_t *r = &region->toCloud;
+    unsigned waited = 0;
+    while (!pcShmRingPut(r, pieces, lengths, count)) {
+        if (waited >= PC_SHM_SEND_TIMEOUT) {
+            // the cloud is stuck or gone; lose the frame like the air would
+            PRINTF("shm: ring full, frame dropped (%lu total)\n",
+                    ++pcShmFramesDropped);
+            return -EBUSY;
+        }
+        // the cloud is behind; it drains the ring without our help
+        if (pcShmRingNeedsWakeup(r)) ringBell(cloudBell);
+        usleep(PC_SHM_SEND_POLL);
+        waited += PC_SHM_SEND_POLL;
+    }
+    if (pcShmRingNeedsWakeup(r)) ringBell(cloudBell);
+    return 0;
+}
+
+void pcShmReceiveLoop(void) {
+    PcShmRing_t *r = &region->toMote;
+    struct pollfd pfd[2];
+    pfd[0].fd = moteBell;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = cloudSock;
+    pfd[1].events = POLLIN;
+
+    while (1) {
+        const unsigned char *frame = pcShmRingPeek(r);
+        if (!frame) {
+            if (!pcShmRingPrepareSleep(r)) continue;
+            if (poll(pfd, 2, -1) < 0 && errno != EINTR) {
+                PRINTF("shm: poll error: %s\n", strerror(errno));
+                return;
+            }
+            pcShmRingWakeUp(r);
+            if (pfd[1].revents) {
+                // nothing is ever sent on the socket; it is only closed
+                PRINTF("shm: cloud disconnected\n");
+                return;
+            }
+            if (pfd[0].revents & POLLIN) {
+                uint64_t value;
+                if (read(moteBell, &value, sizeof(value)) < 0) {
+                    PRINTF("shm: doorbell error: %s\n", strerror(errno));
+                }
+            }
+            continue;
+        }
+
+        PcRadioPackSize_t len;
+        memcpy(&len, frame, sizeof(len));
+        if (len + sizeof(len) > sizeof(pcRadioBuf)) {
+            PRINTF("shm: packet too long (%u bytes)\n", len);
+            return;
+        }
+        memcpy(pcRadioBuf, frame, sizeof(len) + len);
+        pcShmRingRelease(r, frame);
+        if (pcShmRingProducerWaits(r)) ringBell(cloudBell);
+
+        pcRadioBufLen = sizeof(len) + len;
+        if (pcRadioProcessFrame() && pcRadioIsOn && pcRadioCallback) {
+            pcRadioCallback();
+        }
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PC_SHM_HAL_H
+#define PC_SHM_HAL_H
+
+//
+// Shared memory transport to pc-cloud (see shm_ring.h).
+//
+// Used instead of the TCP connection when the mote is started with
+// MANSOS_SHM=1 in the environment and the cloud runs on the same machine.
+//
+
+#include <defines.h>
+
+// true if frames go through shared memory
+extern bool pcShmConnected;
+
+// connect to the cloud, if asked for in the environment;
+// return true on success
+bool pcShmConnect(void);
+
+// frames dropped because the ring stayed full
+extern unsigned long pcShmFramesDropped;
+
+// how long a send waits for the cloud to drain a full ring, in microseconds
+#ifndef PC_SHM_SEND_TIMEOUT
+#define PC_SHM_SEND_TIMEOUT 1000000
+#endif
+
+// send a frame made of `count` pieces (header and payload, without
+// the length prefix); waits while the ring is full, up to
+// PC_SHM_SEND_TIMEOUT, then drops the frame and returns -EBUSY
+int8_t pcShmSendFrame(const void *const *pieces, const unsigned *lengths,
+                      unsigned count);
+
+// receive and process frames from the cloud; returns when the
+// cloud disconnects. Called from the interrupt handler thread
+void pcShmReceiveLoop(void);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PC_SHM_RING_H
+#define PC_SHM_RING_H
+
+//
+// Shared memory transport between a "pc" mote and pc-cloud running on
+// the same machine: an alternative to the TCP connection that needs no
+// system calls per frame.
+//
+// The mote creates a memory region (PcShmRegion_t) and two eventfd
+// "doorbells", and passes them to the cloud over the Unix socket
+// PC_CLOUD_SHM_PATH. The region holds two single-producer/single-consumer
+// rings of frames, one in each direction. Frames have the same format as
+// on the TCP stream (see cloud_protocol.h) and are never split: a frame
+// that does not fit at the end of the ring is written at its start.
+//
+// A consumer that has nothing to do sets the `sleeping` flag of its ring
+// and waits on its doorbell; the producer rings the doorbell only when
+// the flag is set. A producer that finds the ring full may likewise set
+// `producerWaiting` and wait until the consumer has made space.
+//
+// Shared by the mote side and by tools/pc-cloud, so it must not depend
+// on any other MansOS headers.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include "cloud_protocol.h"
+
+#define PC_CLOUD_SHM_PATH "/tmp/mansos-pc-cloud"
+
+enum {
+    // must be a power of two
+    PC_SHM_RING_SIZE = 64 * 1024,
+    // length prefix value that tells the consumer to go to the ring start
+    PC_SHM_WRAP = 0xffff,
+};
+
+typedef struct PcShmRing_s {
+    // head and tail are free running byte counters
+    uint32_t head __attribute__((aligned(64)));  // written by the consumer
+    uint32_t sleeping;                            // written by the consumer
+    uint32_t tail __attribute__((aligned(64)));  // written by the producer
+    uint32_t producerWaiting;                     // set by the producer,
+                                                  // cleared by the consumer
+    unsigned char data[PC_SHM_RING_SIZE] __attribute__((aligned(64)));
+} PcShmRing_t;
+
+typedef struct PcShmRegion_s {
+    PcShmRing_t toCloud;
+    PcShmRing_t toMote;
+} PcShmRegion_t;
+
+// Write a frame made of `count` pieces to the ring.
+// Return 1 if it was written, 0 if there is no space for it.
+static inline int pcShmRingPut(PcShmRing_t *r, const void *const *pieces,
+        const unsigned *lengths, unsigned count) {
+    PcRadioPackSize_t len = 0;
+    unsigned i;
+    for (i = 0; i < count; ++i) len += lengths[i];
+    uint32_t need = sizeof(len) + len;
+    uint32_t tail = r->tail;
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint32_t pos = tail % PC_SHM_RING_SIZE;
+    uint32_t skip = PC_SHM_RING_SIZE - pos;
+    if (skip >= need) skip = 0;
+    if (PC_SHM_RING_SIZE - (tail - head) < skip + need) return 0;
+    if (skip) {
+        if (skip >= sizeof(len)) {
+            PcRadioPackSize_t wrap = PC_SHM_WRAP;
+            memcpy(r->data + pos, &wrap, sizeof(wrap));
+        }
+        tail += skip;
+        pos = 0;
+    }
+    memcpy(r->data + pos, &len, sizeof(len));
+    pos += sizeof(len);
+    for (i = 0; i < count; ++i) {
+        if (lengths[i]) memcpy(r->data + pos, pieces[i], lengths[i]);
+        pos += lengths[i];
+    }
+    __atomic_store_n(&r->tail, tail + need, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Return the next frame (starting with its length prefix) in place,
+// or NULL if the ring is empty. The frame stays valid until
+// pcShmRingRelease() is called.
+static inline const unsigned char *pcShmRingPeek(PcShmRing_t *r) {
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    while (r->head != tail) {
+        uint32_t pos = r->head % PC_SHM_RING_SIZE;
+        PcRadioPackSize_t len = PC_SHM_WRAP;
+        if (PC_SHM_RING_SIZE - pos >= sizeof(len)) {
+            memcpy(&len, r->data + pos, sizeof(len));
+        }
+        if (len != PC_SHM_WRAP) return r->data + pos;
+        // the rest of the ring is unused
+        __atomic_store_n(&r->head, r->head + PC_SHM_RING_SIZE - pos,
+                __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static inline void pcShmRingRelease(PcShmRing_t *r, const unsigned char *frame) {
+    PcRadioPackSize_t len;
+    memcpy(&len, frame, sizeof(len));
+    __atomic_store_n(&r->head, r->head + sizeof(len) + len, __ATOMIC_RELEASE);
+}
+
+// Producer: after putting frames in the ring, return true if the consumer
+// sleeps and its doorbell must be rung
+static inline int pcShmRingNeedsWakeup(PcShmRing_t *r) {
+    // the tail must be visible before `sleeping` is read
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&r->sleeping, __ATOMIC_RELAXED);
+}
+
+// Consumer: before waiting on the doorbell, announce it; return true
+// if the ring is still empty, i.e. waiting is safe
+static inline int pcShmRingPrepareSleep(PcShmRing_t *r) {
+    __atomic_store_n(&r->sleeping, 1, __ATOMIC_RELAXED);
+    // `sleeping` must be visible before the tail is read
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (pcShmRingPeek(r) == NULL) return 1;
+    __atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static inline void pcShmRingWakeUp(PcShmRing_t *r) {
+    __atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+// Consumer: after releasing frames, return true if the producer waits
+// for space and its doorbell must be rung
+static inline int pcShmRingProducerWaits(PcShmRing_t *r) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&r->producerWaiting, __ATOMIC_RELAXED)) return 0;
+    __atomic_store_n(&r->producerWaiting, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Producer: the ring is full; ask for the doorbell to be rung when
+// the consumer makes space. Retry pcShmRingPut() after calling this,
+// and wait only if it fails again
+static inline void pcShmRingWaitForSpace(PcShmRing_t *r) {
+    __atomic_store_n(&r->producerWaiting, 1, __ATOMIC_RELAXED);
+    // `producerWaiting` must be visible before the head is read
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Simulator of many motes in a single process; see sim_hal.h.
+//
+// This file is not moved to the mote sections: its variables are
+// the state of the simulator itself, shared by all motes.
+//
+
+// longjmp() is used to switch between stacks, which the checking
+// version does not allow
+#undef _FORTIFY_SOURCE
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <timing.h>
+#include <radio.h>
+#include <net/address.h>
+#if USE_ALARMS
+#include <kernel/alarms_internal.h>
+#endif
+#include <lib/energy.h>
+#include "sim_hal.h"
+
+enum {
+    SIM_STACK_SIZE = 64 * 1024,
+    SIM_DEFAULT_BITRATE = 250000,
+    // signal of the packets when there is no topology
+    SIM_DEFAULT_RSSI = -50,
+    SIM_DEFAULT_LQI = 107,
+    SIM_NO_MOTE = 0xffffffff,
+};
+
+// the mote sections, created by the objcopy in Makefile.pc;
+// weak, because an application may have no initialized variables
+extern char __start_mote_data[] WEAK_SYMBOL;
+extern char __stop_mote_data[] WEAK_SYMBOL;
+extern char __start_mote_bss[] WEAK_SYMBOL;
+extern char __stop_mote_bss[] WEAK_SYMBOL;
+
+// kernel main() of a mote (renamed in kernelmain.c)
+int pcSimMoteMain(void);
+
+#ifdef USE_RADIO
+extern RadioRecvFunction pcRadioCallback;
+extern unsigned char pcRadioBuf[MAX_PACKET_SIZE];
+extern uint16_t pcRadioBufLen;
+extern bool pcRadioIsOn;
+#endif
+
+typedef struct SimLink_s {
+    uint32_t mote;        // receiver
+    uint32_t prr;         // packet reception ratio, of 0x10000
+    int8_t rssi;
+    uint8_t lqi;
+} SimLink_t;
+
+typedef struct SimMote_s {
+    uint16_t address;
+    uint8_t channel;
+    uint32_t generation;  // wakeup events of older generations are void
+    unsigned char *state; // saved mote sections, while not running
+    void *stack;
+    bool started;
+    ucontext_t context;   // initial context, used to start the mote
+    jmp_buf jump;         // where to continue the mote
+    SimLink_t *links;
+    uint32_t linkCount;
+    uint32_t linkCapacity;
+} SimMote_t;
+
+typedef struct SimPacket_s {
+    uint32_t sender;
+    uint8_t channel;
+    uint16_t length;
+    unsigned char data[];
+} SimPacket_t;
+
+typedef struct SimEvent_s {
+    uint64_t time;        // microseconds
+    uint64_t seq;         // events at the same time go in FIFO order
+    uint32_t mote;
+    uint32_t generation;
+    SimPacket_t *packet;  // end of transmission, or NULL for a wakeup
+} SimEvent_t;
+
+static SimMote_t *simMotes;
+static uint32_t simMoteCount = 1;
+static uint32_t simCurrent = SIM_NO_MOTE;   // whose state is in the sections
+static bool simInMote;                      // running on the mote's stack
+static jmp_buf simSchedulerJump;
+static uint64_t simNow;
+
+// pending events, a binary heap ordered by (time, seq)
+static SimEvent_t *simEvents;
+static uint32_t simEventCount;
+static uint32_t simEventCapacity;
+static uint64_t simEventSeq;
+
+static size_t simDataSize;
+static size_t simBssSize;
+
+static bool simTopology;
+static uint32_t simBitrate = SIM_DEFAULT_BITRATE;
+static uint32_t simSeed;
+static uint32_t simRandomState;
+
+static unsigned long simPacketsSent;
+static unsigned long simPacketsDelivered;
+static unsigned long simPacketsLost;
+static unsigned long simSwitches;
+
+//----------------------------------------------------------
+// event queue
+//----------------------------------------------------------
+
+static inline bool simEventBefore(const SimEvent_t *a, const SimEvent_t *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void simPush(uint64_t time, uint32_t mote, uint32_t generation,
+        SimPacket_t *packet)
+{
+    if (simEventCount == simEventCapacity) {
+        simEventCapacity = simEventCapacity ? simEventCapacity * 2 : 1024;
+        simEvents = realloc(simEvents, simEventCapacity * sizeof(SimEvent_t));
+        if (!simEvents) {
+            fprintf(stderr, "out of memory for simulator events\n");
+            exit(1);
+        }
+    }
+    SimEvent_t e = { time, simEventSeq++, mote, generation, packet };
+    uint32_t i = simEventCount++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!simEventBefore(&e, &simEvents[parent])) break;
+        simEvents[i] = simEvents[parent];
+        i = parent;
+    }
+    simEvents[i] = e;
+}
+
+static SimEvent_t simPop(void)
+{
+    SimEvent_t top = simEvents[0];
+    SimEvent_t last = simEvents[--simEventCount];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= simEventCount) break;
+        if (child + 1 < simEventCount
+                && simEventBefore(&simEvents[child + 1], &simEvents[child])) {
+            child++;
+        }
+        if (!simEventBefore(&simEvents[child], &last)) break;
+        simEvents[i] = simEvents[child];
+        i = child;
+    }
+    simEvents[i] = last;
+    return top;
+}
+
+// (re)schedule the mote to run at the given time
+static void simWakeup(uint32_t mote, uint64_t time)
+{
+    simPush(time, mote, ++simMotes[mote].generation, NULL);
+}
+
+//----------------------------------------------------------
+// mote switching
+//----------------------------------------------------------
+
+// put the state of the mote in the mote sections
+static void simSwitchTo(uint32_t mote)
+{
+    if (simCurrent != mote) {
+        if (simCurrent != SIM_NO_MOTE) {
+            unsigned char *s = simMotes[simCurrent].state;
+            memcpy(s, __start_mote_data, simDataSize);
+            memcpy(s + simDataSize, __start_mote_bss, simBssSize);
+        }
+        unsigned char *s = simMotes[mote].state;
+        memcpy(__start_mote_data, s, simDataSize);
+        memcpy(__start_mote_bss, s + simDataSize, simBssSize);
+        simCurrent = mote;
+        simSwitches++;
+    }
+    jiffies = simNow / 1000;
+}
+
+static void simMoteEntry(void)
+{
+    pcSimMoteMain();
+    // the mote has stopped; it is never run again
+    _longjmp(simSchedulerJump, 1);
+}
+
+// run the mote until it goes to sleep.
+// The switching is done with _setjmp()/_longjmp(), because, unlike
+// swapcontext(), they do not make a system call to save the signal mask
+static void simResume(uint32_t mote)
+{
+    SimMote_t *m = &simMotes[mote];
+    simSwitchTo(mote);
+    simInMote = true;
+    if (!_setjmp(simSchedulerJump)) {
+        if (m->started) _longjmp(m->jump, 1);
+        m->started = true;
+        setcontext(&m->context);
+    }
+    simInMote = false;
+}
+
+void pcSimSleep(uint16_t milliseconds)
+{
+    if (!simInMote) {
+        // called from a radio callback (i.e. "interrupt" context)
+        return;
+    }
+    SimMote_t *m = &simMotes[simCurrent];
+    const uint32_t sleepEnd = (uint32_t) jiffies + milliseconds;
+    for (;;) {
+        // wake up at the end of the sleep, or at the first alarm
+        uint32_t wakeup = sleepEnd;
+#if USE_ALARMS
+        if (hasAnyAlarms() && timeAfter32(wakeup, getNextAlarmTime())) {
+            wakeup = getNextAlarmTime();
+        }
+#endif
+        uint64_t wakeupUs = simNow;
+        int32_t delta = wakeup - (uint32_t) jiffies;
+        if (delta > 0) wakeupUs = (simNow / 1000 + delta) * 1000;
+        simWakeup(simCurrent, wakeupUs);
+
+        // let the others run; packets may wake this mote up earlier
+        if (!_setjmp(m->jump)) _longjmp(simSchedulerJump, 1);
+        energyCountWakeup();
+
+#if USE_ALARMS
+        alarmsProcess();
+#endif
+        if (!timeAfter32(sleepEnd, (uint32_t) jiffies)) break;
+    }
+}
+
+uint64_t pcSimTimeUs(void)
+{
+    return simNow;
+}
+
+uint32_t pcSimRandomSeed(void)
+{
+    return simSeed * 2654435761u + simMotes[simCurrent].address;
+}
+
+void networkingInitArch(void)
+{
+    localAddress = simMotes[simCurrent].address;
+}
+
+//----------------------------------------------------------
+// radio
+//----------------------------------------------------------
+
+static uint32_t simRandom(void)
+{
+    // xorshift32
+    simRandomState ^= simRandomState << 13;
+    simRandomState ^= simRandomState >> 17;
+    simRandomState ^= simRandomState << 5;
+    return simRandomState;
+}
+
+int8_t pcSimSendFrame(const void *frame, uint16_t length)
+{
+    const unsigned char *f = frame;
+    PcCloudHeader_t header;
+    const unsigned offset = sizeof(PcRadioPackSize_t) + sizeof(header);
+
+    if (length < offset) return -1;
+    memcpy(&header, f + sizeof(PcRadioPackSize_t), sizeof(header));
+    switch (header.type) {
+    case PC_CLOUD_DATA: {
+        uint16_t len = length - offset;
+        SimPacket_t *p = malloc(sizeof(SimPacket_t) + len);
+        if (!p) return -1;
+        p->sender = simCurrent;
+        p->channel = header.channel;
+        p->length = len;
+        memcpy(p->data, f + offset, len);
+        // the packet is received at the end of the transmission;
+        // 8 bytes of preamble and sync are added
+        uint64_t airtime = ((uint64_t) len + 8) * 8 * 1000000 / simBitrate;
+        simPush(simNow + airtime, simCurrent, 0, p);
+        simPacketsSent++;
+        break;
+    }
+    case PC_CLOUD_SET_CHANNEL:
+        simMotes[simCurrent].channel = header.channel;
+        break;
+    }
+    return 0;
+}
+
+static void simReceive(uint32_t mote, const SimPacket_t *p,
+        int8_t rssi, uint8_t lqi)
+{
+#ifdef USE_RADIO
+    PcCloudHeader_t header = { PC_CLOUD_DATA, p->channel, rssi, lqi };
+    PcRadioPackSize_t len = sizeof(header) + p->length;
+
+    simSwitchTo(mote);
+    memcpy(pcRadioBuf, &len, sizeof(len));
+    memcpy(pcRadioBuf + sizeof(len), &header, sizeof(header));
+    memcpy(pcRadioBuf + sizeof(len) + sizeof(header), p->data, p->length);
+    pcRadioBufLen = sizeof(len) + len;
+    if (pcRadioProcessFrame() && pcRadioIsOn && pcRadioCallback) {
+        pcRadioCallback();
+        simPacketsDelivered++;
+        // the callback may have changed the plans of the mote
+        simWakeup(mote, simNow);
+    }
+#endif
+}
+
+// end of a transmission: deliver the packet to the neighbors of the sender
+static void simDeliver(const SimPacket_t *p)
+{
+    SimMote_t *sender = &simMotes[p->sender];
+    uint32_t i;
+
+    if (simTopology) {
+        for (i = 0; i < sender->linkCount; ++i) {
+            SimLink_t *l = &sender->links[i];
+            if (simMotes[l->mote].channel != p->channel) continue;
+            if ((simRandom() & 0xffff) >= l->prr) {
+                simPacketsLost++;
+                continue;
+            }
+            simReceive(l->mote, p, l->rssi, l->lqi);
+        }
+    } else {
+        for (i = 0; i < simMoteCount; ++i) {
+            if (i == p->sender || simMotes[i].channel != p->channel) continue;
+            simReceive(i, p, SIM_DEFAULT_RSSI, SIM_DEFAULT_LQI);
+        }
+    }
+}
+
+static bool simLoadTopology(const char *fileName)
+{
+    FILE *f = fopen(fileName, "r");
+    if (!f) {
+        perror(fileName);
+        return false;
+    }
+    char line[256];
+    unsigned lineNr = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNr++;
+        char *p = strchr(line, '#');
+        if (p) *p = '\0';
+        char *end;
+        unsigned long from = strtoul(line, &end, 0);
+        if (end == line) continue; // empty line
+        p = end;
+        unsigned long to = strtoul(p, &end, 0);
+        if (end == p) goto error;
+        p = end;
+        double prr = strtod(p, &end);
+        if (end == p || prr < 0 || prr > 1) goto error;
+        p = end;
+        long rssi = strtol(p, &end, 0);
+        if (end == p) rssi = SIM_DEFAULT_RSSI;
+        p = end;
+        long lqi = strtol(p, &end, 0);
+        if (end == p) lqi = SIM_DEFAULT_LQI;
+
+        // motes have addresses 1..n
+        if (from < 1 || from > simMoteCount || to < 1 || to > simMoteCount) {
+            continue;
+        }
+        SimMote_t *m = &simMotes[from - 1];
+        if (m->linkCount == m->linkCapacity) {
+            m->linkCapacity = m->linkCapacity ? m->linkCapacity * 2 : 8;
+            m->links = realloc(m->links, m->linkCapacity * sizeof(SimLink_t));
+            if (!m->links) goto error;
+        }
+        SimLink_t *l = &m->links[m->linkCount++];
+        l->mote = to - 1;
+        l->prr = prr * 0x10000;
+        l->rssi = rssi;
+        l->lqi = lqi;
+    }
+    fclose(f);
+    simTopology = true;
+    return true;
+
+  error:
+    fprintf(stderr, "%s:%u: invalid link\n", fileName, lineNr);
+    fclose(f);
+    return false;
+}
+
+//----------------------------------------------------------
+// main loop
+//----------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    const char *topologyFile = NULL;
+    uint64_t endTime = ~0ULL;
+    uint32_t i;
+
+    simSeed = time(NULL);
+    for (i = 1; i < (uint32_t) argc; ++i) {
+        if (!strcmp(argv[i], "-n") && i + 1 < (uint32_t) argc) {
+            simMoteCount = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < (uint32_t) argc) {
+            endTime = (uint64_t) (atof(argv[++i]) * 1000000);
+        } else if (!strcmp(argv[i], "-m") && i + 1 < (uint32_t) argc) {
+            topologyFile = argv[++i];
+        } else if (!strcmp(argv[i], "-b") && i + 1 < (uint32_t) argc) {
+            simBitrate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < (uint32_t) argc) {
+            simSeed = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-n <mote count>] [-t <seconds>]\n"
+                    "    [-m <topology file>] [-b <bitrate>] [-r <seed>]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (simMoteCount < 1 || simMoteCount > 0xfffe) simMoteCount = 1;
+    if (simBitrate == 0) simBitrate = SIM_DEFAULT_BITRATE;
+    simRandomState = simSeed ? simSeed : 1;
+
+    // the sections are in their initial state now: use it for all motes
+    simDataSize = __start_mote_data ? __stop_mote_data - __start_mote_data : 0;
+    simBssSize = __start_mote_bss ? __stop_mote_bss - __start_mote_bss : 0;
+    simMotes = calloc(simMoteCount, sizeof(SimMote_t));
+    if (!simMotes) {
+        fprintf(stderr, "out of memory for motes\n");
+        return 1;
+    }
+    for (i = 0; i < simMoteCount; ++i) {
+        SimMote_t *m = &simMotes[i];
+        m->address = i + 1;
+        m->channel = RADIO_CHANNEL;
+        m->state = malloc(simDataSize + simBssSize);
+        // untouched stack pages take no memory
+        m->stack = mmap(NULL, SIM_STACK_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (!m->state || m->stack == MAP_FAILED) {
+            fprintf(stderr, "out of memory for mote %u\n", i + 1);
+            return 1;
+        }
+        memcpy(m->state, __start_mote_data, simDataSize);
+        memcpy(m->state + simDataSize, __start_mote_bss, simBssSize);
+        getcontext(&m->context);
+        m->context.uc_stack.ss_sp = m->stack;
+        m->context.uc_stack.ss_size = SIM_STACK_SIZE;
+        m->context.uc_link = NULL;
+        makecontext(&m->context, simMoteEntry, 0);
+        simWakeup(i, 0);
+    }
+    if (topologyFile && !simLoadTopology(topologyFile)) return 1;
+
+    fprintf(stderr, "simulating %u mote(s), %lu bytes of state each, "
+            "random seed %u\n", simMoteCount,
+            (unsigned long) (simDataSize + simBssSize), simSeed);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (simEventCount) {
+        SimEvent_t e = simPop();
+        if (e.time > endTime) break;
+        simNow = e.time;
+        if (e.packet) {
+            simDeliver(e.packet);
+            free(e.packet);
+        } else if (e.generation == simMotes[e.mote].generation) {
+            simResume(e.mote);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fflush(stdout);
+
+    double real = (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "simulated %.3f s in %.3f s; packets: %lu sent, "
+            "%lu delivered, %lu lost; %lu context switches\n",
+            simNow / 1e6, real, simPacketsSent, simPacketsDelivered,
+            simPacketsLost, simSwitches);
+    return 0;
+}
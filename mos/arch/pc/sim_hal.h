@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PC_SIM_HAL_H
+#define PC_SIM_HAL_H
+
+//
+// Many motes in a single process (USE_PC_SIM=y).
+//
+// All global and static variables of MansOS and of the application are
+// moved to separate sections at build time (see Makefile.pc). The
+// simulator keeps a copy of these sections for every mote and switches
+// them when it switches between motes; each mote runs on its own
+// coroutine stack. Motes run one at a time in virtual time, and radio
+// packets are delivered in memory.
+//
+// Usage: <app>.exe [-n <mote count>] [-t <seconds to simulate>]
+//            [-m <topology file>] [-b <bitrate>] [-r <random seed>]
+//
+// Motes get addresses 1..n. The topology file has the same format as
+// for pc-cloud: lines of "<from> <to> <prr> [rssi [lqi]]". Without it,
+// all motes hear each other.
+//
+
+#include <defines.h>
+
+// sleep in virtual time, letting other motes run
+void pcSimSleep(uint16_t milliseconds);
+
+// current virtual time in microseconds
+uint64_t pcSimTimeUs(void);
+
+// a frame (as it would go to pc-cloud) sent by the current mote
+int8_t pcSimSendFrame(const void *frame, uint16_t length);
+
+// random seed for the current mote
+uint32_t pcSimRandomSeed(void);
+
+#endif
@@ -26,8 +26,15 @@
 
 #include <unistd.h>
 
+#if USE_PC_SIM
+// busy waiting takes no virtual time
+#define udelay(u) ((void) (u))
+
+#define mdelay(m) ((void) (m))
+#else
 #define udelay(u) usleep(u)
 
 #define mdelay(m) usleep((m) * 1000)
+#endif
 
 #endif
@@ -38,8 +38,6 @@
 // Variables
 //===========================================================
 
-volatile Serial_t serial[SERIAL_COUNT];
-
 SerialCallback_t serialRecvCb[SERIAL_COUNT];
 
 static bool txEnabled[SERIAL_COUNT];
@@ -61,8 +59,14 @@ void serialSendByte(uint8_t id, uint8_t data)
     if (id >= SERIAL_COUNT) return;
 
     if (txEnabled[id]) {
+#if USE_PC_SIM
+        // thousands of motes may be printing: buffer the output
+        extern int putchar(int c);
+        putchar(data);
+#else
         int ret = write(STDOUT_FILENO, &data, 1);
         (void) ret;
+#endif
     }
 }
 
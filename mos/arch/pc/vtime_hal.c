@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <timing.h>
+#include <radio.h>
+#include <print.h>
+#if USE_ALARMS
+#include <kernel/alarms_internal.h>
+#endif
+#include <lib/energy.h>
+#include "vtime_hal.h"
+
+bool pcVirtualTime;
+
+static uint64_t virtualTimeUs;
+static bool runGranted;
+static pthread_mutex_t virtualTimeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t virtualTimeCond = PTHREAD_COND_INITIALIZER;
+
+void pcVirtualTimeInit(void)
+{
+    const char *s = getenv("MANSOS_VIRTUAL_TIME");
+    pcVirtualTime = s && *s && strcmp(s, "0");
+    if (pcVirtualTime) PRINTF("using virtual time\n");
+}
+
+uint64_t pcVirtualTimeUs(void)
+{
+    return virtualTimeUs;
+}
+
+void pcVirtualTimeSet(uint64_t us)
+{
+    pthread_mutex_lock(&virtualTimeMutex);
+    virtualTimeUs = us;
+    jiffies = us / 1000;
+    pthread_mutex_unlock(&virtualTimeMutex);
+}
+
+void pcVirtualTimeRun(void)
+{
+    pthread_mutex_lock(&virtualTimeMutex);
+    runGranted = true;
+    pthread_cond_signal(&virtualTimeCond);
+    pthread_mutex_unlock(&virtualTimeMutex);
+}
+
+void pcVirtualTimeWaitRun(void)
+{
+    pthread_mutex_lock(&virtualTimeMutex);
+    while (!runGranted) {
+        pthread_cond_wait(&virtualTimeCond, &virtualTimeMutex);
+    }
+    runGranted = false;
+    pthread_mutex_unlock(&virtualTimeMutex);
+}
+
+void pcVirtualSleep(uint16_t milliseconds)
+{
+    const uint32_t sleepEnd = (uint32_t) jiffies + milliseconds;
+    for (;;) {
+        // wake up at the end of the sleep, or at the first alarm
+        uint32_t wakeup = sleepEnd;
+#if USE_ALARMS
+        if (hasAnyAlarms() && timeAfter32(wakeup, getNextAlarmTime())) {
+            wakeup = getNextAlarmTime();
+        }
+#endif
+        // tell the cloud and wait; packets may wake us up earlier
+        uint64_t wakeupUs = virtualTimeUs;
+        int32_t delta = wakeup - (uint32_t) jiffies;
+        if (delta > 0) wakeupUs = (virtualTimeUs / 1000 + delta) * 1000;
+        pcRadioSendFrame(PC_CLOUD_IDLE, NULL, 0, &wakeupUs, sizeof(wakeupUs));
+        pcVirtualTimeWaitRun();
+        energyCountWakeup();
+
+#if USE_ALARMS
+        alarmsProcess();
+#endif
+        if (!timeAfter32(sleepEnd, (uint32_t) jiffies)) break;
+    }
+}
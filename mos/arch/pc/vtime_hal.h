@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PC_VTIME_HAL_H
+#define PC_VTIME_HAL_H
+
+//
+// Virtual time for the pc platform.
+//
+// When the mote is started with MANSOS_VIRTUAL_TIME=1 in the environment
+// (and pc-cloud with "-s"), jiffies are no longer taken from the PC clock.
+// Instead, the mote tells the cloud when it goes to sleep and until when,
+// and the cloud advances the virtual clock of all motes to the next
+// pending wakeup or radio event. Simulations run as fast as the motes
+// can process their events, and are repeatable.
+//
+
+#include <defines.h>
+
+// true if virtual time is used
+extern bool pcVirtualTime;
+
+// read the environment; called once at startup
+void pcVirtualTimeInit(void);
+
+// current virtual time in microseconds
+uint64_t pcVirtualTimeUs(void);
+
+// sleep in virtual time, processing alarms on the way
+void pcVirtualSleep(uint16_t milliseconds);
+
+// wait until the cloud allows to run
+void pcVirtualTimeWaitRun(void);
+
+// internal: called from net_hal.c when the cloud sends PC_CLOUD_CLOCK
+// and PC_CLOUD_RUN frames
+void pcVirtualTimeSet(uint64_t us);
+void pcVirtualTimeRun(void);
+
+#endif
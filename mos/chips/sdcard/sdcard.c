@@ -84,6 +84,9 @@ static uint32_t cacheAddress;
 static bool cacheChanged;
 #endif // USE_SDCARD_LOW_LEVEL_API
 
+// cacheAddress when the cache holds no block, after a failed read
+#define CACHE_NONE  0xffffffff
+
 #define IN_SECTOR(address, sectorStartAdddress)                 \
     (((address) >= (sectorStartAdddress)) &&                    \
             (address) < ((sectorStartAdddress) + SDCARD_SECTOR_SIZE))
@@ -481,7 +484,7 @@ bool sdcardInit(void)
 #if DEBUG
     memset(cacheBuffer, 0xff, sizeof(cacheBuffer));
 #endif
-    sdcardReadBlock(cacheAddress, cacheBuffer);
+    if (!sdcardReadBlock(cacheAddress, cacheBuffer)) cacheAddress = CACHE_NONE;
     SPRINTF("cache read OK\n");
 #endif // USE_SDCARD_LOW_LEVEL_API
 
@@ -587,7 +590,8 @@ bool sdcardReadBlock(uint32_t address, void* buffer)
     return result;
 }
 
-static bool sdcardReadData(void* buffer, uint16_t len)
+// Read a single data packet; leaves the card selected
+static bool sdcardReceiveData(void* buffer, uint16_t len)
 {
     uint8_t status;
     bool ok;
@@ -595,11 +599,11 @@ static bool sdcardReadData(void* buffer, uint16_t len)
     // wait for start block token
     BUSYWAIT_UNTIL((status = SDCARD_RD_BYTE()) != 0xFF, READ_TIMEOUT_TICKS, ok);
     if (!ok) {
-        goto fail;
+        return false;
     }
 
     if (status != DATA_START_BLOCK) {
-        goto fail;
+        return false;
     }
 
     // transfer data
@@ -609,12 +613,48 @@ static bool sdcardReadData(void* buffer, uint16_t len)
     SDCARD_RD_BYTE();
     SDCARD_RD_BYTE();
 
-    SDCARD_SPI_DISABLE();
     return true;
+}
 
-  fail:
+static bool sdcardReadData(void* buffer, uint16_t len)
+{
+    bool result = sdcardReceiveData(buffer, len);
     SDCARD_SPI_DISABLE();
-    return false;
+    return result;
+}
+
+// Read 'count' consecutive blocks starting at address with one command
+static bool readMultipleBlocks(uint32_t address, void* buffer, uint16_t count)
+{
+    SPRINTF("sdcardReadBlocks %u at %lu\n", count, address);
+    bool result = false;
+    uint8_t *p = (uint8_t *) buffer;
+    Handle_t h;
+
+    //  if SDHC card: use block number instead of address
+    if (cardType == SD_CARD_TYPE_SDHC) address >>= 9;
+
+    ATOMIC_START(h);
+    SDCARD_SPI_ENABLE();
+
+    if (sdcardCommand(CMD_READ_MULTIPLE_BLOCK, address, 0xff) != 0) {
+        goto end;
+    }
+
+    for (; count; --count, p += SDCARD_SECTOR_SIZE) {
+        if (!sdcardReceiveData(p, SDCARD_SECTOR_SIZE)) break;
+    }
+
+    // the card keeps sending blocks until told to stop, also after an error
+    if (sdcardCommand(CMD_STOP_TRANSMISSION, 0, 0xff) == 0 && count == 0) {
+        result = true;
+    }
+
+  end:
+    SDCARD_SPI_DISABLE();
+    ATOMIC_END(h);
+    SPRINTF("  done\n");
+    return result;
 }
 
 static bool sdcardWriteData(uint8_t token, const uint8_t* data)
@@ -627,14 +667,7 @@ static bool sdcardWriteData(uint8_t token, const uint8_t* data)
     SDCARD_WR_BYTE(0xff);
 
     uint8_t status = SDCARD_RD_BYTE();
-    if ((status & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
-        goto fail;
-    }
-    return true;
-
-  fail:
-    SDCARD_SPI_DISABLE();
-    return false;
+    return (status & DATA_RES_MASK) == DATA_RES_ACCEPTED;
 }
 
 // Write len bytes (len == 512) to card at address
@@ -674,6 +707,83 @@ bool sdcardWriteBlock(uint32_t address, const void *buf)
     return result;
 }
 
+// Write 'count' consecutive blocks starting at address with one command
+static bool writeMultipleBlocks(uint32_t address, const void *buf, uint16_t count)
+{
+    SPRINTF("sdcardWriteBlocks %u at %lu\n", count, address);
+    const uint8_t *p = (const uint8_t *) buf;
+    Handle_t handle;
+    bool result = false;
+
+    ATOMIC_START(handle);
+
+    //  if SDHC card: use block number instead of address
+    if (cardType == SD_CARD_TYPE_SDHC) address >>= 9;
+
+    SDCARD_SPI_ENABLE();
+    // let the card pre-erase the whole range; only a hint, so ignore errors
+    sdcardAppCommand(ACMD_SET_WR_BLK_ERASE_COUNT, count);
+    if (sdcardCommand(CMD_WRITE_MULTIPLE_BLOCK, address, 0xff)) {
+        goto end;
+    }
+    for (; count; --count, p += SDCARD_SECTOR_SIZE) {
+        if (!sdcardWriteData(WRITE_MULTIPLE_TOKEN, p)) break;
+        if (!waitCardNotBusyNoints(WRITE_TIMEOUT_TICKS)) break;
+    }
+
+    // end the transfer, also after an error
+    SDCARD_WR_BYTE(STOP_TRAN_TOKEN);
+    // the busy signal starts one byte after the stop token
+    SDCARD_RD_BYTE();
+    if (!waitCardNotBusyNoints(WRITE_TIMEOUT_TICKS) || count) {
+        goto end;
+    }
+    // response is r2 so get and check two bytes for nonzero
+    if (sdcardCommand(CMD_SEND_STATUS, 0, 0xff) || SDCARD_RD_BYTE()) {
+        goto end;
+    }
+    result = true; // success
+
+  end:
+    SDCARD_SPI_DISABLE();
+    ATOMIC_END(handle);
+    SPRINTF("  done\n");
+    return result;
+}
+
+// Interrupts are off during a transfer, as the SPI bus may be shared;
+// longer runs of blocks are split in transfers of SDCARD_ATOMIC_BLOCKS
+
+bool sdcardReadBlocks(uint32_t address, void* buffer, uint16_t count)
+{
+    uint8_t *p = (uint8_t *) buffer;
+    while (count) {
+        uint16_t n = count < SDCARD_ATOMIC_BLOCKS ? count : SDCARD_ATOMIC_BLOCKS;
+        bool ok = n == 1 ? sdcardReadBlock(address, p)
+                : readMultipleBlocks(address, p, n);
+        if (!ok) return false;
+        count -= n;
+        address += (uint32_t) n * SDCARD_SECTOR_SIZE;
+        p += n * SDCARD_SECTOR_SIZE;
+    }
+    return true;
+}
+
+bool sdcardWriteBlocks(uint32_t address, const void *buf, uint16_t count)
+{
+    const uint8_t *p = (const uint8_t *) buf;
+    while (count) {
+        uint16_t n = count < SDCARD_ATOMIC_BLOCKS ? count : SDCARD_ATOMIC_BLOCKS;
+        bool ok = n == 1 ? sdcardWriteBlock(address, p)
+                : writeMultipleBlocks(address, p, n);
+        if (!ok) return false;
+        count -= n;
+        address += (uint32_t) n * SDCARD_SECTOR_SIZE;
+        p += n * SDCARD_SECTOR_SIZE;
+    }
+    return true;
+}
+
 #if USE_SDCARD_DIVIDED_WRITE
 
 // Initialize step-by-step SD card block write
@@ -884,10 +994,36 @@ static uint8_t sdcardCommand(uint8_t cmd, uint32_t arg, uint8_t crc)
 
 #if USE_SDCARD_LOW_LEVEL_API
 
-void sdcardFlush(void)
+bool sdcardFlush(void)
 {
-    sdcardWriteBlock(cacheAddress, cacheBuffer);
+    if (cacheAddress == CACHE_NONE) return true;
+    if (!sdcardWriteBlock(cacheAddress, cacheBuffer)) return false;
     cacheChanged = false;
+    return true;
+}
+
+// write the cached block back to the card, if it has been changed;
+// on failure it stays changed, to be written later
+static bool cacheWriteBack(void)
+{
+    if (!cacheChanged) return true;
+    return sdcardFlush();
+}
+
+// make the cache hold the block at 'address'
+static bool cacheLoad(uint32_t address)
+{
+    if (!cacheWriteBack()) return false;
+    cacheAddress = address;
+#if DEBUG
+    memset(cacheBuffer, 0xff, sizeof(cacheBuffer));
+#endif
+    if (!sdcardReadBlock(cacheAddress, cacheBuffer)) {
+        // whatever was read is no use
+        cacheAddress = CACHE_NONE;
+        return false;
+    }
+    return true;
 }
 
 static inline void takeFromCache(void* buffer, uint16_t len, uint16_t offset)
@@ -900,47 +1036,63 @@ static inline void takeFromCache(void* buffer, uint16_t len, uint16_t offset)
 }
 
 // Read len bytes (len <= 512) at address
-static void sdcardReadInBlock(uint32_t address, void* buffer, uint16_t len)
+static bool sdcardReadInBlock(uint32_t address, void* buffer, uint16_t len)
 {
     // PRINTF("sdcardReadInBlock %u bytes at %lu\n", len, address);
 
-    if (IN_SECTOR(address, cacheAddress)) {
-        takeFromCache(buffer, len, address & (SDCARD_SECTOR_SIZE - 1));
-        return;
+    if (!IN_SECTOR(address, cacheAddress)
+            && !cacheLoad(address & 0xfffffe00)) {
+        return false;
     }
-    // flush cache here too
-    if (cacheChanged) {
-        sdcardWriteBlock(cacheAddress, cacheBuffer);
-        cacheChanged = false;
-    }
-
-    cacheAddress = address & 0xfffffe00;
-#if DEBUG
-    memset(cacheBuffer, 0xff, sizeof(cacheBuffer));
-#endif
-    sdcardReadBlock(cacheAddress, cacheBuffer);
     takeFromCache(buffer, len, address & (SDCARD_SECTOR_SIZE - 1));
-
     // debugHexdump(buffer, len);
+    return true;
 }
 
-// Read len bytes (len <= 512) at address
-void sdcardRead(uint32_t address, void* buffer, uint16_t len)
+// Number of whole blocks at the start of a block-aligned range, if there
+// are enough of them to be worth a multi-block transfer bypassing the cache
+static inline uint16_t wholeBlocks(uint32_t address, uint16_t len)
 {
-    if (!initOk) return;
+    if (address & (SDCARD_SECTOR_SIZE - 1)) return 0;
+    if (len < 2 * SDCARD_SECTOR_SIZE) return 0;
+    return len / SDCARD_SECTOR_SIZE;
+}
+
+static inline bool cacheInRange(uint32_t address, uint16_t count)
+{
+    return cacheAddress != CACHE_NONE
+            && cacheAddress >= address
+            && cacheAddress < address + (uint32_t) count * SDCARD_SECTOR_SIZE;
+}
+
+// Read len bytes at address
+bool sdcardRead(uint32_t address, void* buffer, uint16_t len)
+{
+    if (!initOk) return false;
     // PRINTF("sdcardRead %u bytes at %lu\n", len, address);
 
     uint8_t *buf = (uint8_t *)buffer;
-    uint16_t pageOffset = (uint16_t) (address & (SDCARD_SECTOR_SIZE - 1));
-    if (pageOffset + len > SDCARD_SECTOR_SIZE) {
-        uint16_t safeLen = SDCARD_SECTOR_SIZE - pageOffset;
-        sdcardReadInBlock(address, buf, safeLen);
-        // write remaining bytes in the beginning of the next page
-        address += safeLen;
-        len -= safeLen;
-        buf += safeLen;
+    while (len) {
+        uint16_t n;
+        uint16_t count = wholeBlocks(address, len);
+        if (count) {
+            n = count * SDCARD_SECTOR_SIZE;
+            // the card must see the latest version of the cached block
+            if (cacheInRange(address, count) && !cacheWriteBack()) {
+                return false;
+            }
+            if (!sdcardReadBlocks(address, buf, count)) return false;
+        } else {
+            uint16_t pageOffset = (uint16_t) (address & (SDCARD_SECTOR_SIZE - 1));
+            n = SDCARD_SECTOR_SIZE - pageOffset;
+            if (n > len) n = len;
+            if (!sdcardReadInBlock(address, buf, n)) return false;
+        }
+        address += n;
+        len -= n;
+        buf += n;
     }
-    sdcardReadInBlock(address, buf, len);
+    return true;
 }
 
 
@@ -954,53 +1106,55 @@ static inline void putInCache(const void* buffer, uint16_t len, uint16_t offset)
     cacheChanged = true;
 }
 
-static void sdcardWriteInBlock(uint32_t address, const void* buffer, uint16_t len)
+static bool sdcardWriteInBlock(uint32_t address, const void* buffer, uint16_t len)
 {
     // PRINTF("sdcardWriteInBlock %u bytes at %lu\n", len, address);
     // debugHexdump(buffer, len);
 
-    if (IN_SECTOR(address, cacheAddress)) {
-        putInCache(buffer, len, address & (SDCARD_SECTOR_SIZE - 1));
-        return;
-    }
-
-    if (cacheChanged) {
-        sdcardWriteBlock(cacheAddress, cacheBuffer);
-        cacheChanged = false;
-    }
-
-    cacheAddress = address & 0xfffffe00;
-    if (len == SDCARD_SECTOR_SIZE) {
-        // special, optimized case for block-sized writes
-        ASSERT((address & (SDCARD_SECTOR_SIZE - 1)) == 0);
-        putInCache(buffer, SDCARD_SECTOR_SIZE, 0);
-    } else {
-#if DEBUG
-        memset(cacheBuffer, 0xff, sizeof(cacheBuffer));
-#endif
-        sdcardReadBlock(cacheAddress, cacheBuffer);
-        putInCache(buffer, len, address & (SDCARD_SECTOR_SIZE - 1));
+    if (!IN_SECTOR(address, cacheAddress)) {
+        if (len == SDCARD_SECTOR_SIZE) {
+            // special, optimized case for block-sized writes: nothing to read
+            ASSERT((address & (SDCARD_SECTOR_SIZE - 1)) == 0);
+            if (!cacheWriteBack()) return false;
+            cacheAddress = address;
+        } else if (!cacheLoad(address & 0xfffffe00)) {
+            return false;
+        }
     }
+    putInCache(buffer, len, address & (SDCARD_SECTOR_SIZE - 1));
+    return true;
 }
 
-// Write len bytes (len <= 512) at address
-void sdcardWrite(uint32_t address, const void *buffer, uint16_t len)
+// Write len bytes at address
+bool sdcardWrite(uint32_t address, const void *buffer, uint16_t len)
 {
-    if (!initOk) return;
+    if (!initOk) return false;
 
     //PRINTF("sdcardWrite %u bytes at %lu\n", len, address);
 
     const uint8_t *buf = (const uint8_t *)buffer;
-    uint16_t pageOffset = (uint16_t) (address & (SDCARD_SECTOR_SIZE - 1));
-    if (pageOffset + len > SDCARD_SECTOR_SIZE) {
-        uint16_t safeLen = SDCARD_SECTOR_SIZE - pageOffset;
-        sdcardWriteInBlock(address, buf, safeLen);
-        // write remaining bytes in the beginning of the next page
-        address += safeLen;
-        len -= safeLen;
-        buf += safeLen;
+    while (len) {
+        uint16_t n;
+        uint16_t count = wholeBlocks(address, len);
+        if (count) {
+            n = count * SDCARD_SECTOR_SIZE;
+            if (!sdcardWriteBlocks(address, buf, count)) return false;
+            // keep the cached block up to date; it is already on the card
+            if (cacheInRange(address, count)) {
+                memcpy(cacheBuffer, buf + (cacheAddress - address), SDCARD_SECTOR_SIZE);
+                cacheChanged = false;
+            }
+        } else {
+            uint16_t pageOffset = (uint16_t) (address & (SDCARD_SECTOR_SIZE - 1));
+            n = SDCARD_SECTOR_SIZE - pageOffset;
+            if (n > len) n = len;
+            if (!sdcardWriteInBlock(address, buf, n)) return false;
+        }
+        address += n;
+        len -= n;
+        buf += n;
     }
-    sdcardWriteInBlock(address, buf, len);
+    return true;
 }
 
 #endif // USE_SDCARD_LOW_LEVEL_API
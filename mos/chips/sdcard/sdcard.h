@@ -58,6 +58,16 @@ void sdcardEraseSector(uint32_t addr);
 //
 bool sdcardReadBlock(uint32_t addr, void* buffer);
 bool sdcardWriteBlock(uint32_t addr, const void *buf);
+// Transfer 'count' consecutive blocks with a single card command for each
+// SDCARD_ATOMIC_BLOCKS, much faster than a loop of single-block calls
+bool sdcardReadBlocks(uint32_t addr, void* buffer, uint16_t count);
+bool sdcardWriteBlocks(uint32_t addr, const void *buf, uint16_t count);
+
+// Blocks per multi-block transfer. Interrupts are disabled during each,
+// and writing a block may take a few milliseconds
+#ifndef SDCARD_ATOMIC_BLOCKS
+#define SDCARD_ATOMIC_BLOCKS  4
+#endif
 
 #if USE_SDCARD_DIVIDED_WRITE
 uint32_t targetAddress;
@@ -76,13 +86,13 @@ inline uint8_t dividedSdCardWrite();
 // Do not use both filesystem and these functions together.
 //
 #if USE_SDCARD_LOW_LEVEL_API
-// Read a block of data from addr
-void sdcardRead(uint32_t addr, void* buffer, uint16_t len);
-// Write len bytes (len <= 512) to SD card at 'addr'
+// Read a block of data from addr; false if the card failed
+bool sdcardRead(uint32_t addr, void* buffer, uint16_t len);
+// Write len bytes to SD card at 'addr'; false if the card failed
 // Block can split over multiple blocks
-void sdcardWrite(uint32_t addr, const void *buf, uint16_t len);
-// Flush cache buffers to SD card
-void sdcardFlush(void);
+bool sdcardWrite(uint32_t addr, const void *buf, uint16_t len);
+// Flush cache buffers to SD card; false if the card failed
+bool sdcardFlush(void);
 #endif // USE_SDCARD_LOW_LEVEL_API
 
 // return the number of 512-byte sectors
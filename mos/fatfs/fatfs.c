@@ -46,10 +46,37 @@
 
 FatInfo_t fatInfo;
 
-static Cache16_t cache;
-static uint32_t cacheBlockNumber;
-static bool cacheDirty;
-static uint32_t cacheMirrorBlock;
+//! SD card blocks kept in RAM, 512 bytes each
+#ifndef FATFS_CACHE_BLOCKS
+#define FATFS_CACHE_BLOCKS 3
+#endif
+
+//! Write data to the card after each fatFsWrite() call; if 0, blocks are
+/// written when evicted from the cache and on fflush() or fclose()
+#ifndef FATFS_SYNC_WRITES
+#define FATFS_SYNC_WRITES 1
+#endif
+
+#define NO_BLOCK ((uint32_t) ~0ul)
+
+typedef struct CacheEntry_s {
+    Cache16_t u;
+    uint32_t blockNumber;
+    uint32_t mirrorBlock; // the same block in the second FAT, or 0
+    uint8_t lastUse;
+    bool dirty;
+} CacheEntry_t;
+
+static CacheEntry_t cacheEntries[FATFS_CACHE_BLOCKS];
+// the block last returned by cacheRawBlock() and its data
+static CacheEntry_t *cacheEntry;
+static Cache16_t *cache;
+// the FAT block used last; kept in cache while there is anything else to evict
+static CacheEntry_t *fatCacheEntry;
+static uint8_t cacheUseCounter;
+
+// all clusters before this one are in use
+static fat_t nextFreeCluster;
 
 // ------------------------------------------------
 // functions
@@ -76,22 +103,22 @@ static void printFatEntry(DirectoryEntry_t *entry) {
 #endif
 }
 
-static bool cacheFlush(void)
+static bool cacheEntryFlush(CacheEntry_t *e)
 {
-    if (cacheDirty) {
+    if (e->dirty) {
         DPRINTF("write block %lu (rootDirStart=%lu, dataStartBlock=%lu)\n",
-                cacheBlockNumber, fatInfo.rootDirStart, fatInfo.dataStartBlock);
-        if (!sdcardWriteBlock(cacheBlockNumber * SDCARD_SECTOR_SIZE, cache.data)) {
+                e->blockNumber, fatInfo.rootDirStart, fatInfo.dataStartBlock);
+        if (!sdcardWriteBlock(e->blockNumber * SDCARD_SECTOR_SIZE, e->u.data)) {
             goto fail;
         }
         // mirror FAT tables
-        if (cacheMirrorBlock) {
-            if (!sdcardWriteBlock(cacheMirrorBlock * SDCARD_SECTOR_SIZE, cache.data)) {
+        if (e->mirrorBlock) {
+            if (!sdcardWriteBlock(e->mirrorBlock * SDCARD_SECTOR_SIZE, e->u.data)) {
                 goto fail;
             }
-            cacheMirrorBlock = 0;
+            e->mirrorBlock = 0;
         }
-        cacheDirty = false;
+        e->dirty = false;
     }
     return true;
 
@@ -100,15 +127,108 @@ static bool cacheFlush(void)
     return false;
 }
 
+static bool cacheFlush(void)
+{
+    bool result = true;
+    uint8_t i;
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        if (!cacheEntryFlush(&cacheEntries[i])) result = false;
+    }
+    return result;
+}
+
+// write out cached changes to blocks about to be read directly from the card
+static bool cacheFlushRange(uint32_t firstBlock, uint16_t count)
+{
+    bool result = true;
+    uint8_t i;
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        CacheEntry_t *e = &cacheEntries[i];
+        if (e->blockNumber == NO_BLOCK) continue;
+        if (e->blockNumber - firstBlock >= count) continue;
+        if (!cacheEntryFlush(e)) result = false;
+    }
+    return result;
+}
+
+// refresh cached copies of blocks just written directly to the card
+static void cacheUpdateRange(uint32_t firstBlock, uint16_t count, const uint8_t *data)
+{
+    uint8_t i;
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        CacheEntry_t *e = &cacheEntries[i];
+        if (e->blockNumber == NO_BLOCK) continue;
+        if (e->blockNumber - firstBlock >= count) continue;
+        memcpy(e->u.data, data + (e->blockNumber - firstBlock) * SDCARD_SECTOR_SIZE,
+                SDCARD_SECTOR_SIZE);
+        e->dirty = false;
+    }
+}
+
+static inline bool isFatBlock(uint32_t blockNumber)
+{
+    return blockNumber >= fatInfo.fatStartBlock && blockNumber < fatInfo.rootDirStart;
+}
+
+// least recently used block, but not the last used FAT block
+static CacheEntry_t *cacheVictim(void)
+{
+    CacheEntry_t *victim = NULL;
+    uint8_t i;
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        CacheEntry_t *e = &cacheEntries[i];
+        if (e->blockNumber == NO_BLOCK) return e;
+        if (e == fatCacheEntry && FATFS_CACHE_BLOCKS > 1) continue;
+        if (!victim || e->lastUse < victim->lastUse) victim = e;
+    }
+    return victim;
+}
+
+// renumber the uses from zero, keeping their order, before the counter wraps
+static void cacheRenumberUses(void)
+{
+    uint8_t rank[FATFS_CACHE_BLOCKS];
+    uint8_t i, j;
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        rank[i] = 0;
+        for (j = 0; j < FATFS_CACHE_BLOCKS; ++j) {
+            if (cacheEntries[j].lastUse < cacheEntries[i].lastUse) rank[i]++;
+        }
+    }
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        cacheEntries[i].lastUse = rank[i];
+    }
+    cacheUseCounter = FATFS_CACHE_BLOCKS - 1;
+}
+
 static bool cacheRawBlock(uint32_t blockNumber, bool makeDirty)
 {
-    if (cacheBlockNumber != blockNumber) {
-        if (!cacheFlush()) goto fail;
-        DPRINTF("read block %lu\n", blockNumber);
-        if (!sdcardReadBlock(blockNumber * SDCARD_SECTOR_SIZE, cache.data)) goto fail;
-        cacheBlockNumber = blockNumber;
+    CacheEntry_t *e = NULL;
+    uint8_t i;
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        if (cacheEntries[i].blockNumber == blockNumber) {
+            e = &cacheEntries[i];
+            break;
+        }
     }
-    if (makeDirty) cacheDirty = true;
+    if (!e) {
+        e = cacheVictim();
+        if (!cacheEntryFlush(e)) goto fail;
+        DPRINTF("read block %lu\n", blockNumber);
+        // nothing of the old block may stick to the new one
+        e->blockNumber = NO_BLOCK;
+        e->mirrorBlock = 0;
+        e->dirty = false;
+        if (e == fatCacheEntry) fatCacheEntry = NULL;
+        if (!sdcardReadBlock(blockNumber * SDCARD_SECTOR_SIZE, e->u.data)) goto fail;
+        e->blockNumber = blockNumber;
+    }
+    if (cacheUseCounter == 0xff) cacheRenumberUses();
+    e->lastUse = ++cacheUseCounter;
+    if (isFatBlock(blockNumber)) fatCacheEntry = e;
+    if (makeDirty) e->dirty = true;
+    cacheEntry = e;
+    cache = &e->u;
     return true;
 
   fail:
@@ -118,9 +238,16 @@ static bool cacheRawBlock(uint32_t blockNumber, bool makeDirty)
 
 bool fatFsInitPartition(uint8_t partition)
 {
-    cacheDirty = false;
-    cacheMirrorBlock = 0;
-    cacheBlockNumber = ~0ul;
+    uint8_t i;
+    for (i = 0; i < FATFS_CACHE_BLOCKS; ++i) {
+        cacheEntries[i].blockNumber = NO_BLOCK;
+        cacheEntries[i].mirrorBlock = 0;
+        cacheEntries[i].dirty = false;
+        cacheEntries[i].lastUse = 0;
+    }
+    cacheUseCounter = 0;
+    fatCacheEntry = NULL;
+    nextFreeCluster = INITIAL_CLUSTER;
 
     DPRINTF("fatFsInitPartition %d\n", partition);
 
@@ -136,7 +263,7 @@ bool fatFsInitPartition(uint8_t partition)
             goto fail;
         }
 
-        PartitionTable_t* p = & cache.mbr.part[partition - 1];
+        PartitionTable_t* p = & cache->mbr.part[partition - 1];
         if ((p->boot & 0x7F) != 0  ||
               p->totalSectors < 100 ||
               p->firstSector == 0) {
@@ -151,7 +278,7 @@ bool fatFsInitPartition(uint8_t partition)
 
     uint32_t totalSectors;
 
-    FatBootBlock_t *fbs = &cache.fbs;
+    FatBootBlock_t *fbs = &cache->fbs;
     if (le16Read(fbs->bytesPerSector) != 512
             || fbs->numFATs == 0
             || le16Read(fbs->numReservedSectors) == 0
@@ -213,7 +340,7 @@ void fatFsFileRemove(const char *filename)
     DirectoryEntry_t *de = fatFsFileSearch(filename, &directoryEntry);
     if (de) {
         de->filename[0] = FILENAME_DELETED;
-        cacheDirty = true;
+        cacheEntry->dirty = true;
         cacheFlush();
     }
 }
@@ -345,7 +472,7 @@ DirectoryEntry_t *fatFsFileSearch(const char *restrict name,
         }
         uint16_t j;
         for (j = 0; j < SDCARD_SECTOR_SIZE / 32; ++j) {
-            DirectoryEntry_t *e = &cache.entries[j];
+            DirectoryEntry_t *e = &cache->entries[j];
             DPRINTF("check entry %u\n", j);
             printFatEntry(e);
             if (fatNameMatch(e, filename, extension)) {
@@ -376,7 +503,7 @@ uint16_t fatFsGetFiles(char *p, uint16_t bufferSize)
         }
         uint16_t j;
         for (j = 0; j < SDCARD_SECTOR_SIZE / 32; ++j) {
-            DirectoryEntry_t *e = &cache.entries[j];
+            DirectoryEntry_t *e = &cache->entries[j];
             if (end - p >= 13) {
                 if (fatNameGet(e, p)) {
                     p += 12;
@@ -416,13 +543,13 @@ DirectoryEntry_t *fatFsFileCreate(const char *restrict name,
         }
         uint16_t j;
         for (j = 0; j < SDCARD_SECTOR_SIZE / 32; ++j) {
-            DirectoryEntry_t *entry = &cache.entries[j];
+            DirectoryEntry_t *entry = &cache->entries[j];
             if (entry->filename[0] == FILENAME_UNUSED
                     || entry->filename[0] == FILENAME_DELETED) {
                 memcpy(entry->filename, filename, 8);
                 memcpy(entry->extension, extension, 3);
                 memset(entry + 11, 0, sizeof(*entry) - 11);
-                cacheDirty = true;
+                cacheEntry->dirty = true;
                 return entry;
             }
             (*entryIndex)++;
@@ -436,10 +563,8 @@ DirectoryEntry_t *fatFsFileCreate(const char *restrict name,
 static uint8_t fatGet(fat_t cluster, fat_t* value) {
     if (cluster > (fatInfo.clusterCount + 1)) return false;
     uint32_t lba = fatInfo.fatStartBlock + (cluster >> 8);
-    if (lba != cacheBlockNumber) {
-        if (!cacheRawBlock(lba, false)) return false;
-    }
-    *value = cache.fat[cluster & 0XFF];
+    if (!cacheRawBlock(lba, false)) return false;
+    *value = cache->fat[cluster & 0XFF];
     return true;
 }
 
@@ -448,13 +573,10 @@ static bool fatPut(fat_t cluster, fat_t value) {
     if (cluster < INITIAL_CLUSTER) return false;
     if (cluster > (fatInfo.clusterCount + 1)) return false;
     uint32_t lba = fatInfo.fatStartBlock + (cluster >> 8);
-    if (lba != cacheBlockNumber) {
-        if (!cacheRawBlock(lba, false)) return false;
-    }
-    cache.fat[cluster & 0XFF] = value;
-    cacheDirty = true;
+    if (!cacheRawBlock(lba, true)) return false;
+    cache->fat[cluster & 0XFF] = value;
     // mirror second FAT
-    if (fatInfo.numFATs > 1) cacheMirrorBlock = lba + fatInfo.sectorsPerFAT;
+    if (fatInfo.numFATs > 1) cacheEntry->mirrorBlock = lba + fatInfo.sectorsPerFAT;
     return true;
 }
 
@@ -462,6 +584,8 @@ static bool fatFsAllocateCluster(FILE *handle) {
     DPRINTF("fatFsAllocateCluster\n");
 
     fat_t freeCluster = handle->currentCluster ? handle->currentCluster : 1;
+    // no need to look at the clusters known to be in use
+    if (freeCluster < nextFreeCluster - 1) freeCluster = nextFreeCluster - 1;
     uint16_t i;
     for (i = 0; ; i++) {
         if (i >= fatInfo.clusterCount) {
@@ -469,7 +593,7 @@ static bool fatFsAllocateCluster(FILE *handle) {
             return false;
         }
 
-        if (freeCluster > fatInfo.clusterCount) freeCluster = 1;
+        if (freeCluster > fatInfo.clusterCount) freeCluster = nextFreeCluster - 1;
         freeCluster++;
 
         fat_t value;
@@ -484,6 +608,7 @@ static bool fatFsAllocateCluster(FILE *handle) {
         DPRINTF("fatPut (1) failed\n");
         return false;
     }
+    if (freeCluster == nextFreeCluster) nextFreeCluster++;
 
     if (handle->currentCluster != 0) {
         if (!fatPut(handle->currentCluster, freeCluster)) {
@@ -505,7 +630,7 @@ static DirectoryEntry_t* cacheDirEntry(uint16_t index, bool makeDirty)
     if (!cacheRawBlock(fatInfo.rootDirStart + (index >> 4), makeDirty)) {
         return NULL;
     }
-    return &cache.entries[index & 0xF];
+    return &cache->entries[index & 0xF];
 }
 
 void fatFsFileFlush(FILE *handle)
@@ -531,6 +656,16 @@ void fatFsFileClose(FILE *handle)
     fatFsFileFlush(handle);
 }
 
+// The part of the next transfer that can go directly between the user buffer
+// and the card: whole blocks, up to the end of the current cluster
+static uint16_t wholeBlocksInCluster(uint16_t offsetInCluster, uint16_t length)
+{
+    if (offsetInCluster & (SDCARD_SECTOR_SIZE - 1)) return 0;
+    uint32_t leftInCluster = (uint32_t) fatInfo.bytesPerClusterMask + 1 - offsetInCluster;
+    if (length > leftInCluster) length = leftInCluster;
+    return length / SDCARD_SECTOR_SIZE;
+}
+
 uint16_t fatFsRead(FILE *handle, void *buffer, uint16_t maxLength)
 {
     if (!(handle->flags = O_RDWR))  {
@@ -544,62 +679,52 @@ uint16_t fatFsRead(FILE *handle, void *buffer, uint16_t maxLength)
     // if (handle->currentCluster >= FAT16_END_MIN) return 0;
     if (handle->position == handle->fileSize) return 0;
 
-    uint16_t offsetInCluster = handle->position & fatInfo.bytesPerClusterMask;
-    uint16_t offsetInBlock = offsetInCluster & (SDCARD_SECTOR_SIZE - 1);
-    uint16_t blockNumber = fatInfo.dataStartBlock + clusterToBlock(handle->currentCluster);
-    blockNumber += offsetInCluster / SDCARD_SECTOR_SIZE;
-
     // check the file size and do not allow to read too much
     if (handle->position + maxLength > handle->fileSize) {
         maxLength = handle->fileSize - handle->position;
     }
 
-    bool useTwoClusters;
-    if ((offsetInCluster + maxLength) >= (1 << fatInfo.bytesPerClusterShift)) {
-        // will use two clusters
-        useTwoClusters = true;
-    } else {
-        // will use just one cluster
-        useTwoClusters = false;
-    }
-
-    uint16_t maxLength2 = offsetInBlock + maxLength;
-    if (maxLength2 > SDCARD_SECTOR_SIZE) {
-        // will use two reads
-        maxLength2 -= SDCARD_SECTOR_SIZE;
-        maxLength -= maxLength2;
-    } else {
-        // one read will do
-        maxLength2 = 0;
-    }
-
-    DPRINTF("read from block %d\n", blockNumber);
-    if (!cacheRawBlock(blockNumber, false)) {
-        DPRINTF("fatFsRead: raw read failed\n");
-        return 0;
-    }
-    memcpy(buffer, cache.data + offsetInBlock, maxLength);
-    handle->position += maxLength;
-
-    if (maxLength2) {
-        if (useTwoClusters) {
-            // set handle->currentCluster to the next cluster
-            fatGet(handle->currentCluster, &handle->currentCluster);
-            // set to the first block in the next cluster
-            blockNumber = fatInfo.dataStartBlock + clusterToBlock(handle->currentCluster);
+    uint8_t *buf = (uint8_t *) buffer;
+    uint16_t done = 0;
+    while (done < maxLength) {
+        uint16_t offsetInCluster = handle->position & fatInfo.bytesPerClusterMask;
+        uint16_t offsetInBlock = offsetInCluster & (SDCARD_SECTOR_SIZE - 1);
+        uint32_t blockNumber = fatInfo.dataStartBlock + clusterToBlock(handle->currentCluster);
+        blockNumber += offsetInCluster / SDCARD_SECTOR_SIZE;
+
+        uint16_t length = maxLength - done;
+        uint16_t count = wholeBlocksInCluster(offsetInCluster, length);
+        if (count > 1) {
+            // contiguous blocks: read them all with a single card command
+            DPRINTF("read %u blocks from block %lu\n", count, blockNumber);
+            if (!cacheFlushRange(blockNumber, count)
+                    || !sdcardReadBlocks(blockNumber * SDCARD_SECTOR_SIZE, buf + done, count)) {
+                DPRINTF("fatFsRead: raw read failed\n");
+                break;
+            }
+            length = count * SDCARD_SECTOR_SIZE;
         } else {
-            // simply advance the block number by one
-            blockNumber += 1;
+            DPRINTF("read from block %lu\n", blockNumber);
+            if (!cacheRawBlock(blockNumber, false)) {
+                DPRINTF("fatFsRead: raw read failed\n");
+                break;
+            }
+            if (length > SDCARD_SECTOR_SIZE - offsetInBlock) {
+                length = SDCARD_SECTOR_SIZE - offsetInBlock;
+            }
+            memcpy(buf + done, cache->data + offsetInBlock, length);
         }
-        if (!cacheRawBlock(blockNumber, false)) {
-            DPRINTF("fatFsRead: raw read (2) failed\n");
-            return 0;
+        done += length;
+        handle->position += length;
+
+        if (offsetInCluster + length > fatInfo.bytesPerClusterMask
+                && handle->position < handle->fileSize) {
+            // set handle->currentCluster to the next cluster
+            if (!fatGet(handle->currentCluster, &handle->currentCluster)) break;
         }
-        memcpy(buffer + maxLength, cache.data, maxLength2);
-        handle->position += maxLength2;
     }
 
-    return maxLength + maxLength2;
+    return done;
 }
 
 uint16_t fatFsWrite(FILE *handle, const void *buffer, uint16_t length)
@@ -620,95 +745,69 @@ uint16_t fatFsWrite(FILE *handle, const void *buffer, uint16_t length)
     }
     DPRINTF("  currentCluster=%u\n", handle->currentCluster);
 
-    uint16_t offsetInCluster = handle->position & fatInfo.bytesPerClusterMask;
-    uint16_t offsetInBlock = offsetInCluster & (SDCARD_SECTOR_SIZE - 1);
-    uint16_t blockNumber = fatInfo.dataStartBlock + clusterToBlock(handle->currentCluster);
-    blockNumber += offsetInCluster / SDCARD_SECTOR_SIZE;
-
-    uint16_t beforeEnd = handle->fileSize - handle->position;
-    if (beforeEnd < length) {
-        // the file is going to grow
-        handle->fileSize += length - beforeEnd;
-    }
-    handle->position += length;
-    handle->dirEntryDirty = true;
-    DPRINTF("  pos=%lu fileSize=%lu off-in-block=%u\n",
-            handle->position, handle->fileSize, offsetInBlock);
-
-    bool useTwoClusters;
-    if ((offsetInCluster + length) >= (1 << fatInfo.bytesPerClusterShift)) {
-        // will use two clusters
-        useTwoClusters = true;
-    } else {
-        // will use just one cluster
-        useTwoClusters = false;
-    }
-
-    uint16_t length2 = offsetInBlock + length;
-    if (length2 > SDCARD_SECTOR_SIZE) {
-        // will use two writes
-        length2 -= SDCARD_SECTOR_SIZE;
-        length -= length2;
-    } else {
-        // one write will do
-        length2 = 0;
-    }
-    DPRINTF("write in block %d\n", blockNumber);
-    if (!cacheRawBlock(blockNumber, true)) {
-        DPRINTF("fatFsWrite: raw write failed\n");
-        return 0;
-    }
-    memcpy(cache.data + offsetInBlock, buffer, length);
+    const uint8_t *buf = (const uint8_t *) buffer;
+    uint16_t done = 0;
+    while (done < length) {
+        uint16_t offsetInCluster = handle->position & fatInfo.bytesPerClusterMask;
+        uint16_t offsetInBlock = offsetInCluster & (SDCARD_SECTOR_SIZE - 1);
+        uint32_t blockNumber = fatInfo.dataStartBlock + clusterToBlock(handle->currentCluster);
+        blockNumber += offsetInCluster / SDCARD_SECTOR_SIZE;
+
+        uint16_t n = length - done;
+        uint16_t count = wholeBlocksInCluster(offsetInCluster, n);
+        if (count > 1) {
+            // contiguous blocks: write them all with a single card command
+            DPRINTF("write %u blocks in block %lu\n", count, blockNumber);
+            if (!sdcardWriteBlocks(blockNumber * SDCARD_SECTOR_SIZE, buf + done, count)) {
+                DPRINTF("fatFsWrite: raw write failed\n");
+                break;
+            }
+            n = count * SDCARD_SECTOR_SIZE;
+            cacheUpdateRange(blockNumber, count, buf + done);
+        } else {
+            DPRINTF("write in block %lu\n", blockNumber);
+            if (!cacheRawBlock(blockNumber, true)) {
+                DPRINTF("fatFsWrite: raw write failed\n");
+                break;
+            }
+            if (n > SDCARD_SECTOR_SIZE - offsetInBlock) {
+                n = SDCARD_SECTOR_SIZE - offsetInBlock;
+            }
+            memcpy(cache->data + offsetInBlock, buf + done, n);
+        }
+        done += n;
+        handle->position += n;
+        if (handle->position > handle->fileSize) {
+            // the file grows
+            handle->fileSize = handle->position;
+        }
+        handle->dirEntryDirty = true;
+        DPRINTF("  pos=%lu fileSize=%lu off-in-block=%u\n",
+                handle->position, handle->fileSize, offsetInBlock);
 
-    if (length2) {
-        if (useTwoClusters) {
+        if (offsetInCluster + n > fatInfo.bytesPerClusterMask) {
+            // next write will be exactly at the start of the next cluster
             fat_t nextCluster;
-            fatGet(handle->currentCluster, &nextCluster);
+            if (!fatGet(handle->currentCluster, &nextCluster)) break;
             if (nextCluster >= FAT16_END_MIN) {
                 // end reached; allocate new cluster
                 DPRINTF("!!! alloc new cluster\n");
-                if (!fatFsAllocateCluster(handle)) {
-                    return length; // 'length' bytes were already written
-                }
+                if (!fatFsAllocateCluster(handle)) break;
             }
             else {
                 // next cluster is already allocated to the file; use it
                 handle->currentCluster = nextCluster;
                 DPRINTF("use existing next cluster\n");
             }
-            // set to the first block in the next cluster
-            blockNumber = fatInfo.dataStartBlock + clusterToBlock(handle->currentCluster);
-        } else {
-            // simply advance the block number by one
-            blockNumber += 1;
-        }
-        if (!cacheRawBlock(blockNumber, true)) {
-            DPRINTF("fatFsWrite: raw write (2) failed\n");
-            return 0;
-        }
-        memcpy(cache.data, buffer + length, length2);
-    }
-    else if (useTwoClusters) {
-        // next read will be exactly at the start of the next cluster
-        // fatGet(handle->currentCluster, &handle->currentCluster);
-        fat_t nextCluster;
-        fatGet(handle->currentCluster, &nextCluster);
-        if (nextCluster >= FAT16_END_MIN) {
-            // end reached; allocate new cluster
-            DPRINTF("!!! alloc new cluster\n");
-            fatFsAllocateCluster(handle);
-        }
-        else {
-            // next cluster is already allocated to the file; use it
-            handle->currentCluster = nextCluster;
-            DPRINTF("use existing next cluster\n");
         }
     }
 
+#if FATFS_SYNC_WRITES
     // flush it (also writes changes to dir entry table)
     fatFsFileFlush(handle);
+#endif
 
-    return length + length2;
+    return done;
 }
 
 bool fatfsGoToPosition(FILE *handle, uint32_t newPosition)
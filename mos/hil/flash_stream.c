@@ -32,6 +32,10 @@
 #include <assert.h>
 #include <codec.h>
 #include <print.h>
+#if USE_FLASH_STREAM_BUFFER
+#include <alarms.h>
+#include <hil/atomic.h>
+#endif
 
 #if DEBUG
 #define SPRINTF PRINTF
@@ -54,6 +58,18 @@ static volatile uint32_t extFlashAddress;
 
 static uint8_t tmpBuffer[FSTREAM_MAX_RECORD_SIZE];
 
+#if USE_FLASH_STREAM_BUFFER
+// Records not yet written to flash. They always belong to one page:
+// from 'pageBufferAddress' up to the end of that page at most.
+static uint8_t pageBuffer[EXT_FLASH_PAGE_SIZE];
+static uint32_t pageBufferAddress;
+static uint16_t pageBufferLength;
+static Alarm_t flushTimer;
+// the buffer is being filled or written out; the flush timer may fire
+// in the middle of a write, and must leave it alone then
+static bool bufferLocked;
+#endif
+
 // XXX: crc, if present, is currently always at buffer[2]
 struct HeaderWithCrc_s {
     uint16_t __unused;
@@ -64,60 +80,174 @@ typedef struct HeaderWithCrc_s HeaderWithCrc_t;
 
 void flashStreamReset(void)
 {
+#if USE_FLASH_STREAM_BUFFER
+    flashStreamFlush();
+#endif
     extFlashAddress = 0;
 }
 
-static void flashStreamFindStart(void *buffer, uint16_t length, bool crc)
-{
-    bool oneInvalid = false;
-    extFlashAddress = EXT_FLASH_RESERVED;
-
-    while (extFlashAddress < EXT_FLASH_SIZE) {
-        // PRINTF("%lu\n", extFlashAddress);
-        extFlashRead(extFlashAddress, buffer, length);
-        bool valid = true;
-        if (crc) {
-            HeaderWithCrc_t headerWithCrc;
-            memcpy(&headerWithCrc, buffer, sizeof(headerWithCrc));
-            uint16_t calcCrc = crc16((uint8_t *)buffer + sizeof(headerWithCrc), length - sizeof(headerWithCrc));
-            valid = headerWithCrc.crc == calcCrc;
-        } 
-        if (valid) {
-            // check if all fields are 0 - also count as invalid
-            uint16_t i;
-            valid = false;
-            for (i = 0; i < length; ++i) {
-                if (((uint8_t *)buffer)[i] != 0) {
-                    valid = true;
-                    break;
-                }
+#if USE_FLASH_STREAM_BUFFER
+static bool lockBuffer(void)
+{
+    Handle_t h;
+    bool wasLocked;
+    ATOMIC_START(h);
+    wasLocked = bufferLocked;
+    bufferLocked = true;
+    ATOMIC_END(h);
+    return !wasLocked;
+}
+
+// the buffer must be locked
+static bool flushBuffer(void)
+{
+    if (pageBufferLength == 0) return true;
+    if (serial[EXT_FLASH_SPI_ID].busy) return false;
+
+    // the bytes after pageBufferAddress have never been written,
+    // so each flush programs a new part of the page
+    extFlashWrite(pageBufferAddress, pageBuffer, pageBufferLength);
+#if VERIFY
+    uint16_t i;
+    for (i = 0; i < pageBufferLength; i += sizeof(tmpBuffer)) {
+        uint16_t n = pageBufferLength - i;
+        if (n > sizeof(tmpBuffer)) n = sizeof(tmpBuffer);
+        extFlashRead(pageBufferAddress + i, tmpBuffer, n);
+        if (memcmp(pageBuffer + i, tmpBuffer, n)) {
+            ASSERT("writing in flash failed!" && false);
+        }
+    }
+#endif
+    pageBufferAddress += pageBufferLength;
+    pageBufferLength = 0;
+    alarmRemove(&flushTimer);
+    return true;
+}
+
+bool flashStreamFlush(void)
+{
+    bool ok;
+    if (!lockBuffer()) return false;
+    ok = flushBuffer();
+    bufferLocked = false;
+    return ok;
+}
+
+static void flushTimerCb(void *x)
+{
+    if (!flashStreamFlush()) {
+        // the bus or the buffer is in use; try again soon
+        alarmSchedule(&flushTimer, 100);
+    }
+}
+
+// fails, with nothing written, if a full page cannot be flushed;
+// the buffer must be locked
+static bool bufferedWrite(const uint8_t *data, uint16_t length)
+{
+    uint16_t done = 0;
+
+    // a full page left behind by a failed flush must go first
+    if (pageBufferLength
+            && (pageBufferAddress + pageBufferLength) % EXT_FLASH_PAGE_SIZE == 0) {
+        if (!flushBuffer()) return false;
+    }
+
+    while (done < length) {
+        if (pageBufferLength == 0) {
+            pageBufferAddress = extFlashAddress;
+            if (!flushTimer.callback) {
+                alarmInit(&flushTimer, flushTimerCb, NULL);
             }
+            alarmScheduleWithSlack(&flushTimer, FLASH_STREAM_FLUSH_TIMEOUT,
+                                   FLASH_STREAM_FLUSH_TIMEOUT / 4);
         }
-        if (valid) {
-            oneInvalid = false;
+        uint16_t pageLeft = EXT_FLASH_PAGE_SIZE
+                - (uint16_t) (extFlashAddress % EXT_FLASH_PAGE_SIZE);
+        uint16_t now = length - done < pageLeft ? length - done : pageLeft;
+        memcpy(pageBuffer + pageBufferLength, data + done, now);
+        pageBufferLength += now;
+        extFlashAddress += now;
+        done += now;
+        // the page is complete
+        if (now == pageLeft && !flushBuffer()) {
+            // the page stays buffered; it is flushed before the next write
+            if (done == length) break;
+            // the rest of the record has no room: take back the first part,
+            // which is all in this page, as records are shorter than a page
+            pageBufferLength -= done;
+            extFlashAddress -= done;
+            return false;
+        }
+    }
+    return true;
+}
+
+// whether the record can be written without flushing the buffer
+static bool fitsInBuffer(uint16_t length)
+{
+    return extFlashAddress != 0
+            && extFlashAddress % EXT_FLASH_PAGE_SIZE + length < EXT_FLASH_PAGE_SIZE;
+}
+#endif
+
+// a slot that was never written: all bytes erased
+static bool isBlank(const uint8_t *buffer, uint16_t length)
+{
+    uint16_t i;
+    if (buffer[0] != 0 && buffer[0] != 0xff) return false;
+    for (i = 1; i < length; ++i) {
+        if (buffer[i] != buffer[0]) return false;
+    }
+    return true;
+}
+
+static bool isSlotFree(uint32_t slot, void *buffer, uint16_t length)
+{
+    extFlashRead(EXT_FLASH_RESERVED + slot * length, buffer, length);
+    return isBlank(buffer, length);
+}
+
+//
+// The log is a run of written records followed by free slots, so the end
+// is found by binary search over the slots: O(log n) reads instead of
+// reading and CRC-ing every record. The end is the first of two
+// consecutive free slots, so that a single blank record does not end the log.
+//
+static void flashStreamFindStart(void *buffer, uint16_t length)
+{
+    uint32_t slots = (EXT_FLASH_SIZE - EXT_FLASH_RESERVED) / length;
+    uint32_t low = 0, high = slots;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (isSlotFree(mid, buffer, length)
+                && (mid + 1 == slots || isSlotFree(mid + 1, buffer, length))) {
+            high = mid;
         } else {
-            // XXX: this is supposed to find first non-packet, but it will find first two invalid packets!!
-            if (!oneInvalid) {
-                oneInvalid = true;
-            } else {
-                extFlashAddress -= length;
-                break;
-            }
+            low = mid + 1;
         }
-        extFlashAddress += length;
     }
+    extFlashAddress = EXT_FLASH_RESERVED + low * length;
 }
 
 bool flashStreamWriteRecord(void *data, uint16_t length, bool crc)
 {
+#if USE_FLASH_STREAM_BUFFER
+    bool ok;
+#endif
     ASSERT(length <= sizeof(tmpBuffer));
 
+#if USE_FLASH_STREAM_BUFFER
+    // XXX hack
+    if (!fitsInBuffer(length) && serial[EXT_FLASH_SPI_ID].busy) return false;
+#else
     // XXX hack
     if (serial[EXT_FLASH_SPI_ID].busy) return false;
+#endif
 
     if (extFlashAddress == 0) {
         //void *buffer = memoryAlloc(length);
-        flashStreamFindStart(tmpBuffer, length, crc);
+        flashStreamFindStart(tmpBuffer, length);
         //memoryFree(buffer);
     }
 
@@ -127,6 +257,13 @@ bool flashStreamWriteRecord(void *data, uint16_t length, bool crc)
         uint16_t calcCrc = crc16((uint8_t *)data + sizeof(HeaderWithCrc_t), length - sizeof(HeaderWithCrc_t));
         memcpy((uint8_t *)data + 2, &calcCrc, sizeof(calcCrc));
     }
+#if USE_FLASH_STREAM_BUFFER
+    // the flush timer is in progress
+    if (!lockBuffer()) return false;
+    ok = bufferedWrite(data, length);
+    bufferLocked = false;
+    if (!ok) return false;
+#else
     // PRINTF("sdcard write at %lu\n", extFlashAddress);
     extFlashWrite(extFlashAddress, data, length);
     // make sure it's saved to the card, not just in buffers
@@ -140,19 +277,89 @@ bool flashStreamWriteRecord(void *data, uint16_t length, bool crc)
     //memoryFree(copy);
 #endif
     extFlashAddress += length;
+#endif // USE_FLASH_STREAM_BUFFER
     return true;
 }
 
+static bool isCrcValid(const void *data, uint16_t length)
+{
+    HeaderWithCrc_t headerWithCrc;
+    memcpy(&headerWithCrc, data, sizeof(headerWithCrc));
+    uint16_t calcCrc = crc16((uint8_t *)data + sizeof(headerWithCrc), length - sizeof(headerWithCrc));
+    return headerWithCrc.crc == calcCrc;
+}
+
 bool flashStreamReadRecord(void *data, uint16_t length, bool crc)
 {
-    if (extFlashAddress == 0) flashStreamFindStart(data, length, crc);
+#if USE_FLASH_STREAM_BUFFER
+    // the flash must hold everything written so far
+    if (!flashStreamFlush()) return false;
+#endif
+    if (extFlashAddress == 0) flashStreamFindStart(data, length);
     extFlashRead(extFlashAddress, data, length);
-    if (crc) {
-        HeaderWithCrc_t headerWithCrc;
-        memcpy(&headerWithCrc, data, sizeof(headerWithCrc));
-        uint16_t calcCrc = crc16((uint8_t *)data + sizeof(headerWithCrc), length - sizeof(headerWithCrc));
-        return headerWithCrc.crc == calcCrc;
-    }
+    if (crc) return isCrcValid(data, length);
     extFlashAddress += length;
     return true;
 }
+
+// a bad record is looked past for this many slots before it is taken
+// to be part of an older log format at the start of the stream
+#define FIND_PROBE_SLOTS 4
+
+// read the (epoch, time) key of the first valid record in the slots
+// from '*slot' up to 'limit'; '*slot' is moved to that record
+static bool readKey(uint32_t *slot, uint32_t limit, uint16_t length,
+        uint16_t timeOffset, uint16_t *epoch, uint32_t *time)
+{
+    uint32_t last = *slot + FIND_PROBE_SLOTS;
+    if (last > limit) last = limit;
+    for (; *slot < last; ++*slot) {
+        extFlashRead(EXT_FLASH_RESERVED + *slot * length, tmpBuffer, length);
+        if (isBlank(tmpBuffer, length) || !isCrcValid(tmpBuffer, length)) continue;
+        memcpy(epoch, tmpBuffer + timeOffset, sizeof(*epoch));
+        memcpy(time, tmpBuffer + timeOffset + sizeof(*epoch), sizeof(*time));
+        return true;
+    }
+    return false;
+}
+
+uint32_t flashStreamFindTime(uint16_t epoch, uint32_t time, uint16_t length, uint16_t timeOffset)
+{
+    ASSERT(length <= sizeof(tmpBuffer));
+#if USE_FLASH_STREAM_BUFFER
+    if (!flashStreamFlush()) return 0;
+#endif
+    if (extFlashAddress == 0) flashStreamFindStart(tmpBuffer, length);
+
+    // the records are in (epoch, time) order, so they serve as their own index
+    uint32_t low = 0, high = (extFlashAddress - EXT_FLASH_RESERVED) / length;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        uint32_t slot = mid;
+        uint16_t e;
+        uint32_t t;
+        if (!readKey(&slot, high, length, timeOffset, &e, &t)) {
+            if (slot == high) high = mid; // nothing valid up to 'high'
+            else low = mid + 1;           // an old log, before all records
+        } else if (e < epoch || (e == epoch && t < time)) {
+            low = slot + 1;
+        } else {
+            high = mid;
+        }
+    }
+    // there may be bad records before the one found
+    return EXT_FLASH_RESERVED + low * length;
+}
+
+bool flashStreamReadRecordAt(uint32_t address, void *data, uint16_t length, bool crc)
+{
+#if USE_FLASH_STREAM_BUFFER
+    if (!flashStreamFlush()) return false;
+#endif
+    if (extFlashAddress == 0) flashStreamFindStart(tmpBuffer, length);
+    if (address < EXT_FLASH_RESERVED || address + length > extFlashAddress) return false;
+
+    extFlashRead(address, data, length);
+    if (crc) return isCrcValid(data, length);
+    return true;
+}
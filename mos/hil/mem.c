@@ -27,7 +27,20 @@
 //--------------------------------------------------------------------------------
 
 #include <stdlib.h>
+#include <string.h>
+#include <dynamic_memory.h>
 #include "mem.h"
+#if USE_MEMORY_STATS
+#include <lib/dprint.h>
+#endif
+#if USE_MEMORY_PROFILE
+#if PLATFORM_PC
+#include <stdio.h>
+#include <time.h>
+#else
+#include <platform.h>
+#endif
+#endif
 
 //----------------------------------------------------------
 // types
@@ -42,19 +55,162 @@ typedef struct Node_s {
    struct Node_s *next;
 } Node_t;
 
+// block sizes and counts of the fixed-size pools, smallest first
+#ifndef MEM_POOL_SIZES
+#define MEM_POOL_SIZES 16, 32, 64, 128
+#endif
+#ifndef MEM_POOL_COUNTS
+#define MEM_POOL_COUNTS 8, 8, 4, 4
+#endif
+
+// fill allocated blocks, to find uninitialized use and measure usage
+#ifndef MEMORY_FILL
+#ifdef DEBUG
+#define MEMORY_FILL 1
+#else
+#define MEMORY_FILL 0
+#endif
+#endif
+
+#if USE_MEMORY_POOLS
+/** @brief A free block in a fixed-size pool */
+typedef struct PoolBlock_s {
+   struct PoolBlock_s *next;
+} PoolBlock_t;
+
+/** @brief A pool of equally sized blocks */
+typedef struct Pool_s {
+   uint8_t *start;
+   uint8_t *end;
+   PoolBlock_t *freelist;
+   uint16_t blockSize;
+} Pool_t;
+#endif
+
 //--------------------------------------------------------------------------------
 // variables
 //--------------------------------------------------------------------------------
 static Node_t *freelist; // List head
 
+#if USE_MEMORY_POOLS
+static const uint16_t poolSizes[] = { MEM_POOL_SIZES };
+static const uint16_t poolCounts[] = { MEM_POOL_COUNTS };
+#define NUM_POOLS (sizeof(poolSizes) / sizeof(*poolSizes))
+static Pool_t pools[NUM_POOLS];
+#else
+#define NUM_POOLS 0
+#endif
+
+#if USE_MEMORY_STATS
+// the pools, then the heap
+static MemoryStats_t stats[NUM_POOLS + 1];
+#define HEAP_STATS (&stats[NUM_POOLS])
+
+static inline void statsAlloc(MemoryStats_t *st, uint16_t size) {
+    st->allocs++;
+    st->used += size;
+    if (st->used > st->maxUsed) st->maxUsed = st->used;
+}
+static inline void statsFree(MemoryStats_t *st, uint16_t size) {
+    st->frees++;
+    st->used -= size;
+}
+#define STATS_ALLOC(st, size) statsAlloc(st, size)
+#define STATS_FREE(st, size) statsFree(st, size)
+#define STATS_FAIL(st) (st)->failures++
+#else
+#define STATS_ALLOC(st, size)
+#define STATS_FREE(st, size)
+#define STATS_FAIL(st)
+#endif
+
 //--------------------------------------------------------------------------------
 // functions
 //--------------------------------------------------------------------------------
-inline void flagBlock(Node_t *n);
-inline void combine(Node_t *n1, Node_t *n2);
+static inline void flagBlock(Node_t *n);
+static inline void combine(Node_t *n1, Node_t *n2);
+
+#if USE_MEMORY_POOLS
+// cut the pools from the start of the region; returns the space used
+static uint16_t poolsInit(uint8_t *region, uint16_t size)
+{
+    uint16_t used = 0;
+    uint_t i;
+    for (i = 0; i < NUM_POOLS; ++i) {
+        Pool_t *pool = &pools[i];
+        uint16_t count = poolCounts[i];
+        // each block must hold the free list pointer and keep alignment
+        pool->blockSize = ALIGN_UP(poolSizes[i] < sizeof(PoolBlock_t) ?
+                sizeof(PoolBlock_t) : poolSizes[i], sizeof(PoolBlock_t));
+        // leave at least some space for the heap
+        uint16_t room = size - used > sizeof(Node_t) ?
+                size - used - sizeof(Node_t) : 0;
+        if ((uint32_t) pool->blockSize * count > room) {
+            count = room / pool->blockSize;
+        }
+        pool->start = region + used;
+        pool->end = pool->start + pool->blockSize * count;
+        pool->freelist = NULL;
+        while (count--) {
+            PoolBlock_t *b = (PoolBlock_t *) (pool->start + pool->blockSize * count);
+            b->next = pool->freelist;
+            pool->freelist = b;
+        }
+        used += pool->end - pool->start;
+#if USE_MEMORY_STATS
+        stats[i].blockSize = pool->blockSize;
+        stats[i].total = pool->end - pool->start;
+#endif
+    }
+    return used;
+}
+
+static void *poolAlloc(uint16_t size)
+{
+    uint_t i;
+    for (i = 0; i < NUM_POOLS; ++i) {
+        Pool_t *pool = &pools[i];
+        if (pool->blockSize < size) continue;
+        if (pool->freelist) {
+            PoolBlock_t *b = pool->freelist;
+            pool->freelist = b->next;
+            STATS_ALLOC(&stats[i], pool->blockSize);
+            return b;
+        }
+        // the right class is exhausted, let the heap handle it
+        STATS_FAIL(&stats[i]);
+        break;
+    }
+    return NULL;
+}
+
+static bool poolFree(void *block)
+{
+    uint_t i;
+    for (i = 0; i < NUM_POOLS; ++i) {
+        Pool_t *pool = &pools[i];
+        if ((uint8_t *) block >= pool->start && (uint8_t *) block < pool->end) {
+            PoolBlock_t *b = (PoolBlock_t *) block;
+            b->next = pool->freelist;
+            pool->freelist = b;
+            STATS_FREE(&stats[i], pool->blockSize);
+            return true;
+        }
+    }
+    return false;
+}
+#endif // USE_MEMORY_POOLS
 
 void memoryInit(void *region, uint16_t size)
 {
+#if USE_MEMORY_POOLS
+    uint16_t used = poolsInit((uint8_t *) region, size);
+    region = (uint8_t *) region + used;
+    size -= used;
+#endif
+#if USE_MEMORY_STATS
+    HEAP_STATS->total = size - sizeof(Node_t);
+#endif
     /*set up the initial free list with one region*/
     freelist = (Node_t *)region;
     freelist->size = size - sizeof(Node_t);
@@ -62,13 +218,19 @@ void memoryInit(void *region, uint16_t size)
     freelist->next = freelist;
 }
 
-void *memoryAlloc(uint16_t size)
+static inline void *allocBlock(uint16_t size)
 {
     Node_t *current;
     Node_t *best;
 
+#if USE_MEMORY_POOLS
+    current = poolAlloc(size);
+    if (current) return current;
+#endif
+
     if (freelist == NULL) {
         // No free memory available
+        STATS_FAIL(HEAP_STATS);
         return NULL;
     }
 
@@ -96,6 +258,7 @@ void *memoryAlloc(uint16_t size)
 
     // if we could not find a block, return NULL
     if (best == NULL) {
+        STATS_FAIL(HEAP_STATS);
         return NULL;
     }
 
@@ -118,6 +281,7 @@ void *memoryAlloc(uint16_t size)
         }
 
         flagBlock(best); // Fill the block for later analysis
+        STATS_ALLOC(HEAP_STATS, best->size);
 
         return (uint8_t *)best + sizeof(Node_t);
     }
@@ -129,6 +293,7 @@ void *memoryAlloc(uint16_t size)
         current->size = size;
 
         flagBlock(current); // Fill the block for later analysis
+        STATS_ALLOC(HEAP_STATS, current->size);
         return (uint8_t *)current + sizeof(Node_t);
     }
 }
@@ -136,25 +301,27 @@ void *memoryAlloc(uint16_t size)
 /** @brief Flag a block of memory with 0xEF
  *
  * Fill a block of memory with 0xEF so it's easier to do analysis later on the usage.
+ * Done only when MEMORY_FILL is enabled (by default, in debug builds).
  * @param n Block to fill
  */
-inline void flagBlock(Node_t *n)
+static inline void flagBlock(Node_t *n)
 {
-    uint16_t index;
-    uint8_t *ptr;
-
-    ptr = (uint8_t *)n + sizeof(Node_t);
-
-    for (index = 0; index < (n->size); index++)
-        ptr[index] = 0xEF;
+#if MEMORY_FILL
+    memset((uint8_t *)n + sizeof(Node_t), 0xEF, n->size);
+#endif
 }
 
-void memoryFree(void* block)
+static inline void freeBlock(void *block)
 {
     Node_t *current;
 
+#if USE_MEMORY_POOLS
+    if (poolFree(block)) return;
+#endif
+
     // Get the region's header.
     Node_t *region = (Node_t *) ((uint8_t *)block - sizeof(Node_t));
+    STATS_FREE(HEAP_STATS, region->size);
 
     if (freelist == NULL) { // This is now the only free memory
         freelist = region;
@@ -204,7 +371,7 @@ void memoryFree(void* block)
  * @param n1 First block
  * @param n2 Second block
  */
-inline void combine(Node_t *n1, Node_t *n2) {
+static inline void combine(Node_t *n1, Node_t *n2) {
     /*remove n2 from the free list*/
     n1->next = n2->next;
     n2->next->prev = n1;
@@ -212,3 +379,192 @@ inline void combine(Node_t *n1, Node_t *n2) {
     /*adjust size of n1*/
     n1->size = n1->size + n2->size + sizeof(Node_t);
 }
+
+#if USE_MEMORY_PROFILE
+#define PROFILE_SITES   16
+#define PROFILE_BUCKETS 12
+
+typedef struct CallSite_s {
+    void *address;
+    uint32_t allocs;
+    uint32_t bytes;
+    uint32_t failures;
+} CallSite_t;
+
+static CallSite_t callSites[PROFILE_SITES];
+static uint32_t otherSites;
+// power-of-two histograms of the time taken
+static uint32_t allocLatency[PROFILE_BUCKETS];
+static uint32_t freeLatency[PROFILE_BUCKETS];
+
+#if PLATFORM_PC
+#define PROFILE_UNIT "ns"
+static FILE *traceFile;
+static bool traceChecked;
+
+static uint32_t profileClock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+// record a trace for tools/memreplay when MANSOS_MEM_TRACE is set
+static FILE *getTraceFile(void)
+{
+    if (!traceChecked) {
+        const char *path = getenv("MANSOS_MEM_TRACE");
+        traceChecked = true;
+        if (path) traceFile = fopen(path, "w");
+    }
+    return traceFile;
+}
+#else
+#define PROFILE_UNIT "timer ticks"
+#define profileClock() ALARM_TIMER_READ()
+#endif
+
+// time since `start`; the alarm timer is only 16 bits wide, so the
+// difference is taken modulo its period (2 s at 32 kHz) - far longer
+// than any allocation should take
+#if PLATFORM_PC
+#define profileElapsed(start) (profileClock() - (start))
+#else
+#define profileElapsed(start) ((uint16_t) (profileClock() - (start)))
+#endif
+
+static void profileLatency(uint32_t *histogram, uint32_t time)
+{
+    uint_t i = 0;
+    while (time > 1 && i < PROFILE_BUCKETS - 1) {
+        time >>= 1;
+        i++;
+    }
+    histogram[i]++;
+}
+
+static void profileCallSite(void *address, uint16_t size, bool ok)
+{
+    uint_t i;
+    for (i = 0; i < PROFILE_SITES; ++i) {
+        if (callSites[i].address == address || !callSites[i].address) {
+            callSites[i].address = address;
+            callSites[i].allocs++;
+            callSites[i].bytes += size;
+            if (!ok) callSites[i].failures++;
+            return;
+        }
+    }
+    otherSites++;
+}
+
+void *memoryAlloc(uint16_t size)
+{
+    void *site = __builtin_return_address(0);
+    uint32_t start = profileClock();
+    void *result = allocBlock(size);
+    profileLatency(allocLatency, profileElapsed(start));
+    profileCallSite(site, size, result != NULL);
+#if PLATFORM_PC
+    if (result && getTraceFile()) fprintf(traceFile, "a %p %u\n", result, size);
+#endif
+    return result;
+}
+
+void memoryFree(void *block)
+{
+    uint32_t start = profileClock();
+    freeBlock(block);
+    profileLatency(freeLatency, profileElapsed(start));
+#if PLATFORM_PC
+    if (getTraceFile()) fprintf(traceFile, "f %p\n", block);
+#endif
+}
+
+static void dumpLatency(const char *name, uint32_t *histogram)
+{
+    uint_t i;
+    PRINTF("%s latency (" PROFILE_UNIT "):", name);
+    for (i = 0; i < PROFILE_BUCKETS; ++i) {
+        // the lower bound of each bucket
+        if (histogram[i]) {
+            PRINTF(" %lu+: %lu", i ? 1ul << i : 0ul, (unsigned long) histogram[i]);
+        }
+    }
+    PRINTF("\n");
+}
+
+void memoryProfileDump(void)
+{
+    uint_t i;
+    memoryStatsDump();
+    for (i = 0; i < PROFILE_SITES && callSites[i].address; ++i) {
+        PRINTF("site %p: %lu allocs, %lu bytes, %lu failed\n",
+                callSites[i].address, (unsigned long) callSites[i].allocs,
+                (unsigned long) callSites[i].bytes,
+                (unsigned long) callSites[i].failures);
+    }
+    if (otherSites) PRINTF("other sites: %lu allocs\n", (unsigned long) otherSites);
+    dumpLatency("alloc", allocLatency);
+    dumpLatency("free", freeLatency);
+#if PLATFORM_PC
+    if (traceFile) fflush(traceFile);
+#endif
+}
+
+#else // !USE_MEMORY_PROFILE
+
+void *memoryAlloc(uint16_t size)
+{
+    return allocBlock(size);
+}
+
+void memoryFree(void *block)
+{
+    freeBlock(block);
+}
+
+#endif // USE_MEMORY_PROFILE
+
+#if USE_MEMORY_STATS
+const MemoryStats_t *memoryGetStats(uint_t i)
+{
+    return i <= NUM_POOLS ? &stats[i] : NULL;
+}
+
+void memoryHeapInfo(uint16_t *freeBlocks, uint16_t *freeBytes,
+                    uint16_t *largestFree)
+{
+    Node_t *current = freelist;
+    *freeBlocks = 0;
+    *freeBytes = 0;
+    *largestFree = 0;
+    if (!current) return;
+    do {
+        (*freeBlocks)++;
+        *freeBytes += current->size;
+        if (current->size > *largestFree) *largestFree = current->size;
+        current = current->next;
+    } while (current != freelist);
+}
+
+void memoryStatsDump(void)
+{
+    uint16_t freeBlocks, freeBytes, largestFree;
+    uint_t i;
+    for (i = 0; i <= NUM_POOLS; ++i) {
+        if (i < NUM_POOLS) {
+            PRINTF("pool %u: ", stats[i].blockSize);
+        } else {
+            PRINTF("heap: ");
+        }
+        PRINTF("%u/%u bytes used, max %u; %lu allocs, %lu frees, %lu failed\n",
+                stats[i].used, stats[i].total, stats[i].maxUsed,
+                (unsigned long) stats[i].allocs, (unsigned long) stats[i].frees,
+                (unsigned long) stats[i].failures);
+    }
+    memoryHeapInfo(&freeBlocks, &freeBytes, &largestFree);
+    PRINTF("heap: %u bytes free in %u blocks, largest %u\n",
+            freeBytes, freeBlocks, largestFree);
+}
+#endif
@@ -33,7 +33,10 @@
 static uint32_t randomKey;
 
 void randomInit() {
-#if PLATFORM_PC
+#if USE_PC_SIM
+    // repeatable, but different for each mote
+    randomKey = pcSimRandomSeed();
+#elif PLATFORM_PC
     struct timeval tv;
     gettimeofday(&tv, NULL);
     randomKey = tv.tv_usec + tv.tv_sec;
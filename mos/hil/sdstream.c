@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <codec.h>
 #include <print.h>
+#include <hil/atomic.h>
 
 #if DEBUG
 #define SPRINTF PRINTF
@@ -50,6 +51,27 @@ static volatile uint32_t sdCardAddress;
 
 static uint8_t tmpBuffer[SDSTREAM_MAX_RECORD_SIZE];
 
+// a record is being written or read; records may be queried from an
+// interrupt handler in the middle of a write, which must not then touch
+// the card cache, tmpBuffer or sdCardAddress
+static bool streamLocked;
+
+static bool lockStream(void)
+{
+    Handle_t h;
+    bool wasLocked;
+    ATOMIC_START(h);
+    wasLocked = streamLocked;
+    streamLocked = true;
+    ATOMIC_END(h);
+    return !wasLocked;
+}
+
+static inline void unlockStream(void)
+{
+    streamLocked = false;
+}
+
 // XXX: crc, if present, is acutrrently always at buffer[2]
 struct HeaderWithCrc_s {
     uint16_t __unused;
@@ -63,45 +85,43 @@ void sdStreamReset(void)
     sdCardAddress = 0;
 }
 
-static void sdStreamFindStart(void *buffer, uint16_t length, bool crc)
+// a slot that was never written: all bytes erased
+static bool isBlank(const uint8_t *buffer, uint16_t length)
 {
-    bool oneInvalid = false;
-    sdCardAddress = SDCARD_RESERVED;
-
-    while (sdCardAddress < SDCARD_SIZE) {
-        // PRINTF("%lu\n", sdCardAddress);
-        sdcardRead(sdCardAddress, buffer, length);
-        bool valid = true;
-        if (crc) {
-            HeaderWithCrc_t headerWithCrc;
-            memcpy(&headerWithCrc, buffer, sizeof(headerWithCrc));
-            uint16_t calcCrc = crc16((uint8_t *)buffer + sizeof(headerWithCrc), length - sizeof(headerWithCrc));
-            valid = headerWithCrc.crc == calcCrc;
-        } 
-        if (valid) {
-            // check if all fields are 0 - also count as invalid
-            uint16_t i;
-            valid = false;
-            for (i = 0; i < length; ++i) {
-                if (((uint8_t *)buffer)[i] != 0) {
-                    valid = true;
-                    break;
-                }
-            }
-        }
-        if (valid) {
-            oneInvalid = false;
+    uint16_t i;
+    if (buffer[0] != 0 && buffer[0] != 0xff) return false;
+    for (i = 1; i < length; ++i) {
+        if (buffer[i] != buffer[0]) return false;
+    }
+    return true;
+}
+
+static bool isSlotFree(uint32_t slot, void *buffer, uint16_t length)
+{
+    sdcardRead(SDCARD_RESERVED + slot * length, buffer, length);
+    return isBlank(buffer, length);
+}
+
+//
+// The log is a run of written records followed by free slots, so the end
+// is found by binary search over the slots: O(log n) reads instead of
+// reading and CRC-ing every record. The end is the first of two
+// consecutive free slots, so that a single blank record does not end the log.
+//
+static void sdStreamFindStart(void *buffer, uint16_t length)
+{
+    uint32_t slots = (SDCARD_SIZE - SDCARD_RESERVED) / length;
+    uint32_t low = 0, high = slots;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (isSlotFree(mid, buffer, length)
+                && (mid + 1 == slots || isSlotFree(mid + 1, buffer, length))) {
+            high = mid;
         } else {
-            // XXX: this is supposed to find first non-packet, but it will find first two invalid packets!!
-            if (!oneInvalid) {
-                oneInvalid = true;
-            } else {
-                sdCardAddress -= length;
-                break;
-            }
+            low = mid + 1;
         }
-        sdCardAddress += length;
     }
+    sdCardAddress = SDCARD_RESERVED + low * length;
 }
 
 bool sdStreamWriteRecord(void *data, uint16_t length, bool crc)
@@ -110,10 +130,11 @@ bool sdStreamWriteRecord(void *data, uint16_t length, bool crc)
 
     // XXX hack
     if (serial[SDCARD_SPI_ID].busy) return false;
+    if (!lockStream()) return false;
 
     if (sdCardAddress == 0) {
         //void *buffer = memoryAlloc(length);
-        sdStreamFindStart(tmpBuffer, length, crc);
+        sdStreamFindStart(tmpBuffer, length);
         //memoryFree(buffer);
     }
 
@@ -124,9 +145,11 @@ bool sdStreamWriteRecord(void *data, uint16_t length, bool crc)
         memcpy((uint8_t *)data + 2, &calcCrc, sizeof(calcCrc));
     }
     // PRINTF("sdcard write at %lu\n", sdCardAddress);
-    sdcardWrite(sdCardAddress, data, length);
     // make sure it's saved to the card, not just in buffers
-    sdcardFlush();
+    if (!sdcardWrite(sdCardAddress, data, length) || !sdcardFlush()) {
+        unlockStream();
+        return false;
+    }
 #if VERIFY
     //void *copy = memoryAlloc(length);
     sdcardRead(sdCardAddress, tmpBuffer, length);
@@ -136,19 +159,87 @@ bool sdStreamWriteRecord(void *data, uint16_t length, bool crc)
     //memoryFree(copy);
 #endif
     sdCardAddress += length;
+    unlockStream();
     return true;
 }
 
+static bool isCrcValid(const void *data, uint16_t length)
+{
+    HeaderWithCrc_t headerWithCrc;
+    memcpy(&headerWithCrc, data, sizeof(headerWithCrc));
+    uint16_t calcCrc = crc16((uint8_t *)data + sizeof(headerWithCrc), length - sizeof(headerWithCrc));
+    return headerWithCrc.crc == calcCrc;
+}
+
 bool sdStreamReadRecord(void *data, uint16_t length, bool crc)
 {
-    if (sdCardAddress == 0) sdStreamFindStart(data, length, crc);
-    sdcardRead(sdCardAddress, data, length);
-    if (crc) {
-        HeaderWithCrc_t headerWithCrc;
-        memcpy(&headerWithCrc, data, sizeof(headerWithCrc));
-        uint16_t calcCrc = crc16((uint8_t *)data + sizeof(headerWithCrc), length - sizeof(headerWithCrc));
-        return headerWithCrc.crc == calcCrc;
+    bool ok = true;
+    if (!lockStream()) return false;
+    if (sdCardAddress == 0) sdStreamFindStart(data, length);
+    if (!sdcardRead(sdCardAddress, data, length)) ok = false;
+    else if (crc) ok = isCrcValid(data, length);
+    else sdCardAddress += length;
+    unlockStream();
+    return ok;
+}
+
+// a bad record is looked past for this many slots before it is taken
+// to be part of an older log format at the start of the stream
+#define FIND_PROBE_SLOTS 4
+
+// read the (epoch, time) key of the first valid record in the slots
+// from '*slot' up to 'limit'; '*slot' is moved to that record
+static bool readKey(uint32_t *slot, uint32_t limit, uint16_t length,
+        uint16_t timeOffset, uint16_t *epoch, uint32_t *time)
+{
+    uint32_t last = *slot + FIND_PROBE_SLOTS;
+    if (last > limit) last = limit;
+    for (; *slot < last; ++*slot) {
+        sdcardRead(SDCARD_RESERVED + *slot * length, tmpBuffer, length);
+        if (isBlank(tmpBuffer, length) || !isCrcValid(tmpBuffer, length)) continue;
+        memcpy(epoch, tmpBuffer + timeOffset, sizeof(*epoch));
+        memcpy(time, tmpBuffer + timeOffset + sizeof(*epoch), sizeof(*time));
+        return true;
     }
-    sdCardAddress += length;
-    return true;
+    return false;
+}
+
+uint32_t sdStreamFindTime(uint16_t epoch, uint32_t time, uint16_t length, uint16_t timeOffset)
+{
+    ASSERT(length <= sizeof(tmpBuffer));
+    if (!lockStream()) return 0;
+    if (sdCardAddress == 0) sdStreamFindStart(tmpBuffer, length);
+
+    // the records are in (epoch, time) order, so they serve as their own index
+    uint32_t low = 0, high = (sdCardAddress - SDCARD_RESERVED) / length;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        uint32_t slot = mid;
+        uint16_t e;
+        uint32_t t;
+        if (!readKey(&slot, high, length, timeOffset, &e, &t)) {
+            if (slot == high) high = mid; // nothing valid up to 'high'
+            else low = mid + 1;           // an old log, before all records
+        } else if (e < epoch || (e == epoch && t < time)) {
+            low = slot + 1;
+        } else {
+            high = mid;
+        }
+    }
+    unlockStream();
+    // there may be bad records before the one found
+    return SDCARD_RESERVED + low * length;
+}
+
+bool sdStreamReadRecordAt(uint32_t address, void *data, uint16_t length, bool crc)
+{
+    bool ok = false;
+    if (!lockStream()) return false;
+    if (sdCardAddress == 0) sdStreamFindStart(tmpBuffer, length);
+    if (address >= SDCARD_RESERVED && address + length <= sdCardAddress) {
+        ok = sdcardRead(address, data, length)
+                && (!crc || isCrcValid(data, length));
+    }
+    unlockStream();
+    return ok;
 }
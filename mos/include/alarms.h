@@ -44,6 +44,12 @@ typedef struct Alarm_s {
     void *data;
     //! time when the alarm should be fired (absolute value)
     uint32_t jiffies;
+    //! the alarm may be fired up to this many milliseconds later
+    uint16_t slack;
+#if USE_ALARM_WHEEL
+    //! the link that points to this alarm; NULL when not scheduled
+    struct Alarm_s **pprev;
+#endif
 } Alarm_t;
 
 // -----------------------------------------------
@@ -61,6 +67,10 @@ static inline void alarmInit(Alarm_t *alarm, AlarmCallback cb, void *param)
     alarm->callback = cb;
     alarm->data = param;
     alarm->jiffies = 0;
+    alarm->slack = 0;
+#if USE_ALARM_WHEEL
+    alarm->pprev = NULL;
+#endif
 }
 
 ///
@@ -71,6 +81,17 @@ static inline void alarmInit(Alarm_t *alarm, AlarmCallback cb, void *param)
 ///
 void alarmSchedule(Alarm_t *alarm, uint32_t milliseconds);
 
+///
+/// Schedule an alarm timer that does not need to fire exactly on time
+/// @param milliseconds    milliseconds after which the timer will fire (relative value)
+/// @param slack           the timer may fire up to this many milliseconds later
+///
+/// Alarms with overlapping windows are fired together, at the end of the
+/// earliest window, so that the system wakes up less often.
+///
+void alarmScheduleWithSlack(Alarm_t *alarm, uint32_t milliseconds,
+                            uint16_t slack);
+
 ///
 /// Remove an alarm timer
 ///
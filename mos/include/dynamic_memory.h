@@ -32,6 +32,11 @@
 /// Note: on small-memory & long-lifetime HW static allocation is almost always better.
 /// Avoid using dynamic memory whenever possible!
 ///
+/// With USE_MEMORY_POOLS, small allocations are served in O(1) from
+/// fixed-size pools (block sizes in MEM_POOL_SIZES, counts in
+/// MEM_POOL_COUNTS), cut from the start of the region. Larger requests,
+/// and requests when the matching pool is empty, go to the heap.
+///
 
 #include <stdtypes.h>
 
@@ -44,4 +49,32 @@ void memoryFree(void *block);
 // platform-specific initalization
 void memoryInit(void *region, uint16_t size);
 
+#if USE_MEMORY_STATS
+typedef struct MemoryStats_s {
+    uint16_t blockSize;  // zero for the heap
+    uint16_t total;      // bytes available
+    uint16_t used;       // bytes in use, including rounding
+    uint16_t maxUsed;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;   // for pools: requests passed on to the heap
+} MemoryStats_t;
+
+//! Statistics of the i-th pool; the heap comes after all pools. NULL past it
+const MemoryStats_t *memoryGetStats(uint_t i);
+
+//! Number of blocks in the heap free list, their total size and the largest one
+void memoryHeapInfo(uint16_t *freeBlocks, uint16_t *freeBytes,
+                    uint16_t *largestFree);
+
+//! Print statistics of all pools and the heap
+void memoryStatsDump(void);
+#endif
+
+#if USE_MEMORY_PROFILE
+//! Print statistics, allocation counts per call site and latency histograms.
+//! On pc, set MANSOS_MEM_TRACE=<file> to record a trace for tools/memreplay
+void memoryProfileDump(void);
+#endif
+
 #endif
@@ -27,6 +27,10 @@
 /// \file
 /// External flash stream module interface (i.e. raw access without file system)
 ///
+/// All records in a stream must have the same length. The end of the stream
+/// is found by binary search for blank (all 0x00 or 0xff) record slots,
+/// so a record must never consist of a single repeated 0x00 or 0xff byte.
+///
 
 #include <defines.h>
 
@@ -44,10 +48,48 @@ bool flashStreamWriteRecord(void *data, uint16_t length, bool crc);
 
 ///
 /// Read a record
-/// @return     true on success, false on failure (including bad crc)
+/// @return     true on success, false on failure (including bad crc,
+///             or buffered records that could not be flushed)
 ///
 bool flashStreamReadRecord(void *data, uint16_t length, bool crc);
 
+///
+/// Find the first record with (epoch, time) not less than the given.
+/// Each record must have a crc, and at 'timeOffset' bytes from its start
+/// a 16-bit epoch followed by a 32-bit timestamp. Records must be written
+/// in (epoch, time) order: the writer starts a new epoch whenever its
+/// clock goes back, e.g. after a reboot.
+/// @return     address of the record, or of bad records just before it
+///             (skip them when reading); the end of the stream if there is none;
+///             0 if buffered records could not be flushed
+///
+uint32_t flashStreamFindTime(uint16_t epoch, uint32_t time, uint16_t length, uint16_t timeOffset);
+
+///
+/// Read the record at 'address' (e.g. as returned by flashStreamFindTime()),
+/// leaving the write position as it is
+/// @return     false if there is no record there or its crc is wrong
+///
+bool flashStreamReadRecordAt(uint32_t address, void *data, uint16_t length, bool crc);
+
+#if USE_FLASH_STREAM_BUFFER
+///
+/// Write the buffered records to flash now
+/// @return     false if the flash or the buffer is busy (being written from
+///             another context), nothing written then
+///
+/// With USE_FLASH_STREAM_BUFFER records are collected in RAM and written
+/// one page at a time. The buffer is also flushed FLASH_STREAM_FLUSH_TIMEOUT
+/// milliseconds after the first record in it, which bounds what can be lost
+/// on reset. A record that was only partly written fails its CRC check.
+///
+bool flashStreamFlush(void);
+
+#ifndef FLASH_STREAM_FLUSH_TIMEOUT
+#define FLASH_STREAM_FLUSH_TIMEOUT  (60 * 1000ul) // 1 minute
+#endif
+#endif
+
 ///
 /// Number of reserved bytes (left unused by the stream module)
 /// at the start of external flash memory
@@ -30,6 +30,10 @@
 /// Similar to flash stream, but simpler, as data can be rewritten
 /// without erasing whole sectors.
 ///
+/// All records in a stream must have the same length. The end of the stream
+/// is found by binary search for blank (all 0x00 or 0xff) record slots,
+/// so a record must never consist of a single repeated 0x00 or 0xff byte.
+///
 
 #include <defines.h>
 
@@ -52,6 +56,26 @@ bool sdStreamWriteRecord(void *data, uint16_t length, bool crc);
 ///
 bool sdStreamReadRecord(void *data, uint16_t length, bool crc);
 
+///
+/// Find the first record with (epoch, time) not less than the given.
+/// Each record must have a crc, and at 'timeOffset' bytes from its start
+/// a 16-bit epoch followed by a 32-bit timestamp. Records must be written
+/// in (epoch, time) order: the writer starts a new epoch whenever its
+/// clock goes back, e.g. after a reboot.
+/// @return     address of the record, or of bad records just before it
+///             (skip them when reading); the end of the stream if there is none
+///             0 if the stream is busy, e.g. being written when called
+///             from an interrupt handler
+///
+uint32_t sdStreamFindTime(uint16_t epoch, uint32_t time, uint16_t length, uint16_t timeOffset);
+
+///
+/// Read the record at 'address' (e.g. as returned by sdStreamFindTime()),
+/// leaving the write position as it is
+/// @return     false if there is no record there or its crc is wrong
+///
+bool sdStreamReadRecordAt(uint32_t address, void *data, uint16_t length, bool crc);
+
 ///
 /// Number of reserved bytes (left unused by the stream module)
 /// at the start of SD card
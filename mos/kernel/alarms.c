@@ -31,6 +31,23 @@
 
 // the global list with all alarms
 AlarmList_t alarmListHead;
+uint32_t alarmListDeadline;
+
+// find the earliest deadline
+static void updateDeadline(void)
+{
+    Alarm_t *a = SLIST_FIRST(&alarmListHead);
+    if (!a) return;
+    alarmListDeadline = a->jiffies + a->slack;
+    // the list is sorted by time, and a deadline is never before the time
+    for (a = SLIST_NEXT(a, chain);
+         a && timeAfter32(alarmListDeadline, a->jiffies);
+         a = SLIST_NEXT(a, chain)) {
+        if (timeAfter32(alarmListDeadline, a->jiffies + a->slack)) {
+            alarmListDeadline = a->jiffies + a->slack;
+        }
+    }
+}
 
 void initAlarms(void)
 {
@@ -62,18 +79,28 @@ void alarmsProcess(void)
             break;
         }
 
-        // save next alarm for later reference
-        Alarm_t **next = &SLIST_NEXT(ap, chain);
         // remove the alarm from the list
-        *a = *next;
+        *a = SLIST_NEXT(ap, chain);
         // call the callback
         ap->callback(ap->data);
-        // move to the next
-        a = next;
+        // start over, as the callback may have (re)scheduled alarms
+        // anywhere in the list, including the one just fired
+        a = &SLIST_FIRST(&alarmListHead);
     }
+
+    Handle_t h;
+    ATOMIC_START(h);
+    updateDeadline();
+    ATOMIC_END(h);
 }
 
 void alarmSchedule(Alarm_t *alarm, uint32_t milliseconds)
+{
+    alarmScheduleWithSlack(alarm, milliseconds, 0);
+}
+
+void alarmScheduleWithSlack(Alarm_t *alarm, uint32_t milliseconds,
+                            uint16_t slack)
 {
     // the alarm must have valid callback
     ASSERT(alarm->callback != NULL);
@@ -84,6 +111,7 @@ void alarmSchedule(Alarm_t *alarm, uint32_t milliseconds)
 
     // PRINTF("alarmSchedule %p, ms=%lu\n", alarm, milliseconds);
     alarm->jiffies = (uint32_t)getJiffies() + milliseconds;
+    alarm->slack = slack;
 
     // locking is required, because both kernel and user threads can be using this function
     Handle_t h;
@@ -92,6 +120,11 @@ void alarmSchedule(Alarm_t *alarm, uint32_t milliseconds)
     // unschedule the alarm, if it was already scheduled
     SLIST_REMOVE_SAFE(&alarmListHead, alarm, Alarm_s, chain);
 
+#if USE_THREADS
+    uint32_t oldDeadline = alarmListDeadline;
+    bool wasEmpty = SLIST_EMPTY(&alarmListHead);
+#endif
+
     // insert it in appropriate position
     Alarm_t **prev = &SLIST_FIRST(&alarmListHead);
     Alarm_t *a = *prev;
@@ -101,12 +134,17 @@ void alarmSchedule(Alarm_t *alarm, uint32_t milliseconds)
     }
     SLIST_INSERT(prev, alarm, chain);
 
+    // the alarm may have been holding the old deadline, so recalculate
+    updateDeadline();
+
 #if USE_THREADS
-    // always reschedule alarm processing in case some alarm was added
-    // that might need to be processed before end of current kernel sleep time
-    processFlags.bits.alarmsProcess = true;
-    // and make sure the kernel thread is awake and ready to deal with it
-    threadWakeup(KERNEL_THREAD_INDEX, THREAD_READY);
+    if (wasEmpty || timeAfter32(oldDeadline, alarmListDeadline)) {
+        // reschedule alarm processing, as this alarm might need to be
+        // processed before end of current kernel sleep time
+        processFlags.bits.alarmsProcess = true;
+        // and make sure the kernel thread is awake and ready to deal with it
+        threadWakeup(KERNEL_THREAD_INDEX, THREAD_READY);
+    }
 #endif
 
     ATOMIC_END(h);
@@ -117,6 +155,7 @@ void alarmRemove(Alarm_t *alarm)
     Handle_t h;
     ATOMIC_START(h);
     SLIST_REMOVE_SAFE(&alarmListHead, alarm, Alarm_s, chain);
+    updateDeadline();
     ATOMIC_END(h);
 }
 
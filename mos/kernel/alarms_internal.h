@@ -31,11 +31,6 @@
 // include user API
 #include <alarms.h>
 
-typedef SLIST_HEAD(head, Alarm_s) AlarmList_t;
-
-// the global list with all alarms
-extern AlarmList_t alarmListHead;
-
 // initiaze alarms
 void initAlarms(void);
 
@@ -43,19 +38,73 @@ void initAlarms(void);
 // or from interrupt context (when threads are not enabled)
 void alarmsProcess(void);
 
+#if USE_ALARM_WHEEL
+
+// wheel geometry: ALARM_WHEEL_LEVELS levels of 2^ALARM_WHEEL_BITS slots;
+// 4 levels of 32 slots cover 17 minutes, longer alarms are cascaded again
+#ifndef ALARM_WHEEL_BITS
+#define ALARM_WHEEL_BITS 5
+#endif
+#ifndef ALARM_WHEEL_LEVELS
+#define ALARM_WHEEL_LEVELS 4
+#endif
+#define ALARM_WHEEL_SLOTS (1 << ALARM_WHEEL_BITS)
+
+#if ALARM_WHEEL_BITS > 5
+typedef uint64_t AlarmWheelMask_t;
+#else
+typedef uint32_t AlarmWheelMask_t;
+#endif
+
+// number of scheduled alarms
+extern uint16_t alarmWheelCount;
+// the earliest deadline (time plus slack) of the alarms; may be too early,
+// when that alarm has been removed
+extern uint32_t alarmWheelNext;
+
+static inline bool alarmListEmpty(void)
+{
+    return alarmWheelCount == 0;
+}
+
+static inline uint32_t alarmListFirstTime(void)
+{
+    return alarmWheelNext;
+}
+
+#else // !USE_ALARM_WHEEL
+
+typedef SLIST_HEAD(head, Alarm_s) AlarmList_t;
+
+// the global list with all alarms, sorted by time
+extern AlarmList_t alarmListHead;
+// the earliest deadline (time plus slack) of the alarms; may be too early,
+// when that alarm has been removed
+extern uint32_t alarmListDeadline;
+
+static inline bool alarmListEmpty(void)
+{
+    return SLIST_EMPTY(&alarmListHead);
+}
+
+static inline uint32_t alarmListFirstTime(void)
+{
+    return alarmListDeadline;
+}
+
+#endif // USE_ALARM_WHEEL
+
 // used for kernel
 static inline bool hasAnyAlarms(void)
 {
-    Alarm_t *first = SLIST_FIRST(&alarmListHead);
-    return first != NULL;
+    return !alarmListEmpty();
 }
 
-// used for kernel to determine how long to put kernel thread to sleep
+// used for kernel to determine how long to put kernel thread to sleep:
+// the time when the first alarm (or a group of them) must be fired
 static inline uint32_t getNextAlarmTime(void)
 {
-    Alarm_t *first = SLIST_FIRST(&alarmListHead);
-    // PRINTF("getNextAlarmTime: %p: %lu\n", first, first ? first->jiffies : getJiffies());
-    return first->jiffies;
+    return alarmListFirstTime();
 }
 
 #if USE_THREADS
@@ -63,9 +112,9 @@ static inline uint32_t getNextAlarmTime(void)
 static inline void scheduleProcessAlarms(uint32_t now)
 {
     // if there are no alarms, return
-    if (SLIST_EMPTY(&alarmListHead)) return;
+    if (alarmListEmpty()) return;
     // take the first alarm and compare its time with the current time
-    if (timeAfter(SLIST_FIRST(&alarmListHead)->jiffies, now) == false) {
+    if (timeAfter(alarmListFirstTime(), now) == false) {
         processFlags.bits.alarmsProcess = true;
     }
 }
@@ -76,9 +125,9 @@ static inline void scheduleProcessAlarms(uint32_t now)
 static inline bool hasAnyReadyAlarms(uint32_t now)
 {
     // if there are no alarms, return false
-    if (SLIST_EMPTY(&alarmListHead)) return false;
+    if (alarmListEmpty()) return false;
     // take the fist alarm and compare its time with the current time
-    return !timeAfter(SLIST_FIRST(&alarmListHead)->jiffies, now);
+    return !timeAfter(alarmListFirstTime(), now);
 }
 
 #endif // USE_THREADS
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Alarms kept in a hierarchical timer wheel (USE_ALARM_WHEEL=y).
+//
+// Level 0 has a slot for each of the next ALARM_WHEEL_SLOTS milliseconds,
+// level 1 for each of the next ALARM_WHEEL_SLOTS level 0 rounds, and so on.
+// Alarms from a higher level slot are moved ("cascaded") down when the
+// lower level wraps around to that slot. Scheduling and removing an alarm
+// take constant time, whatever the number of alarms; the cost of firing is
+// moved to alarmsProcess(), which runs with interrupts enabled between
+// the callbacks.
+//
+
+#if USE_THREADS
+#include "threads/threads.h"
+#endif
+#include "alarms_internal.h"
+#include <timing.h>
+#include <print.h>
+#include <stack.h>
+
+#define SLOT_MASK (ALARM_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) (ALARM_WHEEL_BITS * (level))
+// alarms further away are kept in the last level and cascaded again
+#define WHEEL_RANGE ((uint32_t) 1 << LEVEL_SHIFT(ALARM_WHEEL_LEVELS))
+
+static Alarm_t *wheel[ALARM_WHEEL_LEVELS][ALARM_WHEEL_SLOTS];
+// non-empty slots of each level
+static AlarmWheelMask_t wheelMask[ALARM_WHEEL_LEVELS];
+// the current millisecond of the wheel; earlier alarms have been fired
+static uint32_t wheelTime;
+// changed whenever an alarm goes in or out of the wheel
+static uint16_t wheelChanges;
+
+uint16_t alarmWheelCount;
+uint32_t alarmWheelNext;
+
+void initAlarms(void)
+{
+    wheelTime = (uint32_t) getJiffies();
+    ALARM_TIMER_START();
+}
+
+static void slotInsert(Alarm_t *alarm, uint_t level, uint_t slot)
+{
+    Alarm_t **head = &wheel[level][slot];
+    SLIST_NEXT(alarm, chain) = *head;
+    if (*head) (*head)->pprev = &SLIST_NEXT(alarm, chain);
+    *head = alarm;
+    alarm->pprev = head;
+    wheelMask[level] |= (AlarmWheelMask_t) 1 << slot;
+    wheelChanges++;
+}
+
+static void wheelInsert(Alarm_t *alarm)
+{
+    uint32_t expires = alarm->jiffies;
+    uint32_t delta = expires - wheelTime;
+    if ((int32_t) delta < 0) {
+        // late already
+        expires = wheelTime;
+        delta = 0;
+    } else if (delta >= WHEEL_RANGE) {
+        expires = wheelTime + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+    uint_t level = 0;
+    while (delta >> LEVEL_SHIFT(level + 1)) level++;
+    slotInsert(alarm, level, (expires >> LEVEL_SHIFT(level)) & SLOT_MASK);
+}
+
+static void wheelRemove(Alarm_t *alarm)
+{
+    Alarm_t *next = SLIST_NEXT(alarm, chain);
+    *alarm->pprev = next;
+    if (next) {
+        next->pprev = alarm->pprev;
+    } else if (alarm->pprev >= &wheel[0][0]
+            && alarm->pprev < &wheel[0][0] + ALARM_WHEEL_LEVELS * ALARM_WHEEL_SLOTS) {
+        // was the only one in its slot
+        uint_t i = alarm->pprev - &wheel[0][0];
+        wheelMask[i / ALARM_WHEEL_SLOTS] &=
+                ~((AlarmWheelMask_t) 1 << (i % ALARM_WHEEL_SLOTS));
+    }
+    alarm->pprev = NULL;
+    alarmWheelCount--;
+    wheelChanges++;
+}
+
+// take all alarms out of the slot
+static Alarm_t *slotTake(uint_t level, uint_t slot)
+{
+    Alarm_t *list = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    wheelMask[level] &= ~((AlarmWheelMask_t) 1 << slot);
+    wheelChanges++;
+    return list;
+}
+
+// move the alarms of the current slot of each level down, as needed
+static void wheelCascade(void)
+{
+    uint_t level;
+    for (level = 1; level < ALARM_WHEEL_LEVELS; ++level) {
+        uint_t slot = (wheelTime >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        Alarm_t *a = slotTake(level, slot);
+        while (a) {
+            Alarm_t *next = SLIST_NEXT(a, chain);
+            wheelInsert(a);
+            a = next;
+        }
+        // the higher level moves on only when this one wraps around
+        if (slot) break;
+    }
+}
+
+// the first non-empty slot of the level, starting from the given one
+static int_t nextSlot(uint_t level, uint_t from)
+{
+    AlarmWheelMask_t mask = wheelMask[level];
+    uint_t i;
+    if (!mask) return -1;
+    for (i = 0; i < ALARM_WHEEL_SLOTS; ++i) {
+        uint_t slot = (from + i) & SLOT_MASK;
+        if (mask & ((AlarmWheelMask_t) 1 << slot)) return slot;
+    }
+    return -1;
+}
+
+// the next time after wheelTime when anything happens: a level 0 slot
+// becomes due or a higher level slot is cascaded down
+static uint32_t nextEvent(void)
+{
+    uint32_t next = wheelTime + WHEEL_RANGE;
+    uint_t level;
+    for (level = 0; level < ALARM_WHEEL_LEVELS; ++level) {
+        uint_t shift = LEVEL_SHIFT(level);
+        uint_t current = (wheelTime >> shift) & SLOT_MASK;
+        // the current slot itself is reached only after a full round
+        int_t slot = nextSlot(level, current + 1);
+        if (slot < 0) continue;
+        uint32_t rounds = ((slot - current - 1) & SLOT_MASK) + 1;
+        uint32_t start = ((wheelTime >> shift) + rounds) << shift;
+        if (timeAfter32(next, start)) next = start;
+    }
+    return next;
+}
+
+// lower the deadline to the earliest one in the slot. Interrupts are
+// disabled for one alarm at a time; false if the wheel changed meanwhile
+static bool slotEarliest(uint_t level, uint_t slot, uint32_t *earliest,
+                         uint16_t changes)
+{
+    Alarm_t *a = NULL;
+    bool unchanged;
+    Handle_t h;
+    do {
+        ATOMIC_START(h);
+        unchanged = wheelChanges == changes;
+        if (unchanged) {
+            a = a ? SLIST_NEXT(a, chain) : wheel[level][slot];
+            if (a && timeAfter32(*earliest, a->jiffies + a->slack)) {
+                *earliest = a->jiffies + a->slack;
+            }
+        }
+        ATOMIC_END(h);
+    } while (unchanged && a);
+    return unchanged;
+}
+
+// find the earliest deadline (time plus slack). Slots are visited in
+// the order of time; a slot that starts after the deadline found so far
+// cannot have an earlier one. This takes time in proportion to the number
+// of alarms, so it runs with interrupts enabled; if an alarm is scheduled
+// or removed meanwhile, the start of the next used slot is taken instead,
+// which is never later than the deadline
+static void updateNext(void)
+{
+    uint_t level, i;
+    uint32_t next;
+    uint16_t changes;
+    bool unchanged = true;
+    Handle_t h;
+
+    ATOMIC_START(h);
+    changes = wheelChanges;
+    ATOMIC_END(h);
+    if (alarmWheelCount == 0) return;
+
+    next = wheelTime + WHEEL_RANGE;
+    for (level = 0; unchanged && level < ALARM_WHEEL_LEVELS - 1; ++level) {
+        uint_t shift = LEVEL_SHIFT(level);
+        // at level 0 the current slot holds the due alarms; at higher
+        // levels it has been cascaded already
+        uint_t first = level ? 1 : 0;
+        if (!wheelMask[level]) continue;
+        for (i = first; unchanged && i < ALARM_WHEEL_SLOTS + first; ++i) {
+            uint32_t start = ((wheelTime >> shift) + i) << shift;
+            uint_t slot = ((wheelTime >> shift) + i) & SLOT_MASK;
+            if (!timeAfter32(next, start)) break;
+            if (wheelMask[level] & ((AlarmWheelMask_t) 1 << slot)) {
+                unchanged = slotEarliest(level, slot, &next, changes);
+            }
+        }
+    }
+    // the last level may hold clamped alarms in any slot
+    for (i = 0; unchanged && i < ALARM_WHEEL_SLOTS; ++i) {
+        unchanged = slotEarliest(ALARM_WHEEL_LEVELS - 1, i, &next, changes);
+    }
+
+    ATOMIC_START(h);
+    if (wheelChanges != changes) {
+        // alarms late already are in the current level 0 slot
+        next = wheel[0][wheelTime & SLOT_MASK] ? wheelTime : nextEvent();
+    }
+    if (alarmWheelCount) alarmWheelNext = next;
+    ATOMIC_END(h);
+}
+
+void alarmsProcess(void)
+{
+    uint32_t now = (uint32_t) getJiffies();
+    Handle_t h;
+
+    ATOMIC_START(h);
+    while (!timeAfter32(wheelTime, now)) {
+        uint_t index = wheelTime & SLOT_MASK;
+
+        if (wheel[0][index]) {
+            // fire the alarms of this millisecond. They are moved to a list
+            // of their own, from which the callbacks may still remove them;
+            // alarms that the callbacks schedule for now go back to the slot
+            Alarm_t *due = slotTake(0, index);
+            due->pprev = &due;
+            while (due) {
+                Alarm_t *a = due;
+                wheelRemove(a);
+                // the alarm must have valid callback
+                ASSERT(a->callback != NULL);
+                ATOMIC_END(h);
+                a->callback(a->data);
+                ATOMIC_START(h);
+            }
+            continue;
+        }
+        if (wheelTime == now) break;
+
+        // skip straight to the next used slot, so that catching up
+        // takes a step per event rather than per level 0 round
+        uint32_t next = nextEvent();
+        if (timeAfter32(next, now)) next = now;
+        wheelTime = next;
+        if ((wheelTime & SLOT_MASK) == 0) wheelCascade();
+
+        // let the interrupts in between the steps
+        ATOMIC_END(h);
+        ATOMIC_START(h);
+    }
+    ATOMIC_END(h);
+    updateNext();
+}
+
+void alarmSchedule(Alarm_t *alarm, uint32_t milliseconds)
+{
+    alarmScheduleWithSlack(alarm, milliseconds, 0);
+}
+
+void alarmScheduleWithSlack(Alarm_t *alarm, uint32_t milliseconds,
+                            uint16_t slack)
+{
+    // the alarm must have valid callback
+    ASSERT(alarm->callback != NULL);
+
+    // we want to avoid inserting local variables in the global alarm list
+    // (but this warning, not an error, because the user function may never return)
+    WARN_ON(isStackAddress(alarm));
+
+    alarm->jiffies = (uint32_t)getJiffies() + milliseconds;
+    alarm->slack = slack;
+
+    // locking is required, because both kernel and user threads can be using this function
+    Handle_t h;
+    ATOMIC_START(h);
+
+    // unschedule the alarm, if it was already scheduled
+    if (alarm->pprev) wheelRemove(alarm);
+
+    wheelInsert(alarm);
+    bool earliest = alarmWheelCount++ == 0
+            || timeAfter32(alarmWheelNext, alarm->jiffies + slack);
+    if (earliest) alarmWheelNext = alarm->jiffies + slack;
+
+#if USE_THREADS
+    if (earliest) {
+        // reschedule alarm processing, as this alarm might need to be
+        // processed before end of current kernel sleep time
+        processFlags.bits.alarmsProcess = true;
+        // and make sure the kernel thread is awake and ready to deal with it
+        threadWakeup(KERNEL_THREAD_INDEX, THREAD_READY);
+    }
+#endif
+
+    ATOMIC_END(h);
+}
+
+void alarmRemove(Alarm_t *alarm)
+{
+    Handle_t h;
+    ATOMIC_START(h);
+    // alarmWheelNext may now be too early; that only costs
+    // an extra call of alarmsProcess()
+    if (alarm->pprev) wheelRemove(alarm);
+    ATOMIC_END(h);
+}
+
+uint32_t getAlarmTime(Alarm_t *alarm)
+{
+    return (uint32_t)(alarm->jiffies - getJiffies());
+}
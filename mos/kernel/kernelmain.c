@@ -239,6 +239,10 @@ static inline void initSystem(void)
 }
 
 #if USE_KERNEL_MAIN
+#if USE_PC_SIM
+// the simulator has its own main() and calls this for each mote
+#define main pcSimMoteMain
+#endif
 //----------------------------------------------------------
 //      Main entry point
 //----------------------------------------------------------
@@ -275,7 +279,12 @@ int main(void)
     // and do all the "real work" in interrupt handlers.
     // Therefore, interrupts must be kept enabled.
     //
-    for (;;) {}
+    for (;;) {
+#if PLATFORM_PC
+        // let the (possibly virtual) time go on
+        doMsleep(PLATFORM_MAX_SLEEP_MS);
+#endif
+    }
 #endif // USE_THREADS
 
     return 0;
@@ -47,9 +47,8 @@ void msleep(uint16_t ms)
         // calculate time to sleep: minumum of 'ms' and time to next alarm
         Handle_t handle;
         ATOMIC_START(handle);
-        Alarm_t *first = SLIST_FIRST(&alarmListHead);
-        if (first && timeAfter32(sleepEnd, first->jiffies)) {
-            msToSleep = first->jiffies - now;
+        if (hasAnyAlarms() && timeAfter32(sleepEnd, getNextAlarmTime())) {
+            msToSleep = getNextAlarmTime() - now;
             // PRINTF("alarms, dont sleep to end!, msToSleep=%u\n", msToSleep);
             // do the alarm processing with enabled interrupts - it can take long!
             // make sure no outstanding alarms are present
@@ -83,6 +83,7 @@ void doMsleep(uint16_t milliseconds)
         DISABLE_INTS();
 
         isInSleepMode = false;
+        energyCountWakeup();
 
         // determine for how long we actually slept
         // (unexpected wakeups are possible because of interrupts)
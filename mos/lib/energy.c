@@ -25,6 +25,7 @@
 #include <lib/dprint.h>
 
 volatile EnergyStats_t energyStats[TOTAL_ENERGY_CONSUMERS];
+volatile uint32_t energyWakeups;
 
 const char *energyConsumerNames[TOTAL_ENERGY_CONSUMERS] = {
     "MCU",
@@ -52,6 +53,7 @@ void energyStatsDump(void)
         PRINTF("%s: %lu%s\n", energyConsumerNames[i], energyStats[i].totalTicks,
                 energyStats[i].on ? " (on)" : "");
     }
+    PRINTF("wakeups: %lu\n", energyWakeups);
 }
 
 
@@ -57,6 +57,9 @@ typedef struct EnergyStats_s {
 
 extern volatile EnergyStats_t energyStats[TOTAL_ENERGY_CONSUMERS];
 
+// how many times the MCU has woken up from low power mode
+extern volatile uint32_t energyWakeups;
+
 #if USE_ENERGY_STATS
 
 void energyConsumerOn(EnergyConsumer_t type);
@@ -92,6 +95,8 @@ static inline void energyConsumerSet(EnergyConsumer_t type, uint8_t on) {
 #define energyConsumerOffIRQ(type)                             \
     if (_energy_consumer_off) energyConsumerOffNoints(type);   \
 
+#define energyCountWakeup() energyWakeups++
+
 
 #else
 
@@ -105,6 +110,8 @@ static inline void energyConsumerSet(EnergyConsumer_t type, uint8_t on) {
 #define energyConsumerOnIRQ(type)      // nothing
 #define energyConsumerOffIRQ(type)     // nothing
 
+#define energyCountWakeup()            // nothing
+
 #endif
 
 void energyStatsDump(void);
@@ -64,7 +64,9 @@ on 1 byte), but shoehorning those bytes into integers efficiently is messy.
 # define HASH_LITTLE_ENDIAN 0
 # define HASH_BIG_ENDIAN 1
 # define hashbig hash
-#elif defined __IEEE_LITTLE_ENDIAN
+#elif defined __IEEE_LITTLE_ENDIAN \
+    || (defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+// glibc (the pc platform) does not define __IEEE_*, but gcc knows
 # define HASH_LITTLE_ENDIAN 1
 # define HASH_BIG_ENDIAN 0
 # define hashlittle hash
@@ -75,10 +75,12 @@
 #define FCF_EXT_SRC_PORT        0x04
 #define FCF_EXT_DST_PORT        0x08
 #define FCF_EXT_HOPLIMIT        0x10
-// there are more data
-//#define FCF_EXT_MORE            0x20
+// end-to-end sequence number, set by the originator and kept when forwarding
+#define FCF_EXT_ORIG_SEQNUM     0x20
 // this packet is an acknowledgement
 #define FCF_EXT_IS_ACK          0x40
+// sequence numbers (re)start; the receiver may resynchronize
+#define FCF_EXT_SYNC            0x80
 
 enum {
     MOS_ADDR_TYPE_SHORT,
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dup_cache.h"
+#include <timing.h>
+
+#if NET_DUP_CACHE_SIZE & (NET_DUP_CACHE_SIZE - 1)
+#error NET_DUP_CACHE_SIZE must be a power of two
+#endif
+
+// slots probed from the home slot of a packet
+#define DUP_CACHE_PROBES  4
+
+typedef struct DupEntry_s {
+    MosShortAddr origin;
+    uint8_t seqnum;
+    uint32_t time;
+} DupEntry_t;
+
+static DupEntry_t cache[NET_DUP_CACHE_SIZE];
+
+static uint8_t originSeqnum;
+
+static inline bool isExpired(DupEntry_t *e, uint32_t now) {
+    return !e->time || timeAfter32(now, e->time + NET_DUP_CACHE_TIMEOUT);
+}
+
+void dupCacheStamp(MacInfo_t *mi)
+{
+    // zero means "not numbered"
+    if (++originSeqnum == 0) originSeqnum++;
+    mi->originSeqnum = originSeqnum;
+}
+
+bool dupCacheCheck(MacInfo_t *mi)
+{
+    MosShortAddr origin = mi->originalSrc.shortAddr;
+    uint8_t seqnum = mi->originSeqnum;
+    uint8_t home = (origin * 7 + seqnum) & (NET_DUP_CACHE_SIZE - 1);
+    uint32_t now = (uint32_t) getJiffies();
+    DupEntry_t *e, *victim = NULL;
+    uint8_t i;
+
+    // without a sequence number, two packets cannot be told apart
+    if (!seqnum) return false;
+
+    for (i = 0; i < DUP_CACHE_PROBES; ++i) {
+        e = &cache[(home + i) & (NET_DUP_CACHE_SIZE - 1)];
+        if (isExpired(e, now)) {
+            if (!victim || !isExpired(victim, now)) victim = e;
+            continue;
+        }
+        if (e->origin == origin && e->seqnum == seqnum) {
+            // the time is not refreshed: once the sequence numbers wrap
+            // around, the same number is a new packet
+            return true;
+        }
+        // otherwise, the oldest entry goes
+        if (!victim || (!isExpired(victim, now)
+                        && timeAfter32(victim->time, e->time))) {
+            victim = e;
+        }
+    }
+
+    victim->origin = origin;
+    victim->seqnum = seqnum;
+    victim->time = now ? : 1; // zero marks a free slot
+    return false;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MANSOS_DUP_CACHE_H
+#define MANSOS_DUP_CACHE_H
+
+/// \file
+/// Duplicate suppression for packets that pass through this node
+/// (USE_NET_DUP_CACHE, on by default with USE_NET).
+///
+/// Remembers recently forwarded packets by originator and end-to-end
+/// sequence number. MAC sequence numbers are per hop and change on every
+/// forward, so originators stamp each packet with a number of their own,
+/// carried in the extended MAC header. Packets without one are never
+/// considered duplicates.
+///
+
+#include "mac.h"
+
+//! Remembered packets, a power of two
+#ifndef NET_DUP_CACHE_SIZE
+#define NET_DUP_CACHE_SIZE  16
+#endif
+
+//! Milliseconds after which a remembered packet is forgotten
+#ifndef NET_DUP_CACHE_TIMEOUT
+#define NET_DUP_CACHE_TIMEOUT  2000
+#endif
+
+#if USE_NET_DUP_CACHE
+
+//! Returns true if the packet was seen recently; remembers it otherwise
+bool dupCacheCheck(MacInfo_t *mi);
+
+//! Stamp a locally originated packet with the next end-to-end sequence number
+void dupCacheStamp(MacInfo_t *mi);
+
+#else
+
+#define dupCacheCheck(mi) false
+#define dupCacheStamp(mi) do {} while (0)
+
+#endif
+
+#endif
@@ -27,15 +27,9 @@
 #include <print.h>
 #include <stdlib.h>
 #include <errors.h>
-#include <mutex.h>
-
-static Mutex_t macMutex;
-
-#define MAX_MAC_HEADER_LEN  30
-static uint8_t headerBuffer[MAX_MAC_HEADER_LEN]; // XXX: watch out for size
 
 int8_t macSend(MosAddr *dst, const uint8_t *data, uint16_t length) {
-    static MacInfo_t mi;
+    MacInfo_t mi;
     memset(&mi, 0, sizeof(mi));
     fillLocalAddress(&mi.originalSrc);
     if (dst) {
@@ -47,31 +41,34 @@ int8_t macSend(MosAddr *dst, const uint8_t *data, uint16_t length) {
 }
 
 int8_t macSendEx(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
+    // per-call header storage, so that senders need not take turns
+    uint8_t header[MAX_MAC_HEADER_LEN];
     int8_t ret;
 
-    // this function is not reentrant, because as single buffer is used for all mac headers
-    mutexLock(&macMutex);
-
     ASSERT(mi);
-    if (!mi->macHeaderLen) {
-        // do this only if the mac header was not provided by the user
-        if (!macProtocol.buildHeader(mi, &mi->macHeader, &mi->macHeaderLen)) {
-            ret = -EINVAL;
-            goto end;
-        }
+    if (mi->macHeaderLen) {
+        // the mac header was provided by the user
+        return macProtocol.send(mi, data, length);
+    }
+
+    mi->macHeader = header;
+    if (!macProtocol.buildHeader(mi, &mi->macHeader, &mi->macHeaderLen)) {
+        ret = -EINVAL;
+    } else {
+        ret = macProtocol.send(mi, data, length);
     }
-    ret = macProtocol.send(mi, data, length);
-  end:
-    mutexUnlock(&macMutex);
+    // the header does not outlive this call
+    mi->macHeader = NULL;
+    mi->macHeaderLen = 0;
     return ret;
 }
 
 bool defaultBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
                         uint16_t *headerLength /* out */) {
-    uint8_t *p = headerBuffer;
+    uint8_t *p = *header;
 //    uint8_t fcf1 = 0, fcf2 = 0; // FCF flags: byte 1 and 2
-    uint8_t *fcf1 = headerBuffer;
-    uint8_t *fcf2 = headerBuffer + 1; // FCF flags: byte 1 and 2
+    uint8_t *fcf1 = p;
+    uint8_t *fcf2 = p + 1; // FCF flags: byte 1 and 2
     
     *fcf1 = 0;
     ++p;
@@ -85,6 +82,7 @@ bool defaultBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
     if (mi->srcPort) *fcf2 |= FCF_EXT_SRC_PORT;
     if (mi->dstPort) *fcf2 |= FCF_EXT_DST_PORT;
     if (mi->hoplimit) *fcf2 |= FCF_EXT_HOPLIMIT;
+    if (mi->originSeqnum) *fcf2 |= FCF_EXT_ORIG_SEQNUM;
     if (mi->flags & MI_FLAG_IS_ACK) *fcf2 |= FCF_EXT_IS_ACK;
 
 #if SUPPORT_LONG_ADDR
@@ -146,9 +144,11 @@ bool defaultBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
     if (mi->hoplimit) {
         *p++ = mi->hoplimit;
     }
+    if (mi->originSeqnum) {
+        *p++ = mi->originSeqnum;
+    }
 
-    *header = headerBuffer;
-    *headerLength = p - headerBuffer;
+    *headerLength = p - *header;
 
     return true;
 }
@@ -188,6 +188,7 @@ static uint8_t calcMacHeaderLen(uint8_t fcf1, uint8_t fcf2) {
         if (fcf2 & FCF_EXT_SRC_PORT) ++result;
         if (fcf2 & FCF_EXT_DST_PORT) ++result;
         if (fcf2 & FCF_EXT_HOPLIMIT) ++result;
+        if (fcf2 & FCF_EXT_ORIG_SEQNUM) ++result;
     }
 
     return result;
@@ -268,6 +269,7 @@ uint8_t *defaultParseHeader(uint8_t *data, uint16_t length, MacInfo_t *mi /* out
         if (fcf2 & FCF_EXT_SRC_PORT) mi->srcPort = *p++;
         if (fcf2 & FCF_EXT_DST_PORT) mi->dstPort = *p++;
         if (fcf2 & FCF_EXT_HOPLIMIT) mi->hoplimit = *p++;
+        if (fcf2 & FCF_EXT_ORIG_SEQNUM) mi->originSeqnum = *p++;
         if (fcf2 & FCF_EXT_IS_ACK) mi->flags |= MI_FLAG_IS_ACK;
     }
 
@@ -281,7 +283,7 @@ bool defaultIsKnownDstAddress(MosAddr *dst) {
     return true;
 }
 
-uint8_t getMacHeaderSeqnum(uint8_t *data)
+static uint8_t seqnumOffset(const uint8_t *data)
 {
     uint8_t offset = 1;
     uint8_t fcf1 = data[0];
@@ -311,7 +313,18 @@ uint8_t getMacHeaderSeqnum(uint8_t *data)
     if (fcf1 & FCF_IMMED_SRC) offset += MOS_SHORT_ADDR_SIZE;
     if (fcf1 & FCF_IMMED_DST) offset += MOS_SHORT_ADDR_SIZE;
 
-    return data[offset];
+    return offset;
+}
+
+uint8_t getMacHeaderSeqnum(uint8_t *data)
+{
+    return data[seqnumOffset(data)];
+}
+
+void setMacHeaderSeqnum(uint8_t *data, uint8_t seqnum)
+{
+    // the header must have been built with a nonzero seqnum
+    data[seqnumOffset(data)] = seqnum;
 }
 
 void invertDirection(MacInfo_t *mi)
@@ -330,4 +343,7 @@ void invertDirection(MacInfo_t *mi)
     tmpPort = mi->srcPort;
     mi->srcPort = mi->dstPort;
     mi->dstPort = tmpPort;
+
+    // a reply is a new packet
+    mi->originSeqnum = 0;
 }
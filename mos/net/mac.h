@@ -29,6 +29,7 @@
 ///
 
 #include "address.h"
+#include "net_trace.h"
 #include <radio.h>
 
 //===========================================================
@@ -64,6 +65,23 @@
 /// Uses internal buffer to store one unsent packet.
 #define MAC_PROTOCOL_SAD 4
 
+/// CSMA with a sliding window of unacknowledged frames per neighbor.
+///
+/// Up to MAC_WINDOW_SIZE unicast frames per neighbor are in flight at once.
+/// ACKs are cumulative, with a bitmap of frames received out of order.
+/// Retransmission timeouts adapt to the round-trip time measured per neighbor.
+/// Frames may be delivered out of order after a loss, but never twice.
+/// Uses packet queue to store unacknowledged packets.
+#define MAC_PROTOCOL_WINDOW_ACK 5
+
+/// Low-power listening: the radio is duty cycled.
+///
+/// Nodes listen briefly every MAC_LPL_WAKE_INTERVAL milliseconds and sleep
+/// otherwise. Senders repeat a frame for up to one wake interval, until
+/// the receiver ACKs it; broadcasts are repeated for the whole interval.
+/// Uses packet queue to store unsent packets.
+#define MAC_PROTOCOL_LPL 6
+
 #define MI_FLAG_LOCALLY_ORIGINATED  0x1
 #define MI_FLAG_MORE_DATA           0x2
 #define MI_FLAG_ACK_REQUESTED       0x4
@@ -85,6 +103,8 @@ typedef struct MacInfo_s {
     uint8_t dstPort;
     //! Sequence number
     uint8_t seqnum;
+    //! End-to-end sequence number (set at originator, 0 if none)
+    uint8_t originSeqnum;
     //! The path cost of the packed
     uint8_t cost;
     //! The hop limit of the packet. The packet is dropped when hoplimit becomes zero.
@@ -129,8 +149,9 @@ typedef struct MacProtocol_s {
     //! Known address check (protocol-specific)
     bool (*isKnownDstAddress)(MosAddr *dst);
 
-    // Internal - build the packed binary header using MacInfo_t as a source
-    bool (*buildHeader)(MacInfo_t *, uint8_t **header /* out */, uint16_t *headerLength /* out */);
+    // Internal - build the packed binary header using MacInfo_t as a source.
+    // On input, *header points to a buffer of MAX_MAC_HEADER_LEN bytes
+    bool (*buildHeader)(MacInfo_t *, uint8_t **header /* in/out */, uint16_t *headerLength /* out */);
 } MacProtocol_t;
 
 ///
@@ -156,7 +177,7 @@ int8_t macSend(MosAddr *dst, const uint8_t *data, uint16_t length);
 int8_t macSendEx(MacInfo_t *mi, const uint8_t *data, uint16_t length);
 
 // default MAC header creation from MacInfo
-bool defaultBuildHeader(MacInfo_t *mi, uint8_t **header /* out */, uint16_t *headerLength /* out */);
+bool defaultBuildHeader(MacInfo_t *mi, uint8_t **header /* in/out */, uint16_t *headerLength /* out */);
 // returns pointer to data if succeeded, or NULL if failed
 // mac header pointer and length are stored in mi fields
 uint8_t *defaultParseHeader(uint8_t *data, uint16_t length, MacInfo_t *mi /* out */);
@@ -164,6 +185,10 @@ uint8_t *defaultParseHeader(uint8_t *data, uint16_t length, MacInfo_t *mi /* out
 bool defaultIsKnownDstAddress(MosAddr *);
 
 uint8_t getMacHeaderSeqnum(uint8_t *data);
+void setMacHeaderSeqnum(uint8_t *data, uint8_t seqnum);
+
+//! Milliseconds the radio has been on (MAC_PROTOCOL_LPL only)
+uint32_t macLplRadioOnTime(void);
 
 // exchange source <-> destination info in place
 void invertDirection(MacInfo_t *);
@@ -172,6 +197,9 @@ void invertDirection(MacInfo_t *);
 void fillLocalAddress(MosAddr *result);
 bool isLocalAddress(MosAddr *addr);
 
+//! The maximal length of a MAC header
+#define MAX_MAC_HEADER_LEN  30
+
 //! The size of MAC protocol receive/send buffer
 #ifndef MAC_PROTOCOL_BUFFER_SIZE
 #define MAC_PROTOCOL_BUFFER_SIZE RADIO_MAX_PACKET
@@ -199,7 +227,45 @@ bool isLocalAddress(MosAddr *addr);
 
 //! The size of the unsent packet queue
 #ifndef MAC_PROTOCOL_QUEUE_SIZE
-#define MAC_PROTOCOL_QUEUE_SIZE  1
+#define MAC_PROTOCOL_QUEUE_SIZE  4
+#endif
+
+//! Unacknowledged frames per neighbor (at most 16) for MAC_PROTOCOL_WINDOW_ACK
+#ifndef MAC_WINDOW_SIZE
+#define MAC_WINDOW_SIZE  4
+#endif
+
+//! Neighbors with window state for MAC_PROTOCOL_WINDOW_ACK
+#ifndef MAC_WINDOW_NEIGHBORS
+#define MAC_WINDOW_NEIGHBORS  4
+#endif
+
+//! Bounds of the adaptive retransmission timeout, in milliseconds
+#ifndef MAC_WINDOW_MIN_RTO
+#define MAC_WINDOW_MIN_RTO  20
+#endif
+#ifndef MAC_WINDOW_MAX_RTO
+#define MAC_WINDOW_MAX_RTO  2000
+#endif
+
+//! Period (in milliseconds) of the listen windows for MAC_PROTOCOL_LPL
+#ifndef MAC_LPL_WAKE_INTERVAL
+#define MAC_LPL_WAKE_INTERVAL  500
+#endif
+
+//! Length of a listen window, must be enough for a strobe gap and a frame
+#ifndef MAC_LPL_LISTEN_TIME
+#define MAC_LPL_LISTEN_TIME  10
+#endif
+
+//! Pause (in milliseconds) between the strobes of a frame
+#ifndef MAC_LPL_STROBE_GAP
+#define MAC_LPL_STROBE_GAP  2
+#endif
+
+//! Neighbors whose last sequence number is remembered, to drop repeated strobes
+#ifndef MAC_LPL_NEIGHBORS
+#define MAC_LPL_NEIGHBORS  4
 #endif
 
 //! The delay (in milliseconds) for MAC-layer packet forwarding
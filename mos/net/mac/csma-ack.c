@@ -32,6 +32,7 @@
 #include <net/radio_packet_buffer.h>
 #include <net/net_stats.h>
 #include <timing.h>
+#include <hil/atomic.h>
 
 #define TEST_FILTERS 1
 
@@ -42,8 +43,6 @@ static void sendTimerCb(void *);
 static bool ackMacBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
                               uint16_t *headerLength /* out */);
 
-static QueuedPacket_t queuedPackets[MAC_PROTOCOL_QUEUE_SIZE];
-
 MacProtocol_t macProtocol = {
     .name = MAC_PROTOCOL_CSMA_ACK,
     .init = initCsmaMac,
@@ -69,6 +68,18 @@ static void initCsmaMac(RecvFunction recvCb) {
     radioOn();
 }
 
+static void scheduleSendTimer(uint16_t timeout) {
+    if (sendTimerRunning && getAlarmTime(&sendTimer) <= timeout) return;
+    sendTimerRunning = true;
+    alarmSchedule(&sendTimer, timeout);
+}
+
+static void transmit(QueuedPacket_t *p) {
+    p->sendTries++;
+    p->ackTime = getJiffies() + MAC_PROTOCOL_ACK_TIME;
+    macRadioSend(p->data, p->dataLength);
+}
+
 static int8_t sendCsmaMac(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
     int8_t ret;
 
@@ -80,68 +91,69 @@ static int8_t sendCsmaMac(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
     if (!(mi->flags & MI_FLAG_ACK_REQUESTED)) {
         // PRINTF("send a packet\n");
         // this is a broadcast message or ACK
-        ret = radioSendHeader(mi->macHeader, mi->macHeaderLen, data, length);
+        ret = macRadioSendHeader(mi->macHeader, mi->macHeaderLen, data, length);
         if (ret == 0) ret = length;
         return ret;
     }
     // PRINTF("send a packet with ACK expected\n");
-    radioSendHeader(mi->macHeader, mi->macHeaderLen, data, length);
-    QueuedPacket_t *p = &queuedPackets[0];
-    ret = netQueueAddPacket(mi, data, length, p);
+    QueuedPacket_t *p;
+    ret = netQueueAddPacket(mi, data, length, &p);
     if (ret) return ret;
 
     //PRINTF("%lu: packet added!\n", getTimeMs());
 
-    p->sendTries = 0;
-    p->ackTime = getJiffies() + MAC_PROTOCOL_ACK_TIME;
-
-    if (!sendTimerRunning) {
-        sendTimerRunning = true;
-        alarmSchedule(&sendTimer, MAC_PROTOCOL_ACK_TIME);
+    if (netQueueHasEarlier(p)) {
+        // wait until the earlier packets to this destination are acked
+        p->ackTime = getJiffies();
+    } else {
+        transmit(p);
+        scheduleSendTimer(MAC_PROTOCOL_ACK_TIME);
     }
     return length;
 }
 
 static void sendTimerCb(void *x) {
+    QueuedPacket_t *p, *next;
+
     sendTimerRunning = false;
 
     //PRINTF("sendTimerCb\n");
 
-    QueuedPacket_t *p;
-
-    // remove expired packets
-    p = queueHead();
-    while (p && p->sendTries == MAC_PROTOCOL_MAX_ATTEMPTS) {
-        netQueuePop();
-        p = queueHead();
-        INC_NETSTAT(NETSTAT_PACKETS_DROPPED_TX, EMPTY_ADDR);
-    }
-
     if (STAILQ_EMPTY(&packetQueue)) return;
 
     uint32_t now = (uint32_t) getJiffies();
     uint16_t nextTimerTime = MAC_PROTOCOL_ACK_TIME;
-    STAILQ_FOREACH(p, &packetQueue, chain) {
+    for (p = queueHead(); p; p = next) {
+        next = STAILQ_NEXT(p, chain);
+
+        // packets to the same destination are sent in order
+        if (netQueueHasEarlier(p)) continue;
+
         // for this packet ack time has not yet come
         if (timeAfter32(p->ackTime, now)) {
             // adjust nextTimerTime
             uint16_t diff = p->ackTime - now;
             if (diff < nextTimerTime) nextTimerTime = diff;
-            break;
+            continue;
         }
 
-        p->sendTries++;
-        PRINTF("%lu: ************** retry to send (try %u)\n", now, p->sendTries);
-        radioSend(p->data, p->dataLength);
+        // remove expired packets
+        if (p->sendTries > MAC_PROTOCOL_MAX_ATTEMPTS) {
+            netQueueRemove(p);
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_TX, EMPTY_ADDR);
+            continue;
+        }
+
+        if (p->sendTries) {
+            PRINTF("%lu: ************** retry to send (try %u)\n", now, p->sendTries + 1);
+            INC_NETSTAT(NETSTAT_PACKETS_RTX, p->dst);
+        }
+        transmit(p);
         INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
-        // XXX: not the best way, need to get address more simply
-        MacInfo_t mi;
-        defaultParseHeader(p->data, p->dataLength, &mi);
-        INC_NETSTAT(NETSTAT_PACKETS_RTX, mi.originalSrc.shortAddr);
     }
 
-    sendTimerRunning = true;
-    alarmSchedule(&sendTimer, nextTimerTime);
+    if (STAILQ_EMPTY(&packetQueue)) return;
+    scheduleSendTimer(nextTimerTime);
 }
 
 #if TEST_FILTERS
@@ -181,11 +193,14 @@ static bool filterPass(MacInfo_t *mi)
 static void sendAck(MacInfo_t *mi)
 {
     //PRINTF("send ack to seqnum %u\n", mi->seqnum);
-    invertDirection(mi);
-    mi->flags = MI_FLAG_IS_ACK; // only this flag and nothing more
+    // the ACK is the received header with the ACK flag set
     mi->macHeader[1] |= FCF_EXT_IS_ACK;
-    sendCsmaMac(mi, NULL, 0);
-    INC_NETSTAT(NETSTAT_PACKETS_ACK_TX, mi->originalDst.shortAddr);
+    INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
+    macRadioSendHeader(mi->macHeader, mi->macHeaderLen, NULL, 0);
+    mi->macHeader[1] &= ~FCF_EXT_IS_ACK;
+    // the data came from the previous hop
+    INC_NETSTAT(NETSTAT_PACKETS_ACK_TX,
+            mi->immedSrc.shortAddr ? : mi->originalSrc.shortAddr);
 }
 
 static bool matchPacketBySeqnum(QueuedPacket_t *p, void *userData)
@@ -197,6 +212,7 @@ static bool matchPacketBySeqnum(QueuedPacket_t *p, void *userData)
 
 static void pollCsmaMac(void)
 {
+    RadioPacketBuffer_t *rxBuffer = radioPacketBuffer;
     INC_NETSTAT(NETSTAT_RADIO_RX, EMPTY_ADDR);
     if (isRadioPacketReceived()) {
         //PRINTF("got a packet from radio, size=%u\n", radioPacketBuffer->receivedLength);
@@ -209,20 +225,28 @@ static void pollCsmaMac(void)
         if (data) {
             if (mi.flags & MI_FLAG_IS_ACK) {
                 //PRINTF("got ack to a packet with seqnum %u\n", mi.seqnum);
-                INC_NETSTAT(NETSTAT_PACKETS_ACK_RX, mi.originalSrc.shortAddr);
-                netQueueRemovePacket(
-                        matchPacketBySeqnum, (void *) (uint16_t) mi.seqnum);
+                // the ACK echoes our header, so its sender is the destination
+                INC_NETSTAT(NETSTAT_PACKETS_ACK_RX,
+                        mi.immedDst.shortAddr ? : mi.originalDst.shortAddr);
+                if (netQueueRemovePacket(matchPacketBySeqnum,
+                                (void *) (uint16_t) mi.seqnum)
+                        && !STAILQ_EMPTY(&packetQueue)) {
+                    // the next packet to this destination can go now
+                    scheduleSendTimer(0);
+                }
             }
             else if (macProtocol.recvCb && filterPass(&mi)) {
-                //INC_NETSTAT(NETSTAT_PACKETS_RECV, mi.originalSrc.shortAddr);  // done @dv.c
-                // call user callback
-                macProtocol.recvCb(&mi, data,
-                        radioPacketBuffer->receivedLength - mi.macHeaderLen);
                 // Send MAC-layer ACK. How do we know whether the packet needs one?
                 // Simple: it is not ACK itself and has nonzero sequence number.
+                // Done before the callback, which may forward the packet
+                // and so take over the receive buffer.
                 if (mi.seqnum != 0) {
                     sendAck(&mi);
                 }
+                //INC_NETSTAT(NETSTAT_PACKETS_RECV, mi.originalSrc.shortAddr);  // done @dv.c
+                // call user callback
+                macProtocol.recvCb(&mi, data,
+                        radioPacketBuffer->receivedLength - mi.macHeaderLen);
             } else{
                 INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
             }
@@ -235,7 +259,9 @@ static void pollCsmaMac(void)
         PRINTF("got an error from radio: %s\n",
                 strerror(-radioPacketBuffer->receivedLength));
     }
-    radioBufferReset();
+    // a forwarded packet takes the buffer over; the one swapped in
+    // by pbufRadioDetach() may already hold the next packet
+    if (radioPacketBuffer == rxBuffer) radioBufferReset();
 }
 
 static bool ackMacBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
@@ -245,8 +271,11 @@ static bool ackMacBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
     if (!isBroadcast(&mi->originalDst) && !isUnspecified(&mi->originalDst)) {
         mi->flags |= MI_FLAG_ACK_REQUESTED;
         // packets for which ACK is requested must have nonzero sequence number set
+        Handle_t h;
+        ATOMIC_START(h);
         if (mySeqnum == 0) mySeqnum++;
         mi->seqnum = mySeqnum++;
+        ATOMIC_END(h);
     }
 
     // the rest is as usual
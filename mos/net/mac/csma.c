@@ -51,13 +51,12 @@ MacProtocol_t macProtocol = {
 };
 
 static Alarm_t sendTimer;
-static uint8_t sendTries;
-
-static QueuedPacket_t queuedPackets[MAC_PROTOCOL_QUEUE_SIZE];
 
 // -----------------------------------------------
 
 static void initCsmaMac(RecvFunction recvCb) {
+    netQueueInit();
+
     macProtocol.recvCb = recvCb;
 
     alarmInit(&sendTimer, sendTimerCb, NULL);
@@ -68,72 +67,76 @@ static void initCsmaMac(RecvFunction recvCb) {
 
 static int8_t sendCsmaMac(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
     int8_t ret;
-    if (sendTries) {
-        // remove old timers.
-        alarmRemove(&sendTimer);
-        sendTries = 0;
+    QueuedPacket_t *p;
+
+    // packets already waiting go first, to keep the order
+    if (STAILQ_EMPTY(&packetQueue)) {
+#if MAC_FORWARDING_DELAY
+        if (IS_LOCAL(mi))
+#endif
+        {
+            INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
+            if (macRadioSendHeader(mi->macHeader, mi->macHeaderLen, data, length) == 0) {
+                return length;
+            }
+            PRINTF("*************** channel NOT free\n");
+        }
     }
 
+    ret = netQueueAddPacket(mi, data, length, &p);
+    if (ret) return ret;
+    // the timer is running whenever the queue is not empty
+    if (p != queueHead()) return length;
+
 #if MAC_FORWARDING_DELAY
     if (!IS_LOCAL(mi)) {
         // add random backoff for forwarded packets
-        ret = netQueueAddPacket(mi, data, length, &queuedPackets[0]);
-        if (ret) return ret;
-        alarmSchedule(&sendTimer, randomNumberBounded(MAC_PROTOCOL_MAX_INITIAL_BACKOFF));
         // do NOT increase send tries, because we are not trying to send!
+        alarmSchedule(&sendTimer, randomNumberBounded(MAC_PROTOCOL_MAX_INITIAL_BACKOFF));
         return length;
     }
 #endif // MAC_FORWARDING_DELAY
 
-    INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
-    if (radioSendHeader(mi->macHeader, mi->macHeaderLen, data, length) == 0) {
-        return length;
-    }
-    PRINTF("*************** channel NOT free\n");
-
-    ret = netQueueAddPacket(mi, data, length, &queuedPackets[0]);
-    if (ret) return ret;
-
+    // the first attempt failed
+    p->sendTries = 1;
     alarmSchedule(&sendTimer, MAC_PROTOCOL_RETRY_TIMEOUT);
-    sendTries = 1;
-
     return length;
 }
 
 static void sendTimerCb(void *x) {
     QueuedPacket_t *p;
-    uint16_t nextTimeout = MAC_PROTOCOL_RETRY_TIMEOUT * (1 << sendTries);
 
-    if (sendTries) {
-        PRINTF("************** retry to send (try %u)\n", sendTries + 1);
+    p = queueHead();
+    if (!p) return;
+
+    if (p->sendTries) {
+        PRINTF("************** retry to send (try %u)\n", p->sendTries + 1);
+        // XXX: not the best way, need to get address more simply
+        MacInfo_t mi;
+        defaultParseHeader(p->data, p->dataLength, &mi);
+        INC_NETSTAT(NETSTAT_PACKETS_RTX, mi.originalSrc.shortAddr);
     }
-    ++sendTries;
+    ++p->sendTries;
 
-    p = queueHead();
-    ASSERT(p);
     INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
-    // XXX: not the best way, need to get address more simply
-    MacInfo_t mi;
-    defaultParseHeader(p->data, p->dataLength, &mi);
-    INC_NETSTAT(NETSTAT_PACKETS_RTX, mi.originalSrc.shortAddr);
-    if (radioSend(p->data, p->dataLength) == 0) {
+    if (macRadioSend(p->data, p->dataLength) == 0) {
         netQueuePop();
-        sendTries = 0;
-        return;
-    }
-
-    if (sendTries > MAC_PROTOCOL_MAX_ATTEMPTS) {
+    } else if (p->sendTries > MAC_PROTOCOL_MAX_ATTEMPTS) {
         // tx failed
         // XXX: return error code to user...
         INC_NETSTAT(NETSTAT_PACKETS_DROPPED_TX, EMPTY_ADDR);
         PRINTF("CSMA mac send failed: too many retries!");
         netQueuePop();
-        sendTries = 0;
+    } else {
+        // setup next timer, using exponential backoff
+        alarmSchedule(&sendTimer, MAC_PROTOCOL_RETRY_TIMEOUT << (p->sendTries - 1));
         return;
     }
 
-    // setup next timer, using exponential backoff
-    alarmSchedule(&sendTimer, nextTimeout);
+    // continue with the rest of the queue after a short backoff
+    if (!STAILQ_EMPTY(&packetQueue)) {
+        alarmSchedule(&sendTimer, randomNumberBounded(MAC_PROTOCOL_MAX_INITIAL_BACKOFF));
+    }
 }
 
 #if TEST_FILTERS
@@ -170,6 +173,7 @@ static bool filterPass(MacInfo_t *mi)
 static void pollCsmaMac(void) {
     // XXX: stack overflow possible if stack size is too small!
     MacInfo_t mi;
+    RadioPacketBuffer_t *rxBuffer = radioPacketBuffer;
     INC_NETSTAT(NETSTAT_RADIO_RX, EMPTY_ADDR);
     if (isRadioPacketReceived()) {
         // PRINTF("got a packet from radio, size=%u\n", radioPacketBuffer->receivedLength);
@@ -197,5 +201,7 @@ static void pollCsmaMac(void) {
         PRINTF("got an error from radio: %s\n",
                 strerror(-radioPacketBuffer->receivedLength));
     }
-    radioBufferReset();
+    // a forwarded packet takes the buffer over; the one swapped in
+    // by pbufRadioDetach() may already hold the next packet
+    if (radioPacketBuffer == rxBuffer) radioBufferReset();
 }
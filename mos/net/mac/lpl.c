@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Low-power listening MAC with strobed preambles.
+//
+// The radio sleeps most of the time. Every MAC_LPL_WAKE_INTERVAL
+// milliseconds it listens for MAC_LPL_LISTEN_TIME, and stays on as long
+// as frames for this node keep arriving or the channel is busy.
+//
+// A sender does not know when its neighbor wakes up, so it repeats the
+// whole data frame every MAC_LPL_STROBE_GAP ms for one wake interval.
+// A unicast receiver ACKs the first strobe it hears, which ends the train
+// early; broadcasts are strobed for the full interval. Strobes heard more
+// than once are recognized by the per-node sequence number and not passed
+// up again.
+//
+
+#include "../mac.h"
+#include "../net_queue.h"
+#include <radio.h>
+#include <errors.h>
+#include <alarms.h>
+#include <print.h>
+#include <random.h>
+#include <assert.h>
+#include <lib/byteorder.h>
+#include <net/radio_packet_buffer.h>
+#include <net/net_stats.h>
+#include <timing.h>
+#include <hil/atomic.h>
+
+#if MAC_LPL_STROBE_GAP >= MAC_LPL_LISTEN_TIME
+#error MAC_LPL_STROBE_GAP must be shorter than MAC_LPL_LISTEN_TIME
+#endif
+
+// how many times the listen window is prolonged because of a busy channel
+#define MAX_BUSY_EXTENSIONS 8
+// ACK frame: fcf1, fcf2, source, destination, seqnum
+#define ACK_LENGTH   (2 + 2 * MOS_SHORT_ADDR_SIZE + 1)
+
+typedef struct LplNeighbor_s {
+    MosShortAddr address;
+    uint8_t seqnum; // the last one received
+} LplNeighbor_t;
+
+static void initLplMac(RecvFunction cb);
+static int8_t sendLplMac(MacInfo_t *, const uint8_t *data, uint16_t length);
+static void pollLplMac(void);
+static void wakeTimerCb(void *);
+static void strobeTimerCb(void *);
+static bool lplMacBuildHeader(MacInfo_t *mi, uint8_t **header /* in/out */,
+                              uint16_t *headerLength /* out */);
+
+MacProtocol_t macProtocol = {
+    .name = MAC_PROTOCOL_LPL,
+    .init = initLplMac,
+    .send = sendLplMac,
+    .poll = pollLplMac,
+    .buildHeader = lplMacBuildHeader,
+    .isKnownDstAddress = defaultIsKnownDstAddress,
+};
+
+static Alarm_t wakeTimer;
+static Alarm_t strobeTimer;
+
+// receiver state
+static bool awake;          // in the listen window
+static bool heardForUs;     // a frame for this node came during the window
+static bool heardOther;     // a frame for someone else came during the window
+static uint8_t busyExtensions;
+static LplNeighbor_t neighbors[MAC_LPL_NEIGHBORS];
+static uint8_t nextNeighbor;
+
+// sender state
+static bool strobing;       // a strobe train of the head packet is on
+static uint8_t mySeqnum;
+
+// radio on-time accounting
+static bool radioIsOn;
+static uint32_t radioOnSince;
+static uint32_t radioOnTime;
+
+// -----------------------------------------------
+
+static void lplRadioOn(void) {
+    if (radioIsOn) return;
+    radioIsOn = true;
+    radioOnSince = (uint32_t) getJiffies();
+    radioOn();
+}
+
+static void lplRadioOff(void) {
+    if (!radioIsOn) return;
+    radioIsOn = false;
+    radioOnTime += (uint32_t) getJiffies() - radioOnSince;
+    radioOff();
+}
+
+// turn the radio off unless listening or sending
+static void sleepIfIdle(void) {
+    if (awake || strobing || !STAILQ_EMPTY(&packetQueue)) return;
+    lplRadioOff();
+}
+
+uint32_t macLplRadioOnTime(void) {
+    uint32_t result = radioOnTime;
+    if (radioIsOn) result += (uint32_t) getJiffies() - radioOnSince;
+    return result;
+}
+
+// -----------------------------------------------
+
+static void initLplMac(RecvFunction recvCb) {
+    netQueueInit();
+
+    macProtocol.recvCb = recvCb;
+
+    alarmInit(&wakeTimer, wakeTimerCb, NULL);
+    alarmInit(&strobeTimer, strobeTimerCb, NULL);
+
+    // start sleeping; neighbors should not wake up in lockstep
+    radioOff();
+    alarmSchedule(&wakeTimer, randomNumberBounded(MAC_LPL_WAKE_INTERVAL));
+}
+
+static void wakeTimerCb(void *x) {
+    if (!awake) {
+        // listen for strobes
+        awake = true;
+        heardForUs = heardOther = false;
+        busyExtensions = 0;
+        lplRadioOn();
+        alarmSchedule(&wakeTimer, MAC_LPL_LISTEN_TIME);
+        return;
+    }
+
+    if (heardForUs) {
+        // the sender may have more; listen a bit longer
+        heardForUs = false;
+        alarmSchedule(&wakeTimer, MAC_LPL_LISTEN_TIME);
+        return;
+    }
+    if (!heardOther && busyExtensions < MAX_BUSY_EXTENSIONS
+            && !radioIsChannelClear()) {
+        // someone is on the air, maybe a strobe for us
+        busyExtensions++;
+        alarmSchedule(&wakeTimer, MAC_LPL_LISTEN_TIME);
+        return;
+    }
+
+    awake = false;
+    sleepIfIdle();
+    alarmSchedule(&wakeTimer, MAC_LPL_WAKE_INTERVAL - MAC_LPL_LISTEN_TIME);
+}
+
+static int8_t sendLplMac(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
+    int8_t ret;
+    QueuedPacket_t *p;
+
+    // broadcasts are queued as well, to be strobed for a whole interval
+    ret = netQueueAddPacket(mi, data, length, &p);
+    if (ret) return ret;
+    if (p != queueHead()) return length;
+
+    if (IS_LOCAL(mi)) {
+        alarmSchedule(&strobeTimer, 0);
+    } else {
+        // add random backoff for forwarded packets
+        alarmSchedule(&strobeTimer,
+                randomNumberBounded(MAC_PROTOCOL_MAX_INITIAL_BACKOFF));
+    }
+    return length;
+}
+
+static void strobeTimerCb(void *x) {
+    QueuedPacket_t *p = queueHead();
+    uint32_t now = (uint32_t) getJiffies();
+
+    if (!p) {
+        strobing = false;
+        sleepIfIdle();
+        return;
+    }
+
+    if (!strobing) {
+        // the train must cover a whole wake interval of the receiver
+        strobing = true;
+        p->sendTries++;
+        p->sendTime = now;
+        p->ackTime = now + MAC_LPL_WAKE_INTERVAL + MAC_LPL_LISTEN_TIME;
+        // the ACK has to be heard
+        lplRadioOn();
+        if (p->sendTries > 1) {
+            INC_NETSTAT(NETSTAT_PACKETS_RTX, p->dst);
+        }
+    } else if (timeAfter32(now, p->ackTime)) {
+        strobing = false;
+        if (p->dst == MOS_ADDR_BROADCAST) {
+            // every neighbor has been awake once during the train
+            netQueuePop();
+        } else if (p->sendTries >= MAC_PROTOCOL_MAX_ATTEMPTS) {
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_TX, EMPTY_ADDR);
+            PRINTF("LPL mac send failed: too many retries!\n");
+            netQueuePop();
+        }
+        if (STAILQ_EMPTY(&packetQueue)) {
+            sleepIfIdle();
+            return;
+        }
+        alarmSchedule(&strobeTimer,
+                randomNumberBounded(MAC_PROTOCOL_MAX_INITIAL_BACKOFF));
+        return;
+    }
+
+    // a busy channel costs just this strobe
+    INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
+    macRadioSend(p->data, p->dataLength);
+    alarmSchedule(&strobeTimer, MAC_LPL_STROBE_GAP);
+}
+
+// -----------------------------------------------
+
+static void sendAck(MacInfo_t *mi)
+{
+    uint8_t ack[ACK_LENGTH];
+    uint8_t *p = ack;
+    MosShortAddr dst = mi->immedSrc.shortAddr ? : mi->originalSrc.shortAddr;
+
+    // the address combination is a sum, not a set of bits
+    *p++ = FCF_EXTENDED | (FCF_SRC_ADDR_SHORT + FCF_DST_ADDR_SHORT) | FCF_SEQNUM;
+    *p++ = FCF_EXT_IS_ACK;
+    be16Write(p, localAddress);
+    p += MOS_SHORT_ADDR_SIZE;
+    be16Write(p, dst);
+    p += MOS_SHORT_ADDR_SIZE;
+    *p++ = mi->seqnum;
+
+    INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
+    macRadioSend(ack, sizeof(ack));
+    INC_NETSTAT(NETSTAT_PACKETS_ACK_TX, dst);
+}
+
+static void processAck(MacInfo_t *mi)
+{
+    QueuedPacket_t *p = queueHead();
+
+    if (!strobing || !p) return;
+    if (mi->originalDst.shortAddr != localAddress
+            || mi->originalSrc.shortAddr != p->dst
+            || mi->seqnum != getMacHeaderSeqnum(p->data)) {
+        return;
+    }
+    INC_NETSTAT(NETSTAT_PACKETS_ACK_RX, p->dst);
+
+    // early ACK: the train is over
+    strobing = false;
+    netQueuePop();
+    if (STAILQ_EMPTY(&packetQueue)) {
+        alarmRemove(&strobeTimer);
+        sleepIfIdle();
+    } else {
+        // the receiver is still awake
+        alarmSchedule(&strobeTimer, 0);
+    }
+}
+
+// returns true if the strobe has already been received
+static bool isDuplicate(MacInfo_t *mi)
+{
+    MosShortAddr src = mi->immedSrc.shortAddr ? : mi->originalSrc.shortAddr;
+    LplNeighbor_t *n;
+    bool result;
+
+    for (n = neighbors; n < neighbors + MAC_LPL_NEIGHBORS; ++n) {
+        if (n->address == src) {
+            result = n->seqnum == mi->seqnum;
+            n->seqnum = mi->seqnum;
+            return result;
+        }
+    }
+    // replace the entries round-robin
+    n = &neighbors[nextNeighbor];
+    if (++nextNeighbor == MAC_LPL_NEIGHBORS) nextNeighbor = 0;
+    n->address = src;
+    n->seqnum = mi->seqnum;
+    return false;
+}
+
+static void pollLplMac(void)
+{
+    RadioPacketBuffer_t *rxBuffer = radioPacketBuffer;
+    INC_NETSTAT(NETSTAT_RADIO_RX, EMPTY_ADDR);
+    if (isRadioPacketReceived()) {
+        // XXX: stack overflow possible if stack size is too small!
+        MacInfo_t mi;
+        uint8_t *data = defaultParseHeader(radioPacketBuffer->buffer,
+                radioPacketBuffer->receivedLength, &mi);
+        MosShortAddr nexthop = getNexthop((&mi));
+        if (!data) {
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        } else if (mi.flags & MI_FLAG_IS_ACK) {
+            processAck(&mi);
+        } else if (nexthop != localAddress && nexthop != MOS_ADDR_BROADCAST) {
+            // a strobe for another node; no need to stay awake for it
+            heardOther = true;
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        } else {
+            if (nexthop == localAddress) sendAck(&mi);
+            if (mi.seqnum && isDuplicate(&mi)) {
+                // a strobe heard once more; not a reason to stay awake
+                INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+            } else {
+                heardForUs = true;
+                if (macProtocol.recvCb) {
+                    macProtocol.recvCb(&mi, data,
+                            radioPacketBuffer->receivedLength - mi.macHeaderLen);
+                }
+            }
+        }
+    }
+    else if (isRadioPacketError()) {
+        INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        PRINTF("got an error from radio: %s\n",
+                strerror(-radioPacketBuffer->receivedLength));
+    }
+    // a forwarded packet takes the buffer over; the one swapped in
+    // by pbufRadioDetach() may already hold the next packet
+    if (radioPacketBuffer == rxBuffer) radioBufferReset();
+}
+
+static bool lplMacBuildHeader(MacInfo_t *mi, uint8_t **header /* in/out */,
+                              uint16_t *headerLength /* out */)
+{
+    // all frames are numbered, as broadcast strobes are repeated too
+    Handle_t h;
+    ATOMIC_START(h);
+    if (mySeqnum == 0) mySeqnum++;
+    mi->seqnum = mySeqnum++;
+    ATOMIC_END(h);
+
+    return defaultBuildHeader(mi, header, headerLength);
+}
@@ -71,7 +71,7 @@ static void initNullMac(RecvFunction cb)
 
 static int8_t sendNullMac(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
     INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
-    int8_t ret = radioSend(data, length);
+    int8_t ret = macRadioSend(data, length);
     if (ret == 0) ret = length;
     return ret;
 }
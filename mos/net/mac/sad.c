@@ -127,7 +127,7 @@ static int8_t sendSadMac(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
     }
     // PRINTF("%lu: mac tx %u bytes\n", getSyncTimeMs(), length);
     INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
-    ret = radioSendHeader(mi->macHeader, mi->macHeaderLen, data, length);
+    ret = macRadioSendHeader(mi->macHeader, mi->macHeaderLen, data, length);
     if (ret) return ret;
     return length;
 }
@@ -144,7 +144,7 @@ static void delayTimerCb(void *unused)
         lastNexthop = delayedNexthop;
     }
 #endif
-    radioSendHeader(NULL, 0, delayedData, delayedDataLength);
+    macRadioSendHeader(NULL, 0, delayedData, delayedDataLength);
     delayedDataLength = 0;
 }
 #endif
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// CSMA MAC with a sliding window of unacknowledged frames per neighbor.
+//
+// Each neighbor has its own sequence numbers (1..255; 0 means "no ACK").
+// The receiver ACKs every data frame with the last in-order sequence
+// number and a bitmap of the 16 frames after it that it also has.
+// The sender keeps up to MAC_WINDOW_SIZE frames in flight per neighbor
+// and retransmits a frame when its timeout, which follows the RTT
+// measured for that neighbor, expires.
+//
+// Sequence numbers start at a random value. Until the first ACK from a
+// neighbor, frames to it are sent one at a time with FCF_EXT_SYNC. A SYNC
+// frame with an unknown seqnum means the sender has restarted.
+//
+
+#include "../mac.h"
+#include "../net_queue.h"
+#include <radio.h>
+#include <errors.h>
+#include <alarms.h>
+#include <print.h>
+#include <random.h>
+#include <assert.h>
+#include <lib/byteorder.h>
+#include <net/radio_packet_buffer.h>
+#include <net/net_stats.h>
+#include <timing.h>
+#include <hil/atomic.h>
+
+#if MAC_WINDOW_SIZE > 16
+#error MAC_WINDOW_SIZE must not exceed 16, the size of the ACK bitmap
+#endif
+
+#define SEQNUM_COUNT 255
+// frames this far behind the receiver are duplicates
+#define DUP_ZONE     32
+// ACK frame: fcf1, fcf2, source, destination, seqnum, bitmap
+#define ACK_LENGTH   (2 + 2 * MOS_SHORT_ADDR_SIZE + 1 + 2)
+
+typedef struct Neighbor_s {
+    MosShortAddr address;
+    uint32_t lastUsed;
+    // sender
+    uint8_t nextSeqnum;
+    bool synced;        // got an ACK, no need for FCF_EXT_SYNC
+    uint16_t srtt;      // smoothed RTT, 1/8 ms
+    uint16_t rttvar;    // RTT variation, 1/4 ms
+    uint16_t rto;       // retransmission timeout, ms
+    // receiver
+    bool rxValid;
+    uint8_t rxSyncStart; // the first seqnum of the stream
+    uint8_t lastInOrder;
+    uint16_t rxBitmap;  // bit i: lastInOrder + 1 + i received
+} Neighbor_t;
+
+static void initWindowMac(RecvFunction cb);
+static int8_t sendWindowMac(MacInfo_t *, const uint8_t *data, uint16_t length);
+static void pollWindowMac(void);
+static void sendTimerCb(void *);
+static bool windowMacBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
+                                 uint16_t *headerLength /* out */);
+
+MacProtocol_t macProtocol = {
+    .name = MAC_PROTOCOL_WINDOW_ACK,
+    .init = initWindowMac,
+    .send = sendWindowMac,
+    .poll = pollWindowMac,
+    .buildHeader = windowMacBuildHeader,
+    .isKnownDstAddress = defaultIsKnownDstAddress,
+};
+
+static Alarm_t sendTimer;
+static bool sendTimerRunning;
+static Neighbor_t neighbors[MAC_WINDOW_NEIGHBORS];
+
+// -----------------------------------------------
+
+static inline uint8_t seqnumNext(uint8_t s) {
+    return s == SEQNUM_COUNT ? 1 : s + 1;
+}
+
+static inline uint8_t seqnumPrev(uint8_t s) {
+    return s == 1 ? SEQNUM_COUNT : s - 1;
+}
+
+// how far is a after b
+static inline uint8_t seqnumDiff(uint8_t a, uint8_t b) {
+    return (a + SEQNUM_COUNT - b) % SEQNUM_COUNT;
+}
+
+static bool hasQueuedPackets(MosShortAddr address) {
+    QueuedPacket_t *p;
+    STAILQ_FOREACH(p, &packetQueue, chain) {
+        if (p->dst == address) return true;
+    }
+    return false;
+}
+
+static Neighbor_t *findNeighbor(MosShortAddr address, bool create) {
+    Neighbor_t *n, *victim = NULL;
+    for (n = neighbors; n < neighbors + MAC_WINDOW_NEIGHBORS; ++n) {
+        if (n->address == address && n->nextSeqnum) {
+            n->lastUsed = getJiffies();
+            return n;
+        }
+    }
+    if (!create) return NULL;
+
+    // reuse the least recently used entry without packets in flight
+    for (n = neighbors; n < neighbors + MAC_WINDOW_NEIGHBORS; ++n) {
+        if (!n->nextSeqnum) {
+            victim = n;
+            break;
+        }
+        if (hasQueuedPackets(n->address)) continue;
+        if (!victim || timeAfter32(victim->lastUsed, n->lastUsed)) victim = n;
+    }
+    if (!victim) return NULL;
+
+    memset(victim, 0, sizeof(*victim));
+    victim->address = address;
+    victim->lastUsed = getJiffies();
+    victim->nextSeqnum = 1 + randomNumberBounded(SEQNUM_COUNT);
+    victim->rto = MAC_PROTOCOL_ACK_TIME;
+    return victim;
+}
+
+static void updateRto(Neighbor_t *n, uint16_t rtt) {
+    // Jacobson/Karels, as in TCP
+    if (!n->srtt) {
+        n->srtt = rtt << 3;
+        n->rttvar = rtt << 1;
+    } else {
+        int16_t err = rtt - (n->srtt >> 3);
+        n->srtt += err;
+        if (err < 0) err = -err;
+        n->rttvar += err - (n->rttvar >> 2);
+    }
+    n->rto = (n->srtt >> 3) + n->rttvar;
+    if (n->rto < MAC_WINDOW_MIN_RTO) n->rto = MAC_WINDOW_MIN_RTO;
+    if (n->rto > MAC_WINDOW_MAX_RTO) n->rto = MAC_WINDOW_MAX_RTO;
+}
+
+// whether the packet is within the window of its neighbor
+static bool inWindow(QueuedPacket_t *p, Neighbor_t *n) {
+    QueuedPacket_t *q;
+    uint8_t earlier = 0;
+    STAILQ_FOREACH(q, &packetQueue, chain) {
+        if (q == p) break;
+        if (q->dst == p->dst) earlier++;
+    }
+    // stop-and-wait until the first ACK
+    return earlier < (n->synced ? MAC_WINDOW_SIZE : 1);
+}
+
+static void scheduleSendTimer(uint16_t timeout) {
+    if (sendTimerRunning && getAlarmTime(&sendTimer) <= timeout) return;
+    sendTimerRunning = true;
+    alarmSchedule(&sendTimer, timeout);
+}
+
+static void transmit(QueuedPacket_t *p, Neighbor_t *n) {
+    if (n->synced) p->data[1] &= ~FCF_EXT_SYNC;
+    else p->data[1] |= FCF_EXT_SYNC;
+
+    uint32_t timeout = (uint32_t) n->rto << p->sendTries;
+    // back off exponentially on retries
+    if (timeout > MAC_WINDOW_MAX_RTO) timeout = MAC_WINDOW_MAX_RTO;
+    if (!p->sendTries) timeout = n->rto;
+
+    p->sendTries++;
+    p->sendTime = getJiffies();
+    p->ackTime = p->sendTime + timeout;
+    INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
+    macRadioSend(p->data, p->dataLength);
+}
+
+// -----------------------------------------------
+
+static void initWindowMac(RecvFunction recvCb) {
+    netQueueInit();
+
+    macProtocol.recvCb = recvCb;
+
+    alarmInit(&sendTimer, sendTimerCb, NULL);
+    // turn on radio listening
+    radioOn();
+}
+
+static int8_t sendWindowMac(MacInfo_t *mi, const uint8_t *data, uint16_t length) {
+    int8_t ret;
+    QueuedPacket_t *p;
+    Neighbor_t *n;
+
+    if (!(mi->flags & MI_FLAG_ACK_REQUESTED)) {
+        // this is a broadcast message
+        INC_NETSTAT(NETSTAT_RADIO_TX, EMPTY_ADDR);
+        ret = macRadioSendHeader(mi->macHeader, mi->macHeaderLen, data, length);
+        if (ret == 0) ret = length;
+        return ret;
+    }
+
+    ret = netQueueAddPacket(mi, data, length, &p);
+    if (ret) return ret;
+
+    // the sequence number is known only now that the packet is queued;
+    // senders in other threads may be doing the same
+    Handle_t h;
+    ATOMIC_START(h);
+    n = findNeighbor(p->dst, true);
+    if (n) {
+        setMacHeaderSeqnum(p->data, n->nextSeqnum);
+        n->nextSeqnum = seqnumNext(n->nextSeqnum);
+    }
+    ATOMIC_END(h);
+    if (!n) {
+        netQueueRemove(p);
+        return -ENOMEM;
+    }
+
+    if (inWindow(p, n)) {
+        transmit(p, n);
+        scheduleSendTimer(p->ackTime - p->sendTime);
+    }
+    return length;
+}
+
+static void sendTimerCb(void *x) {
+    QueuedPacket_t *p, *next;
+    uint32_t now = (uint32_t) getJiffies();
+    uint16_t nextTimerTime = MAC_WINDOW_MAX_RTO;
+
+    sendTimerRunning = false;
+
+    for (p = queueHead(); p; p = next) {
+        next = STAILQ_NEXT(p, chain);
+
+        // packets in the queue always have a neighbor entry
+        Neighbor_t *n = findNeighbor(p->dst, false);
+        if (!n || !inWindow(p, n)) continue;
+
+        if (p->sendTries) {
+            // for this packet ack time has not yet come
+            if (timeAfter32(p->ackTime, now)) {
+                uint16_t diff = p->ackTime - now;
+                if (diff < nextTimerTime) nextTimerTime = diff;
+                continue;
+            }
+
+            // remove expired packets
+            if (p->sendTries > MAC_PROTOCOL_MAX_ATTEMPTS) {
+                netQueueRemove(p);
+                INC_NETSTAT(NETSTAT_PACKETS_DROPPED_TX, EMPTY_ADDR);
+                continue;
+            }
+
+            PRINTF("%lu: ************** retry to send (try %u)\n", now, p->sendTries + 1);
+            INC_NETSTAT(NETSTAT_PACKETS_RTX, p->dst);
+        }
+        transmit(p, n);
+        if (p->ackTime - now < nextTimerTime) nextTimerTime = p->ackTime - now;
+    }
+
+    if (STAILQ_EMPTY(&packetQueue)) return;
+    scheduleSendTimer(nextTimerTime);
+}
+
+// -----------------------------------------------
+
+static void sendAck(Neighbor_t *n)
+{
+    uint8_t ack[ACK_LENGTH];
+    uint8_t *p = ack;
+
+    // the address combination is a sum, not a set of bits
+    *p++ = FCF_EXTENDED | (FCF_SRC_ADDR_SHORT + FCF_DST_ADDR_SHORT) | FCF_SEQNUM;
+    *p++ = FCF_EXT_IS_ACK;
+    be16Write(p, localAddress);
+    p += MOS_SHORT_ADDR_SIZE;
+    be16Write(p, n->address);
+    p += MOS_SHORT_ADDR_SIZE;
+    *p++ = n->lastInOrder;
+    be16Write(p, n->rxBitmap);
+
+    macRadioSend(ack, sizeof(ack));
+    INC_NETSTAT(NETSTAT_PACKETS_ACK_TX, n->address);
+}
+
+static void processAck(MacInfo_t *mi, uint8_t *data, uint16_t length)
+{
+    QueuedPacket_t *p, *next;
+    Neighbor_t *n;
+    uint8_t cumulative = mi->seqnum;
+    uint16_t bitmap;
+    uint32_t now = (uint32_t) getJiffies();
+    bool removed = false;
+
+    if (length < 2 || mi->originalDst.shortAddr != localAddress) return;
+    n = findNeighbor(mi->originalSrc.shortAddr, false);
+    if (!n) return;
+    bitmap = be16Read(data);
+    n->synced = true;
+    INC_NETSTAT(NETSTAT_PACKETS_ACK_RX, n->address);
+
+    for (p = queueHead(); p; p = next) {
+        next = STAILQ_NEXT(p, chain);
+        if (p->dst != n->address || !p->sendTries) continue;
+
+        uint8_t seqnum = getMacHeaderSeqnum(p->data);
+        // at or before the cumulative ACK, or in the bitmap
+        uint8_t diff = seqnumDiff(seqnum, cumulative);
+        bool acked = diff == 0 || diff > SEQNUM_COUNT - DUP_ZONE
+                || (diff <= 16 && (bitmap & (1u << (diff - 1))));
+        if (!acked) continue;
+
+        // Karn: measure only frames that were sent once
+        if (p->sendTries == 1) updateRto(n, now - p->sendTime);
+        netQueueRemove(p);
+        removed = true;
+    }
+
+    if (removed && !STAILQ_EMPTY(&packetQueue)) {
+        // the window has moved
+        scheduleSendTimer(0);
+    }
+}
+
+// returns true if the frame should be passed to upper layers
+static bool processData(MacInfo_t *mi)
+{
+    MosShortAddr src = mi->immedSrc.shortAddr ? : mi->originalSrc.shortAddr;
+    Neighbor_t *n = findNeighbor(src, true);
+    bool sync = mi->macHeader[1] & FCF_EXT_SYNC;
+    bool fresh = true, resync = false;
+    uint8_t diff;
+
+    if (!n) return true; // cannot track, deliver anyway
+
+    diff = seqnumDiff(mi->seqnum, n->lastInOrder);
+    if (!n->rxValid || (sync && mi->seqnum != n->rxSyncStart)) {
+        // first frame from this neighbor, or it has restarted
+        resync = true;
+    } else if (diff == 0 || diff > SEQNUM_COUNT - DUP_ZONE) {
+        fresh = false;
+    } else if (diff <= 16) {
+        if (n->rxBitmap & (1u << (diff - 1))) fresh = false;
+    } else if (diff <= 32) {
+        // the sender gave up on some frames and moved on; slide
+        while (diff > 16) {
+            n->lastInOrder = seqnumNext(n->lastInOrder);
+            n->rxBitmap >>= 1;
+            diff--;
+        }
+    } else {
+        resync = true;
+    }
+
+    if (resync) {
+        n->rxValid = true;
+        n->rxSyncStart = mi->seqnum;
+        n->lastInOrder = seqnumPrev(mi->seqnum);
+        n->rxBitmap = 0;
+        diff = 1;
+    }
+
+    if (fresh) {
+        n->rxBitmap |= 1u << (diff - 1);
+        while (n->rxBitmap & 1) {
+            n->lastInOrder = seqnumNext(n->lastInOrder);
+            n->rxBitmap >>= 1;
+        }
+    }
+
+    sendAck(n);
+    return fresh;
+}
+
+static void pollWindowMac(void)
+{
+    INC_NETSTAT(NETSTAT_RADIO_RX, EMPTY_ADDR);
+    if (isRadioPacketReceived()) {
+        // XXX: stack overflow possible if stack size is too small!
+        MacInfo_t mi;
+        uint8_t *data = defaultParseHeader(radioPacketBuffer->buffer,
+                radioPacketBuffer->receivedLength, &mi);
+        uint16_t length = radioPacketBuffer->receivedLength - mi.macHeaderLen;
+        if (!data) {
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        } else if (mi.flags & MI_FLAG_IS_ACK) {
+            processAck(&mi, data, length);
+        } else if (mi.immedDst.shortAddr != 0
+                && mi.immedDst.shortAddr != localAddress) {
+            // for another hop
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        } else if (mi.seqnum && !processData(&mi)) {
+            // a duplicate; ACKed again, but not passed up
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        } else if (macProtocol.recvCb) {
+            macProtocol.recvCb(&mi, data, length);
+        } else {
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        }
+    }
+    else if (isRadioPacketError()) {
+        INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
+        PRINTF("got an error from radio: %s\n",
+                strerror(-radioPacketBuffer->receivedLength));
+    }
+    radioBufferReset();
+}
+
+static bool windowMacBuildHeader(MacInfo_t *mi, uint8_t **header /* out */,
+                                 uint16_t *headerLength /* out */)
+{
+    if (!isBroadcast(&mi->originalDst) && !isUnspecified(&mi->originalDst)) {
+        mi->flags |= MI_FLAG_ACK_REQUESTED;
+        // reserve space; the real sequence number is set when queued
+        mi->seqnum = 1;
+    }
+    return defaultBuildHeader(mi, header, headerLength);
+}
@@ -26,9 +26,18 @@
 #include <print.h>
 #include <errors.h>
 #include <mutex.h>
+#include <timing.h>
+
+#if !USE_PBUF
+#error The packet queue needs USE_PBUF
+#endif
 
 PacketQueue_t packetQueue;
 
+// the pool; free packets are kept in a queue, too
+static QueuedPacket_t packets[MAC_PROTOCOL_QUEUE_SIZE];
+static PacketQueue_t freeQueue;
+
 static Mutex_t mutex;
 #define lock()     mutexLock(&mutex) 
 #define unlock()   mutexUnlock(&mutex)
@@ -36,37 +45,114 @@ static Mutex_t mutex;
 // -----------------------------------------------------
 
 void netQueueInit(void) {
+    uint_t i;
     STAILQ_INIT(&packetQueue);
+    STAILQ_INIT(&freeQueue);
+    for (i = 0; i < MAC_PROTOCOL_QUEUE_SIZE; ++i) {
+        packets[i].isUsed = false;
+        STAILQ_INSERT_TAIL(&freeQueue, &packets[i], chain);
+    }
 }
 
 int8_t netQueueAddPacket(MacInfo_t *mi, const uint8_t *data, uint16_t length,
-                      QueuedPacket_t *result) {
-    // QueuedPacket_t *p = newQpacket(replace);
-    if (!result || result->isUsed) {
+                      QueuedPacket_t **result) {
+    QueuedPacket_t *p;
+    Pbuf_t *pb = NULL;
+    uint8_t *payload;
+
+    if (mi->macHeaderLen + length > PBUF_DATA_SIZE) {
+        return -EMSGSIZE;
+    }
+
+    lock();
+    p = STAILQ_FIRST(&freeQueue);
+    if (!p) {
+        unlock();
         PRINTF("netQueueAddPacket: queue is full!\n");
         return -ENOMEM;
     }
-    result->isUsed = true;
-    memcpy(result->data, mi->macHeader, mi->macHeaderLen);
-    memcpy(result->data + mi->macHeaderLen, data, length);
+    STAILQ_REMOVE_HEAD(&freeQueue, chain);
+    unlock();
+
+    // the payload of a forwarded packet is still in the radio buffer;
+    // keep it there and put the new header in front of it
+    if (!IS_LOCAL(mi)) {
+        pb = pbufRadioDetach(data, length, mi->macHeaderLen);
+    }
+    if (!pb) {
+        pb = pbufAlloc(mi->macHeaderLen);
+        if (!pb) {
+            lock();
+            STAILQ_INSERT_HEAD(&freeQueue, p, chain);
+            unlock();
+            PRINTF("netQueueAddPacket: no free buffers!\n");
+            return -ENOMEM;
+        }
+        payload = pbufAppend(pb, length);
+        memcpy(payload, data, length);
+    }
+    // the old header may be there, but is not used anymore
+    memmove(pbufPrepend(pb, mi->macHeaderLen), mi->macHeader, mi->macHeaderLen);
+
+    ASSERT(!p->isUsed);
+    p->isUsed = true;
+    p->sendTries = 0;
+    p->dst = getNexthop(mi);
+    p->pbuf = pb;
+    p->data = pbufData(pb);
+    p->dataLength = pb->length;
+
+#if USE_NET_TRACE
+    p->arrivalTime = getTimeMs();
+    {
+        QueuedPacket_t *q;
+        uint8_t queued = 0;
+        STAILQ_FOREACH(q, &packetQueue, chain) queued++;
+        netTrace(NET_TRACE_MAC_ENQUEUE, p->dst, queued);
+    }
+#endif
 
     lock();
-    STAILQ_INSERT_TAIL(&packetQueue, result, chain);
+    STAILQ_INSERT_TAIL(&packetQueue, p, chain);
     unlock();
+    if (result) *result = p;
     return 0;
 }
 
+static void freePacket(QueuedPacket_t *p) {
+    ASSERT(p->isUsed);
+    p->isUsed = false;
+    netTraceLatency(getTimeMs() - p->arrivalTime);
+    pbufFree(p->pbuf);
+    STAILQ_INSERT_TAIL(&freeQueue, p, chain);
+}
+
 void netQueuePop() {
     QueuedPacket_t *p = STAILQ_FIRST(&packetQueue);
     ASSERT(p);
-    ASSERT(p->isUsed);
-    p->isUsed = false;
     // PRINTF("netQueuePop\n");
     lock();
     STAILQ_REMOVE_HEAD(&packetQueue, chain);
+    freePacket(p);
     unlock();
 }
 
+void netQueueRemove(QueuedPacket_t *p) {
+    lock();
+    STAILQ_REMOVE(&packetQueue, p, QueuedPacket_s, chain);
+    freePacket(p);
+    unlock();
+}
+
+bool netQueueHasEarlier(QueuedPacket_t *p) {
+    QueuedPacket_t *q;
+    STAILQ_FOREACH(q, &packetQueue, chain) {
+        if (q == p) break;
+        if (q->dst == p->dst) return true;
+    }
+    return false;
+}
+
 void netQueueForEachPacket(QpacketProcessFn fn) {
     QueuedPacket_t *p;
     STAILQ_FOREACH(p, &packetQueue, chain) fn(p);
@@ -78,9 +164,11 @@ QueuedPacket_t *netQueueGetPacket(QpacketMatchFn fn, void *userData) {
     return NULL;
 }
 
-QueuedPacket_t *netQueueRemovePacket(QpacketMatchFn fn, void *userData) {
+bool netQueueRemovePacket(QpacketMatchFn fn, void *userData) {
     QueuedPacket_t *ret;
+    lock();
     STAILQ_REMOVE_IF(&packetQueue, ret, chain, fn(__t, userData));
-    if (ret) ret->isUsed = false;
-    return ret;
+    if (ret) freePacket(ret);
+    unlock();
+    return ret != NULL;
 }
@@ -25,6 +25,7 @@
 #define MANSOS_NET_QUEUE_H
 
 #include "mac.h"
+#include "pbuf.h"
 #include <lib/list.h>
 
 typedef struct QueuedPacket_s {
@@ -32,8 +33,14 @@ typedef struct QueuedPacket_s {
     bool isUsed;
     uint8_t sendTries; // how many times already tried to send
     uint32_t ackTime;  // await ACK until this time
-    uint8_t data[MAC_PROTOCOL_BUFFER_SIZE];
+    uint32_t sendTime; // the last transmission, for RTT measurement
+    MosShortAddr dst;  // the next hop, for per-destination ordering
+    Pbuf_t *pbuf;      // holds the frame
+    uint8_t *data;     // the frame, header included
     uint16_t dataLength;
+#if USE_NET_TRACE
+    uint32_t arrivalTime; // when it was queued
+#endif
 } QueuedPacket_t;
 
 typedef STAILQ_HEAD(head, QueuedPacket_s) PacketQueue_t;
@@ -41,17 +48,24 @@ extern PacketQueue_t packetQueue;
 
 // ---------------------------------------------
 
+// initialize the queue and the pool of MAC_PROTOCOL_QUEUE_SIZE packets
 void netQueueInit(void);
 
-//  add new packet to userQueue tail. returns error code. locks mutex.
+//  take a packet from the pool and add it to the queue tail. returns error
+//  code (-ENOMEM when all packets are in use). locks mutex.
+//  a frame that is being forwarded is queued in the radio buffer, not copied.
 int8_t netQueueAddPacket(MacInfo_t *, const uint8_t *data, uint16_t length,
-                      QueuedPacket_t *result);
+                      QueuedPacket_t **result /* out, optional */);
 // frees the userQueue head packet. locks mutex. 
 void netQueuePop(void);
+// removes a packet from the queue and frees it. locks mutex.
+void netQueueRemove(QueuedPacket_t *);
 // mutex is not locked
 static inline QueuedPacket_t *queueHead(void) {
     return STAILQ_FIRST(&packetQueue);
 }
+// whether there is a packet to the same destination before this one
+bool netQueueHasEarlier(QueuedPacket_t *);
 
 // work queue processing. mutex is not locked.
 typedef void (*QpacketProcessFn)(QueuedPacket_t *);
@@ -59,8 +73,7 @@ typedef bool (*QpacketMatchFn)(QueuedPacket_t *, void *userData);
 
 void netQueueForEachPacket(QpacketProcessFn);
 QueuedPacket_t *netQueueGetPacket(QpacketMatchFn, void *userData);
-QueuedPacket_t *netQueueRemovePacket(QpacketMatchFn, void *userData);
-
-void queueFreePacket(QueuedPacket_t *);
+// removes the first matching packet and frees it. returns true if found
+bool netQueueRemovePacket(QpacketMatchFn, void *userData);
 
 #endif
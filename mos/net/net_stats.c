@@ -25,6 +25,10 @@
 #include <print.h>
 #include "net_stats.h"
 
+uint32_t netstats[TOTAL_NETSTAT];
+LinkQuality_t linq[LINQ_MAX_NEIGHBOR_COUNT + 1];
+uint8_t linqNeighborCount;
+
 inline uint16_t getIdFromAddress(MosShortAddr addr){
     uint8_t i;
     for (i = 0; i < linqNeighborCount; i++){
@@ -73,7 +73,7 @@ enum {
 
     TOTAL_NETSTAT
 };
-uint32_t netstats[TOTAL_NETSTAT];
+extern uint32_t netstats[TOTAL_NETSTAT];
 
 typedef struct LinkQuality_s{
     MosShortAddr addr;
@@ -84,9 +84,9 @@ typedef struct LinkQuality_s{
     uint16_t lastSeqnumAcked;
 } LinkQuality_t;
 
-LinkQuality_t linq[LINQ_MAX_NEIGHBOR_COUNT + 1];
+extern LinkQuality_t linq[LINQ_MAX_NEIGHBOR_COUNT + 1];
 
-uint8_t linqNeighborCount;
+extern uint8_t linqNeighborCount;
 
 uint16_t getIdFromAddress(MosShortAddr addr);
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net_trace.h"
+#include "mac.h"
+#include "net_queue.h"
+#include <radio.h>
+#include <serial.h>
+#include <print.h>
+#include <timing.h>
+#include <hil/atomic.h>
+
+#if NET_TRACE_SIZE & (NET_TRACE_SIZE - 1)
+#error NET_TRACE_SIZE must be a power of two
+#endif
+
+#define OCCUPANCY_BUCKETS (MAC_PROTOCOL_QUEUE_SIZE + 1)
+
+static NetTraceRecord_t records[NET_TRACE_SIZE];
+static uint32_t total;
+static uint32_t latency[NET_TRACE_LATENCY_BUCKETS];
+static uint32_t occupancy[OCCUPANCY_BUCKETS];
+
+void netTrace(uint8_t point, MosShortAddr addr, uint8_t arg)
+{
+    NetTraceRecord_t *r;
+    Handle_t h;
+
+    // called from both user and kernel threads
+    ATOMIC_START(h);
+    r = &records[total++ & (NET_TRACE_SIZE - 1)];
+    r->time = (uint32_t) jiffies;
+    r->point = point;
+    r->arg = arg;
+    r->addr = addr;
+    if (point == NET_TRACE_MAC_ENQUEUE) {
+        occupancy[arg < OCCUPANCY_BUCKETS ? arg : OCCUPANCY_BUCKETS - 1]++;
+    }
+    ATOMIC_END(h);
+}
+
+void netTraceLatency(uint32_t ms)
+{
+    uint8_t i = 0;
+    while (ms && i < NET_TRACE_LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        i++;
+    }
+    latency[i]++;
+}
+
+int8_t netTraceRadioSendHeader(const void *header, uint16_t headerLength,
+                               const void *data, uint16_t dataLength)
+{
+    int8_t ret;
+    netTrace(NET_TRACE_TX_START, 0, headerLength + dataLength);
+    ret = radioSendHeader(header, headerLength, data, dataLength);
+    // errors are negative; the record keeps the code without the sign
+    netTrace(NET_TRACE_TX_END, 0, (uint8_t) -ret);
+    return ret;
+}
+
+void netTraceDump(void)
+{
+    NetTraceDumpHeader_t header;
+    uint16_t i, count;
+
+    count = total < NET_TRACE_SIZE ? total : NET_TRACE_SIZE;
+    header.magic[0] = 'N';
+    header.magic[1] = 'T';
+    header.version = NET_TRACE_VERSION;
+    header.recordSize = sizeof(NetTraceRecord_t);
+    header.address = localAddress;
+    header.recordCount = count;
+    header.total = total;
+    header.now = getTimeMs();
+    header.latencyBuckets = NET_TRACE_LATENCY_BUCKETS;
+    header.occupancyBuckets = OCCUPANCY_BUCKETS;
+    serialSendData(PRINTF_SERIAL_ID, (uint8_t *) &header, sizeof(header));
+
+    // oldest first
+    for (i = 0; i < count; ++i) {
+        serialSendData(PRINTF_SERIAL_ID,
+                (uint8_t *) &records[(total - count + i) & (NET_TRACE_SIZE - 1)],
+                sizeof(NetTraceRecord_t));
+    }
+    serialSendData(PRINTF_SERIAL_ID, (uint8_t *) latency, sizeof(latency));
+    serialSendData(PRINTF_SERIAL_ID, (uint8_t *) occupancy, sizeof(occupancy));
+
+    total = 0;
+    memset(latency, 0, sizeof(latency));
+    memset(occupancy, 0, sizeof(occupancy));
+}
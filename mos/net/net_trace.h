@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MANSOS_NET_TRACE_H
+#define MANSOS_NET_TRACE_H
+
+/// \file
+/// Timestamped tracepoints of the network stack (USE_NET_TRACE=y).
+///
+/// Events are kept in a ring buffer of NET_TRACE_SIZE records, together
+/// with histograms of the time packets spend in this node and of the
+/// MAC queue occupancy. netTraceDump() sends all of it to the serial port
+/// in binary; tools/nettrace decodes it.
+///
+
+#include "address.h"
+#include <defines.h>
+
+#if USE_NET_TRACE
+
+//! Tracepoints, in the order a packet passes them
+enum {
+    NET_TRACE_SOCKET_SEND, // addr: destination, arg: length
+    NET_TRACE_RX,          // from the MAC; addr: originator, arg: length
+    NET_TRACE_ROUTE,       // addr: originator, arg: RoutingDecision_e
+    NET_TRACE_MAC_ENQUEUE, // addr: next hop, arg: packets queued before
+    NET_TRACE_TX_START,    // arg: frame length
+    NET_TRACE_TX_END,      // arg: radio result (negated error code)
+    NET_TRACE_DELIVER,     // to a socket; addr: originator, arg: port
+
+    TOTAL_NET_TRACE
+};
+
+//! Records kept; a power of two
+#ifndef NET_TRACE_SIZE
+#define NET_TRACE_SIZE  64
+#endif
+
+//! Buckets of the latency histogram: [0], [1], [2-3], [4-7], ... milliseconds
+#define NET_TRACE_LATENCY_BUCKETS  12
+
+//! Binary dump format version
+#define NET_TRACE_VERSION  1
+
+struct NetTraceRecord_s {
+    uint32_t time;        // milliseconds since boot
+    uint8_t point;
+    uint8_t arg;
+    MosShortAddr addr;
+} PACKED;
+typedef struct NetTraceRecord_s NetTraceRecord_t;
+
+//! The start of a binary dump, followed by the records (oldest first),
+/// the latency and the queue occupancy histograms (uint32_t each).
+/// All fields are little-endian.
+struct NetTraceDumpHeader_s {
+    uint8_t magic[2];     // "NT"
+    uint8_t version;
+    uint8_t recordSize;
+    uint16_t address;     // of this node
+    uint16_t recordCount;
+    uint32_t total;       // records ever made; more than recordCount if lost
+    uint32_t now;
+    uint8_t latencyBuckets;
+    uint8_t occupancyBuckets;
+} PACKED;
+typedef struct NetTraceDumpHeader_s NetTraceDumpHeader_t;
+
+//! Record an event
+void netTrace(uint8_t point, MosShortAddr addr, uint8_t arg);
+//! Account for a packet that spent 'ms' milliseconds in this node
+void netTraceLatency(uint32_t ms);
+//! Send the trace and the histograms to serial port and start anew
+void netTraceDump(void);
+
+//! Radio transmission with TX_START and TX_END tracepoints
+int8_t netTraceRadioSendHeader(const void *header, uint16_t headerLength,
+                               const void *data, uint16_t dataLength);
+#define macRadioSendHeader netTraceRadioSendHeader
+
+#else
+
+#define netTrace(point, addr, arg)
+#define netTraceLatency(ms)
+#define netTraceDump()
+#define macRadioSendHeader radioSendHeader
+
+#endif // USE_NET_TRACE
+
+//! What the MAC protocols use for sending frames
+#define macRadioSend(data, length) macRadioSendHeader(NULL, 0, data, length)
+
+#endif
@@ -26,6 +26,7 @@
 #include "socket.h"
 #include "net_queue.h"
 #include "net_stats.h"
+#include "dup_cache.h"
 #include "radio_packet_buffer.h"
 #include <serial_number.h>
 #include <print.h>
@@ -43,10 +44,12 @@ MosShortAddr rootAddress;
 int64_t rootClockDeltaMs;
 #endif
 
-#ifdef DEBUG
+#if defined(DEBUG) && !USE_NET_STATS
 uint32_t netstats[TOTAL_NETSTAT];
 #endif
 
+#if !USE_PBUF
+// with USE_PBUF, the radio buffer comes from the packet buffer pool
 static struct RadioPacketBufferReal_s {
     uint8_t bufferLength;     // length of the buffer
     int8_t receivedLength;    // length of data stored in the packet, or error code if negative
@@ -54,6 +57,7 @@ static struct RadioPacketBufferReal_s {
 } realBuf = {RADIO_BUFFER_SIZE, 0, {0}};
 
 RadioPacketBuffer_t *radioPacketBuffer = (RadioPacketBuffer_t *) &realBuf;
+#endif
 
 // -----------------------------------
 
@@ -95,53 +99,18 @@ bool isLocalAddress(MosAddr *addr) {
 #endif
 }
 
-#if PLATFORM_SADMOTE
-#define NUM_SENDERS 10
-
-typedef struct Sender_s {
-    uint32_t address;
-    uint32_t timestamp;
-} Sender_t;
-
-Sender_t senders[NUM_SENDERS];
-
-static bool findDuplicate(uint16_t address, uint32_t timestamp)
-{
-    uint16_t i;
-    for (i = 0; i < NUM_SENDERS; ++i) {
-        if (senders[i].address == address) {
-            if (senders[i].timestamp == timestamp) {
-                return true;
-            }
-            senders[i].timestamp = timestamp;
-            return false;
-        }
-    }
-
-    for (i = 0; i < NUM_SENDERS; ++i) {
-        if (senders[i].address == 0) {
-            senders[i].address = address;
-            senders[i].timestamp = timestamp;
-            break;
-        }
-    }
-    return false;
-}
-
-static bool isDuplicate(MacInfo_t *macInfo, uint8_t *data, uint16_t len)
-{
-    uint32_t timestamp;
-    if (len < sizeof(timestamp)) return false;
-    memcpy(&timestamp, data, sizeof(timestamp));
-    return findDuplicate(macInfo->originalSrc.shortAddr, timestamp);
-}
-#endif
-
 // send smth to address 'addr', port 'port' 
 void networkingForwardData(MacInfo_t *macInfo, uint8_t *data, uint16_t len) {
     // PRINTF("commForwardData, len=%u\n", len);
-    
-    switch (routePacket(macInfo)) {
+    RoutingDecision_e decision;
+
+    if (!IS_LOCAL(macInfo)) {
+        netTrace(NET_TRACE_RX, macInfo->originalSrc.shortAddr, len);
+    }
+    decision = routePacket(macInfo);
+    netTrace(NET_TRACE_ROUTE, macInfo->originalSrc.shortAddr, decision);
+
+    switch (decision) {
     case RD_DROP:
         // PRINTF("RD_DROP\n");
         if (IS_LOCAL(macInfo)){
@@ -160,14 +129,15 @@ void networkingForwardData(MacInfo_t *macInfo, uint8_t *data, uint16_t len) {
         // PRINTF("RD_UNICAST\n");
         // force header rebuild
         macInfo->macHeaderLen = 0;
-#if PLATFORM_SADMOTE
-        if (!IS_LOCAL(macInfo) && isDuplicate(macInfo, data, len)) {
+        if (!IS_LOCAL(macInfo) && dupCacheCheck(macInfo)) {
             PRINTF("not forwarding, duplicate...\n");
+            INC_NETSTAT(NETSTAT_PACKETS_DROPPED_RX, EMPTY_ADDR);
             break;
         }
-#endif
         if (IS_LOCAL(macInfo)) {
-            INC_NETSTAT(NETSTAT_PACKETS_SENT, macInfo->originalDst.shortAddr);
+            dupCacheStamp(macInfo);
+            // per link: the routing protocol uses it as a quality estimate
+            INC_NETSTAT(NETSTAT_PACKETS_SENT, getNexthop(macInfo));
         }
         macSendEx(macInfo, data, len);
         break;
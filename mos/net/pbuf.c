@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pbuf.h"
+#include "radio_packet_buffer.h"
+#include <assert.h>
+#include <mutex.h>
+
+// buffer 0 starts as the radio receive buffer
+static Pbuf_t pool[PBUF_COUNT] = {
+    [0] = { .refcount = 1, .buffer = { [PBUF_HEADROOM] = PBUF_DATA_SIZE } },
+};
+static Pbuf_t *radioPbuf = &pool[0];
+
+RadioPacketBuffer_t *radioPacketBuffer = (RadioPacketBuffer_t *) (pool[0].buffer + PBUF_HEADROOM);
+
+static Mutex_t mutex;
+#define lock()     mutexLock(&mutex)
+#define unlock()   mutexUnlock(&mutex)
+
+// -----------------------------------------------------
+
+Pbuf_t *pbufAlloc(uint16_t headroom) {
+    Pbuf_t *pb;
+
+    ASSERT(headroom <= PBUF_SIZE);
+    lock();
+    for (pb = pool; pb < pool + PBUF_COUNT; ++pb) {
+        if (!pb->refcount) {
+            pb->refcount = 1;
+            break;
+        }
+    }
+    unlock();
+    if (pb == pool + PBUF_COUNT) return NULL;
+
+    pb->offset = headroom;
+    pb->length = 0;
+    return pb;
+}
+
+void pbufFree(Pbuf_t *pb) {
+    lock();
+    ASSERT(pb->refcount);
+    pb->refcount--;
+    unlock();
+}
+
+uint8_t *pbufPrepend(Pbuf_t *pb, uint16_t length) {
+    if (length > pb->offset) return NULL;
+    pb->offset -= length;
+    pb->length += length;
+    return pbufData(pb);
+}
+
+uint8_t *pbufAppend(Pbuf_t *pb, uint16_t length) {
+    uint8_t *result = pbufData(pb) + pb->length;
+    if (pb->offset + pb->length + length > PBUF_SIZE) return NULL;
+    pb->length += length;
+    return result;
+}
+
+Pbuf_t *pbufRadioDetach(const uint8_t *data, uint16_t length, uint16_t headroom) {
+    Pbuf_t *pb = radioPbuf;
+    Pbuf_t *fresh;
+
+    if (data < radioPacketBuffer->buffer
+            || data + length > radioPacketBuffer->buffer + radioPacketBuffer->bufferLength
+            || data - pb->buffer < headroom) {
+        return NULL;
+    }
+
+    fresh = pbufAlloc(0);
+    if (!fresh) return NULL;
+    radioPbuf = fresh;
+    radioPacketBuffer = (RadioPacketBuffer_t *) (fresh->buffer + PBUF_HEADROOM);
+    radioPacketBuffer->bufferLength = PBUF_DATA_SIZE;
+    radioPacketBuffer->receivedLength = 0;
+
+    pb->offset = data - pb->buffer;
+    pb->length = length;
+    return pb;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MANSOS_PBUF_H
+#define MANSOS_PBUF_H
+
+/// \file
+/// Packet buffers: reference counted, taken from a fixed pool,
+/// with free space in front of the data for headers.
+///
+/// With USE_PBUF the radio also receives into a pool buffer, so a frame
+/// that is forwarded can be queued by reference instead of copied.
+///
+
+#include "mac.h"
+
+//! Free space in front of a received frame, for a longer header when forwarding
+#ifndef PBUF_HEADROOM
+#define PBUF_HEADROOM  16
+#endif
+
+//! The number of buffers: one for each queued packet, one for the radio
+#ifndef PBUF_COUNT
+#define PBUF_COUNT  (MAC_PROTOCOL_QUEUE_SIZE + 1)
+#endif
+
+// RadioPacketBuffer_t describes at most 255 bytes
+#if MAC_PROTOCOL_BUFFER_SIZE > 255
+#define PBUF_DATA_SIZE  255
+#else
+#define PBUF_DATA_SIZE  MAC_PROTOCOL_BUFFER_SIZE
+#endif
+
+// the radio buffer needs two bytes for RadioPacketBuffer_t fields
+#define PBUF_SIZE  (PBUF_HEADROOM + 2 + PBUF_DATA_SIZE)
+
+typedef struct Pbuf_s {
+    uint8_t refcount;  // 0 when in the pool
+    uint16_t offset;   // of the first data byte
+    uint16_t length;   // of the data
+    uint8_t buffer[PBUF_SIZE];
+} Pbuf_t;
+
+//! Take a buffer from the pool, with 'headroom' bytes free in front of the data
+/// @return  NULL if all buffers are in use
+Pbuf_t *pbufAlloc(uint16_t headroom);
+
+//! Release a reference; the last one returns the buffer to the pool
+void pbufFree(Pbuf_t *pb);
+
+//! Take one more reference to a buffer
+static inline void pbufRef(Pbuf_t *pb) {
+    pb->refcount++;
+}
+
+static inline uint8_t *pbufData(Pbuf_t *pb) {
+    return pb->buffer + pb->offset;
+}
+
+//! Grow the data at the front, e.g. for a header
+/// @return  the new start of the data, or NULL if there is not enough headroom
+uint8_t *pbufPrepend(Pbuf_t *pb, uint16_t length);
+
+//! Grow the data at the end
+/// @return  pointer to the added bytes, or NULL if there is not enough room
+uint8_t *pbufAppend(Pbuf_t *pb, uint16_t length);
+
+//! Take over the frame the radio has received, if 'data' is in it
+///
+/// The radio gets a fresh buffer from the pool. The returned buffer
+/// holds 'length' bytes from 'data' and has at least 'headroom' bytes
+/// in front of them.
+/// @return  NULL if 'data' is not in the radio buffer or no buffer is free
+Pbuf_t *pbufRadioDetach(const uint8_t *data, uint16_t length, uint16_t headroom);
+
+#endif
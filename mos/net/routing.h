@@ -41,6 +41,8 @@
 #define ROUTING_PROTOCOL_DV  1
 //! SAD routing protocol
 #define ROUTING_PROTOCOL_SAD 2
+//! Distance vector routing with a link quality (ETX) metric
+#define ROUTING_PROTOCOL_ETX 3
 
 //! Routing decision
 typedef enum {
@@ -93,6 +95,17 @@ struct RoutingInfoPacket_s {
 } PACKED;
 typedef struct RoutingInfoPacket_s RoutingInfoPacket_t;
 
+//! Routing information with the path cost, sent out by ROUTING_PROTOCOL_ETX nodes
+///
+/// Nodes that send plain RoutingInfoPacket_t are assumed to have
+/// perfect links, i.e. a cost of (hopCount - 1) * ETX_ONE.
+struct RoutingEtxInfoPacket_s {
+    RoutingInfoPacket_t info;
+    //! Expected number of transmissions to the root, in 1/ETX_ONE units
+    uint16_t pathEtx;
+} PACKED;
+typedef struct RoutingEtxInfoPacket_s RoutingEtxInfoPacket_t;
+
 //! Routing information, sent out by all nodes except base station
 typedef struct RoutingRequestPacket_s {
     //! Always set to ROUTING_REQUEST
@@ -145,6 +158,45 @@ typedef struct RoutingRequestPacket_s {
 
 #define MAX_HOP_COUNT 16
 
+//! ETX value of a perfect link
+#define ETX_ONE       16
+#define ETX_INFINITY  0xffff
+
+//! Minimal path cost improvement to switch to another parent
+#ifndef ETX_PARENT_SWITCH_THRESHOLD
+#define ETX_PARENT_SWITCH_THRESHOLD  (ETX_ONE + ETX_ONE / 2)
+#endif
+
+//! Links with a weaker signal than this (dBm) get one extra expected transmission
+#ifndef ETX_RSSI_THRESHOLD
+#define ETX_RSSI_THRESHOLD  -87
+#endif
+
+//! Links with a lower LQI than this get one extra expected transmission (radio specific; 0 disables)
+#ifndef ETX_LQI_THRESHOLD
+#define ETX_LQI_THRESHOLD  0
+#endif
+
+//! Neighbors tracked by ROUTING_PROTOCOL_ETX
+#ifndef ETX_MAX_NEIGHBORS
+#define ETX_MAX_NEIGHBORS  8
+#endif
+
+//! Running average of ETX link qualities, which are fractions of 255
+static inline uint8_t etxEwma(uint8_t average, uint8_t sample)
+{
+    return average - (average >> 3) + (sample >> 3);
+}
+
+//! Outbound link quality after 'acked' of 'sent' unicast packets got an ACK;
+//! 'average' is the previous value, 0 if unknown
+static inline uint8_t etxOutQuality(uint8_t average, uint32_t sent, uint32_t acked)
+{
+    uint8_t q = acked >= sent ? 255 : acked * 255 / sent;
+    if (!q) q = 1; // known to be bad
+    return average ? etxEwma(average, q) : q;
+}
+
 #if USE_ROLE_FORWARDER || USE_ROLE_COLLECTOR
 // turn off radio, but only after two hours of uninterrupted listening
 #define RADIO_OFF_ENERGSAVE() \
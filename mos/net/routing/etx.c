@@ -0,0 +1,438 @@
+/*
+ * Copyright (c) 2008-2012 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Distance-vector routing with a link quality metric, mote side algorithm
+//
+// Same as dv.c, but the parent is the neighbor with the least expected
+// number of transmissions (ETX) to the root, not the least hops.
+// The ETX of a link is 1 / (df * dr): dr is the share of routing rounds
+// heard from the neighbor, df the share of unicast packets it has ACKed
+// (taken from the link statistics when available, assumed equal to dr
+// otherwise). Links with weak RSSI or LQI get a penalty.
+// The parent is replaced only by a neighbor that is better by at least
+// ETX_PARENT_SWITCH_THRESHOLD, or when it falls behind the routing rounds.
+//
+
+#include "../mac.h"
+#include "../routing.h"
+#include "../socket.h"
+#include <alarms.h>
+#include <timing.h>
+#include <print.h>
+#include <random.h>
+#include <radio.h>
+#include <net/net_stats.h>
+
+// quality is a fraction of 255
+#define QUALITY_INITIAL  128
+// ACK ratio is measured over at least this many packets
+#define ETX_MIN_SAMPLES  8
+
+typedef struct EtxNeighbor_s {
+    MosShortAddr address;   // 0 for unused entries
+    Seqnum_t seqnum;        // the last routing round heard from it
+    uint16_t hopCount;
+    uint16_t pathEtx;       // its cost to the root
+    uint8_t inQuality;      // share of routing rounds heard
+    uint8_t outQuality;     // share of unicast packets ACKed, 0 if unknown
+    int8_t rssi;
+    uint8_t lqi;
+#if USE_NET_STATS
+    uint32_t lastSent;
+    uint32_t lastAcked;
+#endif
+} EtxNeighbor_t;
+
+static Socket_t roSocket;
+static Alarm_t roForwardTimer;
+static Alarm_t roRequestTimer;
+
+#if MULTIHOP_FORWARDER
+static void roForwardTimerCb(void *);
+#endif
+static void roRequestTimerCb(void *);
+static void routingReceive(Socket_t *s, uint8_t *data, uint16_t len);
+
+static EtxNeighbor_t neighbors[ETX_MAX_NEIGHBORS];
+static EtxNeighbor_t *parent;
+
+static Seqnum_t lastSeenSeqnum;
+static Seqnum_t routeSeqnum;
+static uint16_t hopCountToRoot = MAX_HOP_COUNT;
+static uint16_t pathEtxToRoot = ETX_INFINITY;
+static uint32_t lastRootMessageTime = (uint32_t) -ROUTING_INFO_VALID_TIME;
+static MosShortAddr nexthopToRoot;
+
+// -----------------------------------------------
+
+static void markForwardTimerActive(uint16_t times)
+{
+    roForwardTimer.data = (void *) times;
+}
+
+#if MULTIHOP_FORWARDER
+static bool isForwardTimerActive(void)
+{
+    return (bool) roForwardTimer.data;
+}
+#endif
+
+static inline bool isRoutingInfoValid(void)
+{
+    return timeAfter32(lastRootMessageTime + ROUTING_INFO_VALID_TIME, (uint32_t)getJiffies());
+}
+
+// heard from in this or the previous routing round
+static inline bool isFresh(EtxNeighbor_t *n)
+{
+    return (Seqnum_t) (lastSeenSeqnum - n->seqnum) <= 1;
+}
+
+static uint16_t linkEtx(EtxNeighbor_t *n)
+{
+    uint16_t out = n->outQuality ? : n->inQuality;
+    uint32_t etx;
+
+    if (!n->inQuality || !out) return ETX_INFINITY;
+    etx = (uint32_t) ETX_ONE * 255 * 255 / ((uint32_t) n->inQuality * out);
+    // gray zone links tend to fail in bursts
+    if (n->rssi < ETX_RSSI_THRESHOLD) etx += ETX_ONE;
+#if ETX_LQI_THRESHOLD
+    if (n->lqi < ETX_LQI_THRESHOLD) etx += ETX_ONE;
+#endif
+    return etx < ETX_INFINITY ? etx : ETX_INFINITY;
+}
+
+static uint16_t pathCost(EtxNeighbor_t *n)
+{
+    uint32_t cost = (uint32_t) n->pathEtx + linkEtx(n);
+    return cost < ETX_INFINITY ? cost : ETX_INFINITY;
+}
+
+#if USE_NET_STATS
+static void updateOutQuality(EtxNeighbor_t *n)
+{
+    uint8_t i;
+    uint32_t sent, acked;
+
+    // only MACs with ACKs tell whether unicast packets got through
+    if (macProtocol.name != MAC_PROTOCOL_CSMA_ACK
+            && macProtocol.name != MAC_PROTOCOL_WINDOW_ACK
+            && macProtocol.name != MAC_PROTOCOL_LPL) return;
+
+    for (i = 0; i < linqNeighborCount; i++) {
+        if (linq[i].addr == n->address) break;
+    }
+    if (i == linqNeighborCount) return;
+
+    sent = linq[i].sent - n->lastSent;
+    acked = linq[i].recvAck - n->lastAcked;
+    if (sent < ETX_MIN_SAMPLES) return;
+    n->lastSent = linq[i].sent;
+    n->lastAcked = linq[i].recvAck;
+
+    n->outQuality = etxOutQuality(n->outQuality, sent, acked);
+}
+#else
+#define updateOutQuality(n)
+#endif
+
+static EtxNeighbor_t *findNeighbor(MosShortAddr address, bool *isNew)
+{
+    EtxNeighbor_t *n, *victim = NULL;
+    *isNew = false;
+    for (n = neighbors; n < neighbors + ETX_MAX_NEIGHBORS; ++n) {
+        if (n->address == address) return n;
+    }
+
+    // replace the one heard from longest ago, but never the parent
+    for (n = neighbors; n < neighbors + ETX_MAX_NEIGHBORS; ++n) {
+        if (!n->address) {
+            victim = n;
+            break;
+        }
+        if (n == parent) continue;
+        if (!victim || (Seqnum_t) (lastSeenSeqnum - n->seqnum)
+                > (Seqnum_t) (lastSeenSeqnum - victim->seqnum)) {
+            victim = n;
+        }
+    }
+    if (!victim) return NULL;
+
+    *isNew = true;
+    memset(victim, 0, sizeof(*victim));
+    victim->address = address;
+    victim->inQuality = QUALITY_INITIAL;
+    victim->rssi = radioGetLastRSSI();
+    victim->lqi = radioGetLastLQI();
+#if USE_NET_STATS
+    uint8_t i;
+    for (i = 0; i < linqNeighborCount; i++) {
+        if (linq[i].addr == address) {
+            victim->lastSent = linq[i].sent;
+            victim->lastAcked = linq[i].recvAck;
+        }
+    }
+#endif
+    return victim;
+}
+
+static void updateNeighbor(EtxNeighbor_t *n, RoutingEtxInfoPacket_t *ri, bool isNew)
+{
+    n->rssi = ((int16_t) n->rssi * 3 + radioGetLastRSSI()) / 4;
+    n->lqi = ((uint16_t) n->lqi * 3 + radioGetLastLQI()) / 4;
+
+    if (isNew) {
+        n->inQuality = etxEwma(n->inQuality, 255);
+    } else if (timeAfter16(ri->info.seqnum, n->seqnum)) {
+        // the rounds in between were missed
+        Seqnum_t missed = ri->info.seqnum - n->seqnum - 1;
+        if (missed > 8) missed = 8;
+        while (missed--) n->inQuality = etxEwma(n->inQuality, 0);
+        n->inQuality = etxEwma(n->inQuality, 255);
+    } else if (ri->info.seqnum != n->seqnum) {
+        return; // stale
+    }
+    n->seqnum = ri->info.seqnum;
+    n->hopCount = ri->info.hopCount;
+    n->pathEtx = ri->pathEtx;
+    updateOutQuality(n);
+}
+
+static EtxNeighbor_t *bestNeighbor(uint16_t *bestCost)
+{
+    EtxNeighbor_t *n, *best = NULL;
+    *bestCost = ETX_INFINITY;
+    for (n = neighbors; n < neighbors + ETX_MAX_NEIGHBORS; ++n) {
+        if (!n->address || !isFresh(n) || n->hopCount >= MAX_HOP_COUNT) continue;
+        uint16_t cost = pathCost(n);
+        if (cost < *bestCost) {
+            *bestCost = cost;
+            best = n;
+        }
+    }
+    return best;
+}
+
+void routingInit(void)
+{
+    socketOpen(&roSocket, routingReceive);
+    socketBind(&roSocket, ROUTING_PROTOCOL_PORT);
+    socketSetDstAddress(&roSocket, MOS_ADDR_BROADCAST);
+
+#if MULTIHOP_FORWARDER
+    alarmInit(&roForwardTimer, roForwardTimerCb, NULL);
+#endif
+    alarmInit(&roRequestTimer, roRequestTimerCb, NULL);
+    alarmSchedule(&roRequestTimer, randomInRange(2000, 3000));
+}
+
+#if MULTIHOP_FORWARDER
+static void roForwardTimerCb(void *x)
+{
+    if (hopCountToRoot >= MAX_HOP_COUNT) return;
+
+    PRINTF("forward routing packet, ETX %u\n", pathEtxToRoot);
+
+    RoutingEtxInfoPacket_t routingInfo;
+    routingInfo.info.packetType = ROUTING_INFORMATION;
+    routingInfo.info.senderType = 0;
+    routingInfo.info.rootAddress = rootAddress;
+    routingInfo.info.hopCount = hopCountToRoot + 1;
+    routingInfo.info.seqnum = routeSeqnum;
+    routingInfo.info.rootClockMs = getSyncTimeMs64();
+    routingInfo.info.moteNumber = 0;
+    routingInfo.pathEtx = pathEtxToRoot;
+
+    socketSend(&roSocket, &routingInfo, sizeof(routingInfo));
+
+    uint16_t timesLeft = (uint16_t)roForwardTimer.data;
+    --timesLeft;
+    markForwardTimerActive(timesLeft);
+    if (timesLeft) {
+        // reschedule alarm
+        alarmSchedule(&roForwardTimer, randomInRange(100, 300));
+    }
+}
+#endif
+
+static void roRequestTimerCb(void *x)
+{
+    if (isRoutingInfoValid()) return;
+
+    RoutingRequestPacket_t req;
+    req.packetType = ROUTING_REQUEST;
+    req.senderType = 0;
+    socketSend(&roSocket, &req, sizeof(req));
+    markForwardTimerActive(0);
+}
+
+static void routingReceive(Socket_t *s, uint8_t *data, uint16_t len)
+{
+    if (len == 0) {
+        PRINTF("routingReceive: no data!\n");
+        return;
+    }
+
+    uint8_t type = *data;
+    if (type == ROUTING_REQUEST) {
+#if MULTIHOP_FORWARDER
+        if (!isForwardTimerActive()) {
+            markForwardTimerActive(1);
+            alarmSchedule(&roForwardTimer, randomInRange(1000, 3000));
+        }
+#endif
+        return;
+    }
+
+    if (type != ROUTING_INFORMATION) {
+        PRINTF("routingReceive: unknown type!\n");
+        return;
+    }
+
+    if (len < sizeof(RoutingInfoPacket_t)) {
+        PRINTF("routingReceive: too short for info packet!\n");
+        return;
+    }
+
+    RoutingEtxInfoPacket_t ri;
+    if (len >= sizeof(RoutingEtxInfoPacket_t)) {
+        memcpy(&ri, data, sizeof(RoutingEtxInfoPacket_t));
+    } else {
+        // from the base station or a plain DV node
+        memcpy(&ri.info, data, sizeof(RoutingInfoPacket_t));
+        ri.pathEtx = ri.info.hopCount ? (ri.info.hopCount - 1) * ETX_ONE : 0;
+    }
+    if (ri.info.hopCount > MAX_HOP_COUNT) return;
+
+    bool isNew;
+    EtxNeighbor_t *n = findNeighbor(s->recvMacInfo->originalSrc.shortAddr, &isNew);
+    if (!n) return;
+
+    if (!isRoutingInfoValid() || timeAfter16(ri.info.seqnum, lastSeenSeqnum)) {
+        lastSeenSeqnum = ri.info.seqnum;
+    }
+    updateNeighbor(n, &ri, isNew);
+
+    uint16_t cost;
+    EtxNeighbor_t *best = bestNeighbor(&cost);
+    if (!best) return;
+
+    // hysteresis: stay with the parent unless it is clearly worse
+    if (parent && isFresh(parent)
+            && parent->hopCount < MAX_HOP_COUNT) {
+        uint16_t parentCost = pathCost(parent);
+        if (parentCost != ETX_INFINITY
+                && (uint32_t) cost + ETX_PARENT_SWITCH_THRESHOLD >= parentCost) {
+            best = parent;
+            cost = parentCost;
+        }
+    }
+
+    bool changed = best != parent || !isRoutingInfoValid();
+    if (!changed && n != parent) return;
+
+    if (best != parent) {
+        PRINTF("ETX: new parent %#04x, cost %u\n", best->address, cost);
+    }
+    bool advertise = changed || best->seqnum != routeSeqnum
+            || cost + ETX_ONE / 2 < pathEtxToRoot;
+
+    parent = best;
+    rootAddress = ri.info.rootAddress;
+    nexthopToRoot = best->address;
+    hopCountToRoot = best->hopCount;
+    pathEtxToRoot = cost;
+    routeSeqnum = best->seqnum;
+    lastRootMessageTime = getJiffies();
+
+#if MULTIHOP_FORWARDER
+    if (advertise && !isForwardTimerActive()) {
+        markForwardTimerActive(1);
+        alarmSchedule(&roForwardTimer, randomInRange(1000, 3000));
+    }
+#else
+    (void) advertise;
+#endif
+}
+
+static bool checkHoplimit(MacInfo_t *info)
+{
+    if (IS_LOCAL(info)) return true; // only for forwarding
+    if (!info->hoplimit) return true; // hoplimit is optional
+    if (--info->hoplimit) return true; // shold be larger than zero after decrement
+    return false;
+}
+
+RoutingDecision_e routePacket(MacInfo_t *info)
+{
+    MosAddr *dst = &info->originalDst;
+
+    // fix root address if we are sending it to the root
+    if (IS_LOCAL(info) && dst->shortAddr == MOS_ADDR_ROOT) {
+        intToAddr(info->originalDst, rootAddress);
+        info->hoplimit = MAX_HOP_COUNT;
+    }
+
+    if (isLocalAddress(dst)) {
+        INC_NETSTAT(NETSTAT_PACKETS_RECV, info->originalSrc.shortAddr);
+        return RD_LOCAL;
+    }
+    if (isBroadcast(dst)) {
+        if (!IS_LOCAL(info)){
+            INC_NETSTAT(NETSTAT_PACKETS_RECV, info->originalSrc.shortAddr);
+        }
+        // don't forward broadcast packets
+        return IS_LOCAL(info) ? RD_BROADCAST : RD_LOCAL;
+    }
+
+    // check if hop limit allows the packet to be forwarded
+    if (!checkHoplimit(info)) {
+        PRINTF("hoplimit reached!\n");
+        return RD_DROP;
+    }
+
+#if MULTIHOP_FORWARDER
+    if (dst->shortAddr == rootAddress) {
+        if (isRoutingInfoValid()) {
+            if (!IS_LOCAL(info)) {
+                PRINTF("****************** Forwarding a packet to root for %#04x!\n",
+                        info->originalSrc.shortAddr);
+                INC_NETSTAT(NETSTAT_PACKETS_FWD, nexthopToRoot);
+            }
+            info->immedDst.shortAddr = nexthopToRoot;
+            return RD_UNICAST;
+        } else {
+            PRINTF("root routing info not present or expired!\n");
+            return RD_DROP;
+        }
+    }
+#endif
+
+    if (IS_LOCAL(info)) {
+        // send out even with an unknown nexthop, makes sense?
+        return RD_UNICAST;
+    }
+    return RD_DROP;
+}
@@ -28,6 +28,9 @@
 #include <assert.h>
 #include <timing.h>
 #include <print.h>
+#if USE_SEAL_AGGREGATION
+#include <alarms.h>
+#endif
 
 #if DEBUG
 #define SEAL_DEBUG 1
@@ -51,9 +54,24 @@ uint8_t packetInProgressNumFields;
 static Socket_t socket;
 #endif
 
+#if USE_SEAL_AGGREGATION
+#if USE_NET
+#define SEAL_AGGREGATE_MAX_LENGTH (RADIO_MAX_PACKET - MAX_MAC_HEADER_LEN)
+#else
+#define SEAL_AGGREGATE_MAX_LENGTH RADIO_MAX_PACKET
+#endif
+
+static uint8_t aggregateBuffer[SEAL_AGGREGATE_MAX_LENGTH];
+static uint16_t aggregateLength;
+// the buffer is being sent; new packets cannot join it
+static bool aggregateSending;
+static Alarm_t aggregateTimer;
+#endif
+
 // local functions
 
 static void sealRecv(uint8_t *data, uint16_t length);
+static void sealSend(const void *data, uint16_t length);
 
 #define for_all_listeners(op)                                           \
     do {                                                                \
@@ -76,8 +94,18 @@ static void sealRecvRaw(void)
 }
 #endif
 
+#if USE_SEAL_AGGREGATION
+static void aggregateTimerCb(void *x)
+{
+    sealNetFlush();
+}
+#endif
+
 void sealNetInit(void)
 {
+#if USE_SEAL_AGGREGATION
+    alarmInit(&aggregateTimer, aggregateTimerCb, NULL);
+#endif
 #if USE_NET
     // use sockets
     socketOpen(&socket, sealRecvData);
@@ -135,10 +163,8 @@ static void receivePacketData(SealNetListener_t *l, uint32_t typeMask, const uin
     listenerBeingProcessed = NULL;
 }
 
-static void sealRecv(uint8_t *data, uint16_t length)
+static void sealRecvPacket(uint8_t *data, uint16_t length)
 {
-    DPRINTF("%lu: seal rx\n", (uint32_t) getTimeMs());
-
     if (length < sizeof(SealHeader_t)) {
         DPRINTF("sealRecv: too short!\n");
         return;
@@ -172,6 +198,35 @@ static void sealRecv(uint8_t *data, uint16_t length)
     PRINTF("$\n");
 }
 
+static void sealRecv(uint8_t *data, uint16_t length)
+{
+    DPRINTF("%lu: seal rx\n", (uint32_t) getTimeMs());
+
+    SealAggregateHeader_t ah;
+    if (length < sizeof(ah)) {
+        DPRINTF("sealRecv: too short!\n");
+        return;
+    }
+    memcpy(&ah, data, sizeof(ah));
+    if (ah.magic != SEAL_AGGREGATE_MAGIC) {
+        sealRecvPacket(data, length);
+        return;
+    }
+
+    // split an aggregated frame; each packet has its own crc
+    uint8_t *end = data + length;
+    data += sizeof(ah);
+    while (ah.count-- && data < end) {
+        uint8_t packetLength = *data++;
+        if (packetLength > end - data) {
+            DPRINTF("sealRecv: aggregated packet truncated!\n");
+            return;
+        }
+        sealRecvPacket(data, packetLength);
+        data += packetLength;
+    }
+}
+
 bool sealNetPacketRegisterInterest(uint32_t typeMask,
                                     MultiValueCallbackFunction callback,
                                     int32_t *buffer)
@@ -251,13 +306,97 @@ void sealNetPacketFinish(void)
     packetInProgress->header.crc = 
             crc16((const uint8_t *) packetInProgress + 4, length - 4);
 
+#if USE_SEAL_AGGREGATION
+    sealNetSendAggregated(packetInProgress, length);
+#else
+    sealSend(packetInProgress, length);
+#endif
+}
+
+static void sealSend(const void *data, uint16_t length)
+{
 #if USE_NET
-    socketSend(&socket, packetInProgress, length);
+    socketSend(&socket, data, length);
 #else
-    radioSend(packetInProgress, length);
+    radioSend(data, length);
 #endif
 }
 
+#if USE_SEAL_AGGREGATION
+// must be called with interrupts off, as the flush may run in the
+// kernel thread; returns false if the packet must go on its own
+static bool aggregateAppend(const void *packet, uint16_t length)
+{
+    if (aggregateSending) return false;
+    if (aggregateLength + 1 + length > SEAL_AGGREGATE_MAX_LENGTH) return false;
+    if (aggregateLength == 0) {
+        SealAggregateHeader_t ah = { SEAL_AGGREGATE_MAGIC, 0 };
+        memcpy(aggregateBuffer, &ah, sizeof(ah));
+        aggregateLength = sizeof(ah);
+        alarmSchedule(&aggregateTimer, SEAL_AGGREGATE_MAX_DELAY);
+    }
+    aggregateBuffer[aggregateLength++] = length;
+    memcpy(aggregateBuffer + aggregateLength, packet, length);
+    aggregateLength += length;
+    ((SealAggregateHeader_t *) aggregateBuffer)->count++;
+    return true;
+}
+
+void sealNetSendAggregated(const void *packet, uint16_t length)
+{
+    Handle_t h;
+    bool queued;
+
+    if (length + 1 + sizeof(SealAggregateHeader_t) > SEAL_AGGREGATE_MAX_LENGTH) {
+        // does not fit in a frame with anything else
+        sealSend(packet, length);
+        return;
+    }
+
+    ATOMIC_START(h);
+    queued = aggregateAppend(packet, length);
+    ATOMIC_END(h);
+    if (queued) return;
+
+    // full: send what there is and start a new frame
+    sealNetFlush();
+    ATOMIC_START(h);
+    queued = aggregateAppend(packet, length);
+    ATOMIC_END(h);
+    // another flush still in progress
+    if (!queued) sealSend(packet, length);
+}
+
+void sealNetFlush(void)
+{
+    Handle_t h;
+    bool empty;
+
+    alarmRemove(&aggregateTimer);
+
+    // the buffer is not touched by others while being sent, so the
+    // sending itself can go with interrupts on
+    ATOMIC_START(h);
+    empty = aggregateLength == 0 || aggregateSending;
+    if (!empty) aggregateSending = true;
+    ATOMIC_END(h);
+    if (empty) return;
+
+    SealAggregateHeader_t *ah = (SealAggregateHeader_t *) aggregateBuffer;
+    if (ah->count == 1) {
+        // no point in the extra header
+        sealSend(aggregateBuffer + sizeof(*ah) + 1, aggregateLength - sizeof(*ah) - 1);
+    } else {
+        sealSend(aggregateBuffer, aggregateLength);
+    }
+
+    ATOMIC_START(h);
+    aggregateLength = 0;
+    aggregateSending = false;
+    ATOMIC_END(h);
+}
+#endif
+
 void sealNetSendValue(uint16_t code, int32_t value)
 {
     SealPacket_t packet;
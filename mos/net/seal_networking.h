@@ -35,6 +35,11 @@
 #define SEAL_MAGIC    0x5EA1 // "SEAl"
 #endif
 
+//! The magic code at start of aggregated frames (several SEAL packets in one)
+#ifndef SEAL_AGGREGATE_MAGIC
+#define SEAL_AGGREGATE_MAGIC 0x5EA9
+#endif
+
 //! The data port used for SEAL packets
 #ifndef SEAL_DATA_PORT
 #define SEAL_DATA_PORT 123
@@ -74,6 +79,19 @@ struct SealPacket_s {
 } PACKED;
 typedef struct SealPacket_s SealPacket_t;
 
+//! Aggregated frame header; followed by 'count' packets,
+/// each prefixed by its length in one byte
+struct SealAggregateHeader_s {
+    uint16_t magic;
+    uint8_t count;
+} PACKED;
+typedef struct SealAggregateHeader_s SealAggregateHeader_t;
+
+//! The longest time a packet can wait for others to share its frame (ms)
+#ifndef SEAL_AGGREGATE_MAX_DELAY
+#define SEAL_AGGREGATE_MAX_DELAY 1000
+#endif
+
 typedef void (*MultiValueCallbackFunction)(int32_t *packet);
 typedef void (*SingleValueCallbackFunction)(uint16_t code, int32_t value);
 
@@ -132,6 +150,19 @@ static inline void sealNetSendCommand(uint16_t command)
     sealNetSendValue(PACKET_FIELD_ID_COMMAND, command);
 }
 
+#if USE_SEAL_AGGREGATION
+//
+// Queue a complete SEAL packet for sending. Packets are batched in one frame,
+// which is sent when full or SEAL_AGGREGATE_MAX_DELAY ms after the first packet.
+//
+void sealNetSendAggregated(const void *packet, uint16_t length);
+
+//
+// Send the queued packets now
+//
+void sealNetFlush(void);
+#endif
+
 //
 // Read last received sensor value (identified by code only)
 //
@@ -28,15 +28,22 @@
 #include <mutex.h>
 #include <kernel/stack.h>
 
-static SLIST_HEAD(head, Socket_s) socketList;
+// sockets hashed by port; MOS_PORT_ANY sockets are in the bucket of port 0
+SLIST_HEAD(SocketList_s, Socket_s);
+static struct SocketList_s socketTable[SOCKET_HASH_SIZE];
 static Mutex_t socketListMutex;
 
 #define lock()    mutexLock(&socketListMutex)
 #define unlock()  mutexUnlock(&socketListMutex)
 
+#define bucket(port) (&socketTable[(port) & (SOCKET_HASH_SIZE - 1)])
+
 void socketsInit(void)
 {
-    SLIST_INIT(&socketList);
+    uint8_t i;
+    for (i = 0; i < SOCKET_HASH_SIZE; ++i) {
+        SLIST_INIT(&socketTable[i]);
+    }
 }
 
 int8_t socketOpen(Socket_t *socket, SocketRecvFunction cb)
@@ -50,7 +57,7 @@ int8_t socketOpen(Socket_t *socket, SocketRecvFunction cb)
     socket->port = MOS_PORT_ANY;
     socket->recvMacInfo = NULL;
     lock();
-    SLIST_INSERT_HEAD(&socketList, socket, chain);
+    SLIST_INSERT_HEAD(bucket(MOS_PORT_ANY), socket, chain);
     unlock();
     return 0; // XXX
 }
@@ -58,11 +65,28 @@ int8_t socketOpen(Socket_t *socket, SocketRecvFunction cb)
 int8_t socketClose(Socket_t *socket)
 {
     lock();
-    SLIST_REMOVE_SAFE(&socketList, socket, Socket_s, chain);
+    SLIST_REMOVE_SAFE(bucket(socket->port), socket, Socket_s, chain);
     unlock();
     return 0; // XXX
 }
 
+void socketBind(Socket_t *socket, NetPort_t port)
+{
+    Socket_t *t;
+
+    lock();
+    SLIST_FOREACH(t, bucket(socket->port), chain) {
+        if (t == socket) break;
+    }
+    if (t) {
+        // opened already, move to the bucket of the new port
+        SLIST_REMOVE_SAFE(bucket(socket->port), socket, Socket_s, chain);
+        SLIST_INSERT_HEAD(bucket(port), socket, chain);
+    }
+    socket->port = port;
+    unlock();
+}
+
 int8_t socketSend(Socket_t *socket, const void *data, uint16_t len)
 {
     return sendPacket(socket->dstAddress, socket->port, data, len);
@@ -73,24 +97,26 @@ void socketInputData(MacInfo_t *macInfo, void *data, uint16_t len)
     Socket_t *s;
     Socket_t *catchall;
     Socket_t *t;
+    SocketRecvFunction cb;
 
     // PRINTF("socketInputData, port=%u\n", macInfo->dstPort);
+    netTrace(NET_TRACE_DELIVER, macInfo->originalSrc.shortAddr, macInfo->dstPort);
 
     s = NULL;
     catchall = NULL;
     lock();
-    SLIST_FOREACH(t, &socketList, chain) {
+    SLIST_FOREACH(t, bucket(macInfo->dstPort), chain) {
         if (t->port == macInfo->dstPort) {
             s = t;
             break;
         }
-        
-        if (t->port == MOS_PORT_ANY) {
-            catchall = t;
-        }
     }
-
     if (!s) {
+        SLIST_FOREACH(t, bucket(MOS_PORT_ANY), chain) {
+            if (t->port == MOS_PORT_ANY) {
+                catchall = t;
+            }
+        }
         if (!catchall) {
             PRINTF("warning: dropping data, no sockets listening to port %d\n",
                     macInfo->dstPort);
@@ -100,25 +126,26 @@ void socketInputData(MacInfo_t *macInfo, void *data, uint16_t len)
         s = catchall;
     }
 
-    if (s->recvCb) {
-        // set meta info
-        s->recvMacInfo = macInfo;
-        // call user's callback
-        s->recvCb(s, data, len);
-    }
+    // set meta info
+    s->recvMacInfo = macInfo;
+    cb = s->recvCb;
     unlock();
+
+    // call user's callback without the lock, so that it can use sockets too
+    if (cb) cb(s, data, len);
 }
 
 int8_t sendPacket(MosShortAddr addr, NetPort_t port,
                   const void *buffer, uint16_t bufferLength)
 {
-    static MacInfo_t mi;
+    MacInfo_t mi;
     memset(&mi, 0, sizeof(mi));
     fillLocalAddress(&mi.originalSrc);
     intToAddr(mi.originalDst, addr);
     mi.dstPort = port;
     mi.flags |= MI_FLAG_LOCALLY_ORIGINATED;
 
+    netTrace(NET_TRACE_SOCKET_SEND, addr, bufferLength);
     networkingForwardData(&mi, (uint8_t *) buffer, bufferLength);
 
     return 0;
@@ -37,6 +37,11 @@
 
 typedef uint8_t NetPort_t;
 
+//! The number of buckets in the socket port table (power of 2)
+#ifndef SOCKET_HASH_SIZE
+#define SOCKET_HASH_SIZE 8
+#endif
+
 struct Socket_s;
 typedef void (*SocketRecvFunction)(struct Socket_s *, uint8_t *data, uint16_t len);
 
@@ -73,10 +78,7 @@ int8_t socketOpen(Socket_t *, SocketRecvFunction cb);
 int8_t socketClose(Socket_t *);
 
 //! Bind a socket to a specific port
-static inline void socketBind(Socket_t *s, NetPort_t port)
-{
-    s->port = port;
-}
+void socketBind(Socket_t *s, NetPort_t port);
 
 //! Set destination address of a specific socket
 static inline void socketSetDstAddress(Socket_t *s, MosShortAddr addr)
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include "platform.h"
+#include <lib/energy.h>
 
 uint16_t pcAlarmTimerRegister;
 uint16_t pcSleepTimerRegister;
@@ -38,11 +39,20 @@ sem_t sleepSem;
 
 void *alarmIntHandler(void *);
 
+#if !USE_PC_SIM
 static void loopForever(void) {
     // this is needed to emulate behaviour of microconrolleer compilers:
     // they insert an infinite loop after the end of main()
     for (;;);
 }
+#endif
+
+void pcSleep(uint16_t milliseconds)
+{
+    usleep(milliseconds * 1000);
+    // counted like a wakeup from low power mode on a real MCU
+    energyCountWakeup();
+}
 
 //----------------------------------------------------------
 //      Init the platform as if on cold reset
@@ -51,6 +61,14 @@ void initPlatform(void)
 {
     mos_sem_init(&sleepSem, 0);
 
+#if USE_PC_SIM
+    // the simulator takes care of time and alarms
+#else
+#ifdef USE_ADDRESSING
+    // must be known before the alarm thread is started
+    pcVirtualTimeInit();
+#endif
+
 #if USE_ALARMS
     // this is a "specific thread", not part of the scheduler
     // create it even when threads are turned off
@@ -59,5 +77,6 @@ void initPlatform(void)
 #endif
 
     atexit(loopForever);
+#endif
 }
 
@@ -67,9 +67,31 @@ void initPlatform(void);
 
 // sleeping
 #include <unistd.h>
+#if USE_PC_SIM
+#include "sim_hal.h"
+// the variable is the same for all simulated motes
+#define PC_SIM_SHARED __attribute__((section("pcsim_shared")))
+#elif defined USE_ADDRESSING
+#include "vtime_hal.h"
+#endif
+#ifndef PC_SIM_SHARED
+#define PC_SIM_SHARED
+#endif
+
+// sleep in real time
+void pcSleep(uint16_t milliseconds);
 
 extern inline void doMsleep(uint16_t milliseconds) {
-    usleep(milliseconds * 1000);
+#if USE_PC_SIM
+    pcSimSleep(milliseconds);
+    return;
+#elif defined USE_ADDRESSING
+    if (pcVirtualTime) {
+        pcVirtualSleep(milliseconds);
+        return;
+    }
+#endif
+    pcSleep(milliseconds);
 }
 
 #endif
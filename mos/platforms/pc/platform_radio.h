@@ -26,16 +26,11 @@
 
 #include <defines.h>
 #include <radio_hal.h>
+#include <cloud_protocol.h>
 
 //===========================================================
 // Data types and constants
 //===========================================================
-enum {
-    PROXY_SERVER_PORT = 6293, // TCP port where sockets subscribe to cloud
-    MAX_PACKET_SIZE = 1024,
-};
-
-typedef uint16_t PcRadioPackSize_t;
 
 #define RADIO_MAX_PACKET     0xffff
 #define RADIO_TX_POWER_MIN        0
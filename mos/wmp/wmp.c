@@ -32,6 +32,7 @@
 #include <sdstream.h>
 #include <eeprom.h>
 #include <timing.h>
+#include <stddef.h>
 
 #define WMP_DEBUG DEBUG
 
@@ -237,6 +238,78 @@ static void writeCsvFileRecord(void)
     numReadSensors = 0;
 }
 
+#if USE_SDCARD_STREAM
+
+#define LOG_LENGTH       sizeof(WmpLogRecord_t)
+#define LOG_TIME_OFFSET  offsetof(WmpLogRecord_t, epoch)
+
+// the logged records are in (epoch, time) order, which makes them
+// searchable even though the time is reset at boot
+static uint16_t logEpoch;
+static uint32_t logLastTime;
+
+static uint32_t logFind(uint16_t epoch, uint32_t time)
+{
+    return sdStreamFindTime(epoch, time, LOG_LENGTH, LOG_TIME_OFFSET);
+}
+
+static uint32_t logEnd(void)
+{
+    return logFind(0xffff, 0xffffffff);
+}
+
+static bool logRead(uint32_t address, WmpLogRecord_t *record)
+{
+    // a blank slot has no epoch
+    return sdStreamReadRecordAt(address, record, LOG_LENGTH, true)
+            && record->epoch != 0;
+}
+
+// address of the first record; older versions logged text lines,
+// which may be stored before it
+static uint32_t logStart(void)
+{
+    WmpLogRecord_t record;
+    uint32_t address = logFind(0, 0);
+    uint32_t end = logEnd();
+    while (address < end && !logRead(address, &record)) {
+        address += LOG_LENGTH;
+    }
+    return address;
+}
+
+static void logWrite(WmpSensor_t *sensor)
+{
+    WmpLogRecord_t record;
+    uint32_t now = getSyncTimeSec();
+
+    if (logEpoch == 0) {
+        // the first write since boot: continue from the last epoch in the log
+        uint32_t start = logStart();
+        uint32_t address = logEnd();
+        logEpoch = 1;
+        while (address > start) {
+            address -= LOG_LENGTH;
+            if (logRead(address, &record)) {
+                logEpoch = record.epoch + 1;
+                break;
+            }
+        }
+    } else if (now < logLastTime) {
+        // e.g. the time was synchronized
+        logEpoch++;
+    }
+    logLastTime = now;
+
+    record.sensor = sensor->code;
+    record.epoch = logEpoch;
+    record.time = now;
+    record.value = sensor->lastReadValue;
+    sdStreamWriteRecord(&record, LOG_LENGTH, true);
+}
+
+#endif // USE_SDCARD_STREAM
+
 void wmpReadSensor(void *sensor_)
 {
     WmpSensor_t *sensor = (WmpSensor_t *) sensor_;
@@ -264,7 +337,8 @@ void wmpReadSensor(void *sensor_)
     // handle output to SD card
     if (wmpSdCardOutputEnabled) {
 #if USE_SDCARD_STREAM
-        sdStreamWriteRecord(buffer, strlen(buffer), false);
+        // fixed-size binary records, so that they can be found by time
+        logWrite(sensor);
 #endif
     }
     // handle output to file 
@@ -578,6 +652,65 @@ static void processFileGet(void)
     wmpSendReply();
 }
 
+// reply with the logged records from the time range [from, to], in log order.
+// The time is reset at boot, so each epoch in the log has its own range.
+// Starts from epoch 'epoch', skipping the first 'skip' records of its range;
+// the reply starts with the epoch and skip to continue from.
+static void processRecordsGet(void)
+{
+#if USE_SDCARD_STREAM
+    uint8_t count = 0;
+    uint32_t from = le32Read(sp.arguments);
+    uint32_t to = le32Read(sp.arguments + 4);
+    uint16_t epoch = sp.argLen >= 10 ? le16Read(sp.arguments + 8) : 0;
+    uint16_t skip = sp.argLen >= 12 ? le16Read(sp.arguments + 10) : 0;
+    const uint8_t maxCount = (sizeof(sp.arguments) - 4) / LOG_LENGTH;
+    uint32_t end = logEnd();
+
+    while (count < maxCount) {
+        WmpLogRecord_t record;
+        uint32_t address = logFind(epoch, from) + (uint32_t) skip * LOG_LENGTH;
+        uint32_t rangeEnd = to == 0xffffffff ? logFind(epoch + 1, 0) : logFind(epoch, to + 1);
+        for (; address < rangeEnd && count < maxCount; address += LOG_LENGTH) {
+            skip++;
+            if (!logRead(address, &record)) continue;
+            memcpy(sp.arguments + 4 + count * LOG_LENGTH, &record, LOG_LENGTH);
+            count++;
+        }
+        if (address < rangeEnd) break;
+
+        // on to the next epoch in the log
+        address = logFind(epoch + 1, 0);
+        if (address >= end) break;
+        epoch = logRead(address, &record) ? record.epoch : epoch + 1;
+        skip = 0;
+    }
+    le16Write(sp.arguments, epoch);
+    le16Write(sp.arguments + 2, skip);
+    sp.argLen = 4 + count * LOG_LENGTH;
+#else
+    sp.argLen = 0;
+#endif
+    wmpSendReply();
+}
+
+// reply with the text log from before the first record, starting from 'offset'
+static void processTextLogGet(void)
+{
+    uint8_t length = 0;
+#if USE_SDCARD_STREAM
+    uint32_t address = SDCARD_RESERVED + le32Read(sp.arguments);
+    uint32_t start = logStart();
+    if (address < start) {
+        length = start - address < sizeof(sp.arguments) ?
+                start - address : sizeof(sp.arguments);
+        if (!sdStreamReadRecordAt(address, sp.arguments, length, false)) length = 0;
+    }
+#endif
+    sp.argLen = length;
+    wmpSendReply();
+}
+
 static void wmpProcessCommand(void)
 {
     DPRINTF("got command %u\n", (uint16_t) sp.command);
@@ -631,6 +764,14 @@ static void wmpProcessCommand(void)
         if (!checkArgLen(1)) return;
         processFileGet();
         break;
+    case WMP_CMD_GET_RECORDS:
+        if (!checkArgLen(8)) return;
+        processRecordsGet();
+        break;
+    case WMP_CMD_GET_TEXT_LOG:
+        if (!checkArgLen(4)) return;
+        processTextLogGet();
+        break;
     case WMP_CMD_SET_DAC:
         if (!checkArgLen(4)) return;
         // TODO
@@ -85,9 +85,23 @@ enum WmpCommandType_e {
     WMP_CMD_SET_DAC,
     //! get DAC channel value
     WMP_CMD_GET_DAC,
+    //! get logged sensor readings from a time range
+    WMP_CMD_GET_RECORDS,
+    //! get the text log written to SD card by older versions
+    WMP_CMD_GET_TEXT_LOG,
 } PACKED;
 typedef enum WmpCommandType_e WmpCommandType_t;
 
+//! A sensor reading as logged to SD card
+struct WmpLogRecord_s {
+    uint16_t sensor;   // WmpSensorType_t
+    uint16_t crc;
+    uint16_t epoch;    // starts from 1, incremented at boot and when the time goes back
+    uint32_t time;     // seconds, synchronized time if available
+    int32_t value;
+} PACKED;
+typedef struct WmpLogRecord_s WmpLogRecord_t;
+
 //! This bit is set in replies to commands
 #define WMP_CMD_REPLY_FLAG  0x80
 
@@ -0,0 +1,305 @@
+/**
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Replay dynamic memory traces against the MansOS allocator (mos/hil/mem.c)
+// and alternatives, and compare their fragmentation and speed.
+//
+// Trace format, one operation per line ('#' starts a comment):
+//     a <id> <size>    allocate size bytes; id names the block
+//     f <id>           free the block
+// Ids are arbitrary tokens, e.g. the pointers in traces recorded on pc
+// with USE_MEMORY_PROFILE=y and MANSOS_MEM_TRACE=<file>.
+//
+// To add an allocator, implement the functions in Allocator_t and
+// append it to the allocators[] table.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+typedef struct Allocator_s {
+    const char *name;
+    void (*init)(void *region, uint16_t size);
+    void *(*alloc)(uint16_t size);
+    void (*free)(void *block);
+    // may be NULL when the allocator cannot tell
+    void (*heapInfo)(uint16_t *freeBlocks, uint16_t *freeBytes,
+            uint16_t *largestFree);
+} Allocator_t;
+
+// mem.c, compiled with different options (see Makefile)
+#define DECLARE_MEM(prefix)                                             \
+    void prefix ## Init(void *region, uint16_t size);                   \
+    void *prefix ## Alloc(uint16_t size);                               \
+    void prefix ## Free(void *block);                                   \
+    void prefix ## HeapInfo(uint16_t *freeBlocks, uint16_t *freeBytes,  \
+            uint16_t *largestFree);
+DECLARE_MEM(heap)
+DECLARE_MEM(pooled)
+
+// libc malloc, as a reference; it does not use the region
+static void libcInit(void *region, uint16_t size) { }
+static void *libcAlloc(uint16_t size) { return malloc(size); }
+static void libcFree(void *block) { free(block); }
+
+static Allocator_t allocators[] = {
+    { "heap", heapInit, heapAlloc, heapFree, heapHeapInfo },
+    { "pools", pooledInit, pooledAlloc, pooledFree, pooledHeapInfo },
+    { "libc", libcInit, libcAlloc, libcFree, NULL },
+};
+#define NUM_ALLOCATORS (sizeof(allocators) / sizeof(*allocators))
+
+typedef struct Op_s {
+    uint32_t block;  // index in the block table
+    uint16_t size;   // zero for free
+} Op_t;
+
+static Op_t *ops;
+static uint32_t numOps, numBlocks;
+
+// ---------------------------------------------------------------
+// trace parsing: ids are mapped to block indexes with a hash table
+
+typedef struct Id_s {
+    char *name;
+    uint32_t block;
+} Id_t;
+
+static Id_t *ids;
+static uint32_t idsSize, idsUsed;
+
+static uint32_t hashString(const char *s)
+{
+    uint32_t h = 5381;
+    while (*s) h = h * 33 + (uint8_t) *s++;
+    return h;
+}
+
+static Id_t *findId(const char *name)
+{
+    uint32_t i = hashString(name) & (idsSize - 1);
+    while (ids[i].name && strcmp(ids[i].name, name)) i = (i + 1) & (idsSize - 1);
+    return &ids[i];
+}
+
+static void growIds(void)
+{
+    Id_t *old = ids;
+    uint32_t i, oldSize = idsSize;
+    idsSize = idsSize ? idsSize * 2 : 1024;
+    ids = calloc(idsSize, sizeof(Id_t));
+    idsUsed = 0;
+    for (i = 0; i < oldSize; ++i) {
+        if (!old[i].name) continue;
+        if (old[i].name[0]) {
+            *findId(old[i].name) = old[i];
+            idsUsed++;
+        } else {
+            free(old[i].name);
+        }
+    }
+    free(old);
+}
+
+static bool readTrace(FILE *f)
+{
+    char line[256], id[128];
+    uint32_t lineNr = 0, maxOps = 0;
+    unsigned size;
+
+    while (fgets(line, sizeof(line), f)) {
+        Op_t op;
+        Id_t *entry;
+        lineNr++;
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        if (sscanf(line, "a %127s %u", id, &size) == 2 && size && size < 0x10000) {
+            if (idsUsed * 2 >= idsSize) growIds();
+            entry = findId(id);
+            if (entry->name) {
+                fprintf(stderr, "line %u: %s allocated twice\n", lineNr, id);
+                return false;
+            }
+            entry->name = strdup(id);
+            // ids are reused after free, blocks are not
+            entry->block = numBlocks++;
+            idsUsed++;
+            op.block = entry->block;
+            op.size = size;
+        } else if (sscanf(line, "f %127s", id) == 1) {
+            if (!idsSize || !(entry = findId(id))->name) {
+                fprintf(stderr, "line %u: %s freed but not allocated\n", lineNr, id);
+                return false;
+            }
+            op.block = entry->block;
+            op.size = 0;
+            // leave a tombstone that matches nothing; dropped when rehashing
+            entry->name[0] = '\0';
+        } else {
+            fprintf(stderr, "line %u: cannot parse\n", lineNr);
+            return false;
+        }
+
+        if (numOps == maxOps) {
+            maxOps = maxOps ? maxOps * 2 : 4096;
+            ops = realloc(ops, maxOps * sizeof(Op_t));
+        }
+        ops[numOps++] = op;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------
+// replay
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void replay(Allocator_t *a, uint16_t regionSize, uint32_t sampleEvery)
+{
+    // allocate as uint32_t, for alignment
+    uint32_t *region = malloc(regionSize + sizeof(uint32_t));
+    void **blocks = calloc(numBlocks, sizeof(void *));
+    uint16_t *sizes = calloc(numBlocks, sizeof(uint16_t));
+    uint64_t allocNs = 0, freeNs = 0, start;
+    uint32_t i, allocs = 0, frees = 0, failed = 0;
+    uint32_t live = 0, maxLive = 0, samples = 0;
+    double fragmentation = 0, maxFragmentation = 0;
+
+    a->init(region, regionSize);
+
+    for (i = 0; i < numOps; ++i) {
+        Op_t *op = &ops[i];
+        if (op->size) {
+            start = nowNs();
+            blocks[op->block] = a->alloc(op->size);
+            allocNs += nowNs() - start;
+            allocs++;
+            if (!blocks[op->block]) {
+                failed++;
+                continue;
+            }
+            sizes[op->block] = op->size;
+            live += op->size;
+            if (live > maxLive) maxLive = live;
+        } else {
+            // frees of failed allocations are skipped
+            if (!blocks[op->block]) continue;
+            start = nowNs();
+            a->free(blocks[op->block]);
+            freeNs += nowNs() - start;
+            frees++;
+            blocks[op->block] = NULL;
+            live -= sizes[op->block];
+        }
+
+        if (a->heapInfo && i % sampleEvery == 0) {
+            // 1 - largest free block / free space, in the heap
+            uint16_t freeBlocks, freeBytes, largestFree;
+            a->heapInfo(&freeBlocks, &freeBytes, &largestFree);
+            double f = freeBytes ? 1.0 - (double) largestFree / freeBytes : 0;
+            fragmentation += f;
+            if (f > maxFragmentation) maxFragmentation = f;
+            samples++;
+        }
+    }
+
+    printf("%-8s %8u %8u %7u %8u %9.1f %9.1f",
+            a->name, allocs, frees, failed, maxLive,
+            allocs ? (double) allocNs / allocs : 0.0,
+            frees ? (double) freeNs / frees : 0.0);
+    if (samples) {
+        printf(" %8.2f %8.2f\n", fragmentation / samples, maxFragmentation);
+    } else {
+        printf(" %8s %8s\n", "-", "-");
+    }
+
+    for (i = 0; i < numBlocks; ++i) {
+        if (blocks[i]) a->free(blocks[i]);
+    }
+    free(sizes);
+    free(blocks);
+    free(region);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s region_size] [-a allocator] [trace]\n"
+            "  -s  size of the memory region in bytes (default: 4096)\n"
+            "  -a  replay only with this allocator:", name);
+    unsigned i;
+    for (i = 0; i < NUM_ALLOCATORS; ++i) fprintf(stderr, " %s", allocators[i].name);
+    fprintf(stderr, "\nThe trace is read from stdin if no file is given\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned regionSize = 4096, i;
+    const char *only = NULL;
+    FILE *f = stdin;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:a:h")) != -1) {
+        switch (c) {
+        case 's':
+            regionSize = atoi(optarg);
+            if (regionSize < 64 || regionSize > 0xffff) usage(argv[0]);
+            break;
+        case 'a':
+            only = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        f = fopen(argv[optind], "r");
+        if (!f) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+    if (!readTrace(f)) return 1;
+
+    printf("%u operations, %u byte region; latency in ns, fragmentation "
+            "sampled every %u operations\n",
+            numOps, regionSize, numOps / 1000 + 1);
+    printf("%-8s %8s %8s %7s %8s %9s %9s %8s %8s\n", "", "allocs", "frees",
+            "failed", "maxlive", "alloc_ns", "free_ns", "avgfrag", "maxfrag");
+    for (i = 0; i < NUM_ALLOCATORS; ++i) {
+        if (only && strcmp(only, allocators[i].name)) continue;
+        replay(&allocators[i], regionSize, numOps / 1000 + 1);
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#!/usr/bin/env python
+
+#
+# Decoder for network trace dumps (see mos/net/net_trace.h).
+# Reads from a serial port or from a file with captured output;
+# any text printed around the dumps is skipped.
+#
+
+import sys
+import struct
+import argparse
+
+MAGIC = b'NT'
+VERSION = 1
+HEADER_FORMAT = '<2sBBHHIIBB'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+RECORD_FORMAT = '<IBBH'
+
+POINTS = ['send', 'rx', 'route', 'enqueue', 'tx-start', 'tx-end', 'deliver']
+ROUTE_DECISIONS = ['drop', 'local', 'unicast', 'broadcast']
+
+
+def pointName(point):
+    if point < len(POINTS):
+        return POINTS[point]
+    return 'point%d' % point
+
+
+def argText(point, arg):
+    if POINTS[point:point + 1] == ['route'] and arg < len(ROUTE_DECISIONS):
+        return ROUTE_DECISIONS[arg]
+    if POINTS[point:point + 1] == ['tx-end']:
+        return 'ok' if arg == 0 else 'error -%d' % arg
+    return str(arg)
+
+
+class Reader(object):
+    def __init__(self, stream):
+        self.stream = stream
+        self.buffer = b''
+
+    def read(self, length):
+        while len(self.buffer) < length:
+            data = self.stream.read(max(1, length - len(self.buffer)))
+            if not data:
+                return None
+            self.buffer += data
+        result = self.buffer[:length]
+        self.buffer = self.buffer[length:]
+        return result
+
+    def findMagic(self):
+        while True:
+            i = self.buffer.find(MAGIC)
+            if i >= 0:
+                self.buffer = self.buffer[i:]
+                return True
+            # keep the last byte in case the magic is split
+            self.buffer = self.buffer[-1:]
+            data = self.stream.read(64)
+            if not data:
+                return False
+            self.buffer += data
+
+
+def readDump(reader):
+    while reader.findMagic():
+        header = reader.read(HEADER_SIZE)
+        if header is None:
+            return None
+        (magic, version, recordSize, address, count, total, now,
+         latencyBuckets, occupancyBuckets) = struct.unpack(HEADER_FORMAT, header)
+        if version != VERSION or recordSize != struct.calcsize(RECORD_FORMAT):
+            # false match in text; skip the magic and look again
+            reader.buffer = header[len(MAGIC):] + reader.buffer
+            continue
+        records = []
+        for i in range(count):
+            data = reader.read(recordSize)
+            if data is None:
+                return None
+            records.append(struct.unpack(RECORD_FORMAT, data))
+        data = reader.read(4 * (latencyBuckets + occupancyBuckets))
+        if data is None:
+            return None
+        histograms = struct.unpack('<%dI' % (latencyBuckets + occupancyBuckets), data)
+        return {
+            'address': address,
+            'total': total,
+            'now': now,
+            'records': records,
+            'latency': histograms[:latencyBuckets],
+            'occupancy': histograms[latencyBuckets:],
+        }
+    return None
+
+
+def printHistogram(title, labels, counts):
+    print(title)
+    top = max(counts) if counts and max(counts) else 1
+    for label, count in zip(labels, counts):
+        print('  %12s %8d %s' % (label, count, '#' * (40 * count // top)))
+
+
+def latencyLabels(count):
+    labels = ['0 ms']
+    for i in range(1, count):
+        if i == count - 1:
+            labels.append('>= %d ms' % (1 << (i - 1)))
+        elif i == 1:
+            labels.append('1 ms')
+        else:
+            labels.append('%d-%d ms' % (1 << (i - 1), (1 << i) - 1))
+    return labels
+
+
+def printStages(records):
+    # time between consecutive tracepoints, by transition
+    stages = {}
+    for prev, cur in zip(records, records[1:]):
+        key = (prev[1], cur[1])
+        delta = (cur[0] - prev[0]) & 0xffffffff
+        stages.setdefault(key, []).append(delta)
+    if not stages:
+        return
+    print('Stage latency (ms):')
+    print('  %-22s %6s %8s %8s' % ('stage', 'count', 'average', 'max'))
+    for key in sorted(stages):
+        deltas = stages[key]
+        name = '%s -> %s' % (pointName(key[0]), pointName(key[1]))
+        print('  %-22s %6d %8.1f %8d' % (name, len(deltas),
+                                         float(sum(deltas)) / len(deltas), max(deltas)))
+
+
+def printDump(dump, verbose):
+    records = dump['records']
+    print('Node 0x%04x at %d ms: %d records (%d lost)' % (
+        dump['address'], dump['now'], len(records), dump['total'] - len(records)))
+    if verbose:
+        for time, point, arg, addr in records:
+            print('  %10d %-9s 0x%04x %s' % (time, pointName(point), addr, argText(point, arg)))
+    printStages(records)
+    printHistogram('Per-hop latency:', latencyLabels(len(dump['latency'])), dump['latency'])
+    printHistogram('Queue occupancy at enqueue:',
+                   ['%d queued' % i for i in range(len(dump['occupancy']))], dump['occupancy'])
+    print('')
+
+
+def openInput(args):
+    if args.file:
+        return open(args.file, 'rb')
+    import serial
+    return serial.Serial(args.serialPort, args.baudRate, timeout=None)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Network trace dump decoder")
+    parser.add_argument("-f", "--file", help="File with captured serial output")
+    parser.add_argument("-s", "--serialPort", default="/dev/ttyUSB0", help="Serial port name")
+    parser.add_argument("-b", "--baudRate", type=int, default=38400, help="Baud rate")
+    parser.add_argument("-v", "--verbose", action="store_true", help="Print every record")
+    args = parser.parse_args()
+
+    reader = Reader(openInput(args))
+    try:
+        while True:
+            dump = readDump(reader)
+            if dump is None:
+                break
+            printDump(dump, args.verbose)
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
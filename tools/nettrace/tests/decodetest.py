@@ -0,0 +1,59 @@
+#!/usr/bin/env python
+
+#
+# Decoder test: a dump made the way mos/net/net_trace.c makes it,
+# with text around it, and records of a successful and a failing send
+#
+
+import os, sys, struct, io
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+
+import nettrace
+
+EAGAIN = 11
+TX_START = nettrace.POINTS.index('tx-start')
+TX_END = nettrace.POINTS.index('tx-end')
+
+
+def record(time, point, arg, addr=0):
+    return struct.pack(nettrace.RECORD_FORMAT, time, point, arg & 0xff, addr)
+
+
+def txEnd(time, ret):
+    # netTraceRadioSendHeader() stores (uint8_t) -ret
+    return record(time, TX_END, -ret)
+
+
+records = [
+    record(100, TX_START, 30),
+    txEnd(102, 0),
+    record(200, TX_START, 30),
+    txEnd(203, -EAGAIN),
+]
+latency = [0] * 4
+occupancy = [0] * 3
+dump = struct.pack(nettrace.HEADER_FORMAT, nettrace.MAGIC, nettrace.VERSION,
+                   struct.calcsize(nettrace.RECORD_FORMAT), 0x1234, len(records),
+                   len(records), 300, len(latency), len(occupancy))
+dump += b''.join(records)
+dump += struct.pack('<%dI' % (len(latency) + len(occupancy)), *(latency + occupancy))
+
+reader = nettrace.Reader(io.BytesIO(b'boot text NT\n' + dump + b'more text\n'))
+result = nettrace.readDump(reader)
+
+failed = 0
+
+
+def check(what, ok):
+    global failed
+    print('%s: %s' % (what, 'OK' if ok else 'FAILED'))
+    if not ok:
+        failed += 1
+
+
+check("dump found", result is not None and result['address'] == 0x1234)
+texts = [nettrace.argText(point, arg) for time, point, arg, addr in result['records']]
+check("successful send", texts[1] == 'ok')
+check("failing send", texts[3] == 'error -%d' % EAGAIN)
+sys.exit(failed)
@@ -0,0 +1,382 @@
+/**
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include "channel.h"
+
+enum {
+    // signal reported by the broadcast model
+    DEFAULT_RSSI = -50,
+    DEFAULT_LQI = 107,
+    // bytes sent on the air besides the packet itself:
+    // preamble (4), start of frame delimiter (1), length (1), CRC (2)
+    PHY_OVERHEAD = 8,
+};
+
+ChannelModel *channelModel;
+
+// ------------------------------------------------------------------
+// Broadcast model
+// ------------------------------------------------------------------
+
+class BroadcastModel : public ChannelModel {
+public:
+    void moteConnected(Worker *w, Client *c) {}
+    void moteDisconnected(Worker *w, Client *c) {}
+    void channelChanged(Worker *w, Client *c) {}
+
+    void transmit(Worker *w, Client *c, Packet *p) {
+        PcCloudHeader_t header;
+        header.type = PC_CLOUD_DATA;
+        header.channel = c->channel;
+        header.rssi = DEFAULT_RSSI;
+        header.lqi = DEFAULT_LQI;
+        deliverBroadcast(w, c, p, &header);
+    }
+};
+
+ChannelModel *broadcastModelCreate()
+{
+    return new BroadcastModel();
+}
+
+// ------------------------------------------------------------------
+// Topology graph model
+// ------------------------------------------------------------------
+
+struct Transmission;
+
+struct Link {
+    Mote *to;
+    double prr;       // packet reception ratio, 0..1
+    int8_t rssi;
+    uint8_t lqi;
+};
+
+// a packet being received by a mote
+struct Reception {
+    Mote *mote;
+    Transmission *tx;
+    int8_t rssi;
+    uint8_t lqi;
+    bool corrupted;   // collided with another packet
+    bool lost;        // lost because of the link quality
+};
+
+struct Transmission {
+    Mote *sender;
+    uint8_t channel;
+    Packet *packet;
+    uint64_t end;
+    std::vector<Reception> receptions;
+};
+
+struct Mote {
+    uint16_t address;
+    std::vector<Link> links;
+
+    // connection state
+    bool connected;
+    int workerNr;
+    unsigned clientId;
+    uint8_t channel;
+
+    uint64_t txEnd;   // the mote is transmitting until this time
+    std::vector<Reception *> receiving;
+};
+
+class GraphModel : public ChannelModel {
+public:
+    GraphModel(unsigned bitrate, unsigned seed)
+        : bitrate(bitrate), random(seed),
+          delivered(0), collided(0), lost(0) {
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    bool load(const char *fileName);
+
+    void moteConnected(Worker *w, Client *c);
+    void moteDisconnected(Worker *w, Client *c);
+    void channelChanged(Worker *w, Client *c);
+    void transmit(Worker *w, Client *c, Packet *p);
+    void timerExpired(Worker *w, void *arg);
+
+private:
+    Mote *findMote(uint16_t address);
+
+    // protects all motes and transmissions
+    pthread_mutex_t mutex;
+    std::unordered_map<uint16_t, Mote *> motes;
+    unsigned bitrate;
+    std::mt19937 random;
+    std::uniform_real_distribution<double> uniform;
+
+    unsigned long delivered;
+    unsigned long collided;
+    unsigned long lost;
+};
+
+ChannelModel *graphModelCreate(const char *topologyFile,
+        unsigned bitrate, unsigned seed)
+{
+    GraphModel *m = new GraphModel(bitrate, seed);
+    if (!m->load(topologyFile)) {
+        delete m;
+        return NULL;
+    }
+    return m;
+}
+
+Mote *GraphModel::findMote(uint16_t address)
+{
+    std::unordered_map<uint16_t, Mote *>::iterator it = motes.find(address);
+    if (it != motes.end()) return it->second;
+    Mote *m = new Mote();
+    m->address = address;
+    motes[address] = m;
+    return m;
+}
+
+//
+// Topology file format: one directed link per line,
+//     <from> <to> <prr> [<rssi> [<lqi>]]
+// Addresses may be decimal or hex (0x...). Lines starting with '#' are
+// ignored. A mote hears only those motes that have a link to it.
+//
+bool GraphModel::load(const char *fileName)
+{
+    FILE *f = fopen(fileName, "r");
+    if (!f) {
+        printf("cannot open topology file %s\n", fileName);
+        return false;
+    }
+    char line[256];
+    unsigned lineNr = 0;
+    unsigned linkCount = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNr++;
+        char from[32], to[32];
+        double prr;
+        int rssi = DEFAULT_RSSI, lqi = DEFAULT_LQI;
+        char *s = line;
+        while (*s == ' ' || *s == '\t') s++;
+        if (*s == '#' || *s == '\n' || *s == '\r' || !*s) continue;
+        if (sscanf(s, "%31s %31s %lf %i %i", from, to, &prr, &rssi, &lqi) < 3
+                || prr < 0.0 || prr > 1.0) {
+            printf("%s:%u: invalid link\n", fileName, lineNr);
+            fclose(f);
+            return false;
+        }
+        Link link;
+        link.to = findMote(strtol(to, NULL, 0));
+        link.prr = prr;
+        link.rssi = rssi;
+        link.lqi = lqi;
+        findMote(strtol(from, NULL, 0))->links.push_back(link);
+        linkCount++;
+    }
+    fclose(f);
+    printf("topology loaded: %u motes, %u links\n",
+            (unsigned) motes.size(), linkCount);
+    return true;
+}
+
+void GraphModel::moteConnected(Worker *w, Client *c)
+{
+    pthread_mutex_lock(&mutex);
+    if (motes.find(c->address) == motes.end()) {
+        printf("mote 0x%04x is not in the topology, it will hear nothing\n",
+                c->address);
+    }
+    Mote *m = findMote(c->address);
+    if (m->connected) {
+        printf("mote 0x%04x connected twice, using the last connection\n",
+                c->address);
+    }
+    m->connected = true;
+    m->workerNr = w->nr;
+    m->clientId = c->id;
+    m->channel = c->channel;
+    c->mote = m;
+    pthread_mutex_unlock(&mutex);
+}
+
+void GraphModel::moteDisconnected(Worker *w, Client *c)
+{
+    pthread_mutex_lock(&mutex);
+    Mote *m = c->mote;
+    if (m->clientId == c->id) m->connected = false;
+    c->mote = NULL;
+    pthread_mutex_unlock(&mutex);
+}
+
+void GraphModel::channelChanged(Worker *w, Client *c)
+{
+    pthread_mutex_lock(&mutex);
+    Mote *m = c->mote;
+    if (m->clientId == c->id) {
+        m->channel = c->channel;
+        // the radio stops receiving what it was receiving on the old channel
+        for (size_t i = 0; i < m->receiving.size(); ++i) {
+            m->receiving[i]->corrupted = true;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void GraphModel::transmit(Worker *w, Client *c, Packet *p)
+{
+    struct Carrier {
+        int workerNr;
+        unsigned clientId;
+        int8_t rssi;
+    };
+    std::vector<Carrier> carriers;
+
+    uint64_t now = nowUs();
+    uint32_t duration = (uint64_t) (p->length + PHY_OVERHEAD) * 8
+            * 1000000 / bitrate;
+
+    Transmission *t = new Transmission();
+    t->channel = c->channel;
+    t->packet = p;
+    t->end = now + duration;
+    p->refCount.fetch_add(1, std::memory_order_relaxed);
+
+    pthread_mutex_lock(&mutex);
+    Mote *m = c->mote;
+    t->sender = m;
+
+    // the radio is half duplex: stop receiving while transmitting
+    for (size_t i = 0; i < m->receiving.size(); ++i) {
+        m->receiving[i]->corrupted = true;
+    }
+    m->txEnd = t->end;
+
+    t->receptions.reserve(m->links.size());
+    for (size_t i = 0; i < m->links.size(); ++i) {
+        Link *l = &m->links[i];
+        Mote *rx = l->to;
+        if (!rx->connected || rx->channel != t->channel) continue;
+
+        Reception r;
+        r.mote = rx;
+        r.tx = t;
+        r.rssi = l->rssi;
+        r.lqi = l->lqi;
+        r.corrupted = rx->txEnd > now;
+        r.lost = uniform(random) >= l->prr;
+        // overlapping packets destroy each other
+        for (size_t j = 0; j < rx->receiving.size(); ++j) {
+            if (rx->receiving[j]->tx->end > now) {
+                rx->receiving[j]->corrupted = true;
+                r.corrupted = true;
+            }
+        }
+        t->receptions.push_back(r);
+
+        Carrier carrier = { rx->workerNr, rx->clientId, l->rssi };
+        carriers.push_back(carrier);
+    }
+    // the vector is not resized anymore, pointers to elements are stable
+    for (size_t i = 0; i < t->receptions.size(); ++i) {
+        t->receptions[i].mote->receiving.push_back(&t->receptions[i]);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    // let the neighbors know that the channel is busy
+    if (!carriers.empty()) {
+        Packet *cp = packetAlloc(w, &duration, sizeof(duration));
+        if (cp) {
+            PcCloudHeader_t header;
+            header.type = PC_CLOUD_CARRIER;
+            header.channel = t->channel;
+            header.lqi = 0;
+            for (size_t i = 0; i < carriers.size(); ++i) {
+                header.rssi = carriers[i].rssi;
+                deliverToClient(w, carriers[i].workerNr, carriers[i].clientId,
+                        cp, &header);
+            }
+            packetRelease(w, cp);
+        }
+    }
+
+    // the packet is received when the transmission ends
+    workerAddTimer(w, t->end, t);
+}
+
+void GraphModel::timerExpired(Worker *w, void *arg)
+{
+    Transmission *t = (Transmission *) arg;
+    struct Delivery {
+        int workerNr;
+        unsigned clientId;
+        int8_t rssi;
+        uint8_t lqi;
+    };
+    std::vector<Delivery> deliveries;
+
+    pthread_mutex_lock(&mutex);
+    for (size_t i = 0; i < t->receptions.size(); ++i) {
+        Reception *r = &t->receptions[i];
+        Mote *rx = r->mote;
+        for (size_t j = 0; j < rx->receiving.size(); ++j) {
+            if (rx->receiving[j] == r) {
+                rx->receiving[j] = rx->receiving.back();
+                rx->receiving.pop_back();
+                break;
+            }
+        }
+        if (r->corrupted) {
+            collided++;
+        } else if (r->lost) {
+            lost++;
+        } else if (rx->connected && rx->channel == t->channel) {
+            Delivery d = { rx->workerNr, rx->clientId, r->rssi, r->lqi };
+            deliveries.push_back(d);
+            delivered++;
+        }
+    }
+    if (verbose) {
+        printf("0x%04x: %u byte(s) on channel %u, %u receiver(s) "
+                "(total: %lu delivered, %lu collided, %lu lost)\n",
+                t->sender->address, t->packet->length, t->channel,
+                (unsigned) deliveries.size(), delivered, collided, lost);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    PcCloudHeader_t header;
+    header.type = PC_CLOUD_DATA;
+    header.channel = t->channel;
+    for (size_t i = 0; i < deliveries.size(); ++i) {
+        header.rssi = deliveries[i].rssi;
+        header.lqi = deliveries[i].lqi;
+        deliverToClient(w, deliveries[i].workerNr, deliveries[i].clientId,
+                t->packet, &header);
+    }
+    packetRelease(w, t->packet);
+    delete t;
+}
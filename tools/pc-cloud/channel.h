@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PC_CLOUD_CHANNEL_H
+#define PC_CLOUD_CHANNEL_H
+
+//
+// Radio channel models: decide which motes receive a transmitted packet,
+// when, and with what signal strength.
+//
+// All methods are called from worker threads, concurrently.
+//
+
+#include "cloud.h"
+
+class ChannelModel {
+public:
+    virtual ~ChannelModel() {}
+
+    // the client has introduced itself (c->address and c->channel are set)
+    virtual void moteConnected(Worker *w, Client *c) = 0;
+    virtual void moteDisconnected(Worker *w, Client *c) = 0;
+    // c->channel has been changed
+    virtual void channelChanged(Worker *w, Client *c) = 0;
+    // the client has sent a radio packet on c->channel
+    virtual void transmit(Worker *w, Client *c, Packet *p) = 0;
+    // a timer, added with workerAddTimer(), has expired
+    virtual void timerExpired(Worker *w, void *arg) {}
+};
+
+// Every mote hears every packet sent on its channel immediately,
+// without losses or collisions
+ChannelModel *broadcastModelCreate();
+
+// Motes hear only their neighbors, as given in the topology file.
+// Packets take time on the air, may be lost (as given by link PRR),
+// and collide when overlapping at a receiver.
+// Return NULL if the file cannot be loaded.
+ChannelModel *graphModelCreate(const char *topologyFile,
+        unsigned bitrate, unsigned seed);
+
+extern ChannelModel *channelModel;
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * Copyright (c) 2013 the MansOS team. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of  conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PC_CLOUD_H
+#define PC_CLOUD_H
+
+//
+// pc-cloud internal data structures, shared by the relay (main.cpp)
+// and the radio channel models (channel.cpp)
+//
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <queue>
+#include <vector>
+#include <unordered_map>
+#include "cloud_protocol.h"
+#include "shm_ring.h"
+
+enum {
+    MAX_WORKERS = 64,
+    // max packets queued for a single client
+    CLIENT_QUEUE_LENGTH = 1024,
+    // max bytes queued for a single client; further packets are dropped
+    MAX_CLIENT_BACKLOG = 64 * 1024,
+    // max packets in flight from one worker to another
+    SHARD_QUEUE_LENGTH = 4096,
+    // max packets passed to a single writev() call
+    MAX_IOV_COUNT = 64,
+    // max events returned by a single epoll_wait() call
+    MAX_EVENTS = 256,
+    // read() chunk size; several packets may arrive at once
+    RECV_BUFFER_SIZE = 16 * 1024,
+    // largest possible frame on the wire
+    MAX_FRAME_SIZE = sizeof(PcRadioPackSize_t) + MAX_PACKET_SIZE,
+    // length prefix and header of a frame
+    FRAME_HEAD_SIZE = sizeof(PcRadioPackSize_t) + sizeof(PcCloudHeader_t),
+    // unused packet buffers kept by each worker
+    PACKET_POOL_SIZE = 4096,
+};
+
+// Frame payload, shared between send queues of all clients it is
+// forwarded to. The frame header is kept separately for each receiver.
+struct Packet {
+    std::atomic<unsigned> refCount;
+    unsigned length;
+    unsigned char data[MAX_PACKET_SIZE];
+};
+
+// An entry in a client's send queue: a frame exactly as it goes
+// on the wire is head[] followed by packet->data
+struct QueueEntry {
+    Packet *packet;
+    unsigned char head[FRAME_HEAD_SIZE];
+};
+
+struct Mote;
+
+struct Client {
+    int fd;           // TCP socket, or Unix socket for shared memory clients
+    unsigned id;      // unique, never reused
+    int index;        // position in the owner worker's client array
+    bool dirty;       // has data to send, is in the worker's dirty list
+    bool closed;      // closed, will be freed at the end of the loop pass
+
+    // mote properties, known after it has sent PC_CLOUD_HELLO
+    bool introduced;
+    uint16_t address;
+    uint8_t channel;
+    Mote *mote;       // channel model state, if any
+
+    // virtual time state (simulation mode only)
+    bool idle;        // has sent PC_CLOUD_IDLE, waits for PC_CLOUD_RUN
+    bool runPending;  // is in the worker's run list
+    uint64_t wakeup;  // time requested in the last PC_CLOUD_IDLE
+    uint64_t clock;   // last time sent in PC_CLOUD_CLOCK
+
+    // shared memory transport (see shm_ring.h), NULL for TCP clients
+    PcShmRegion_t *shm;
+    int bellFd;       // rung by the mote
+    int moteBellFd;   // rung by the cloud
+
+    // partially received frame
+    unsigned char rxBuf[MAX_FRAME_SIZE];
+    unsigned rxLen;
+
+    // send queue (ring buffer of packet references)
+    QueueEntry txQueue[CLIENT_QUEUE_LENGTH];
+    unsigned txHead;
+    unsigned txCount;
+    unsigned txOffset; // bytes of the first frame already written
+    unsigned txBytes;  // bytes waiting in the queue (backpressure accounting)
+
+    unsigned long packetsReceived;
+    unsigned long packetsSent;
+    unsigned long packetsDropped;
+};
+
+// A connection accepted by the main thread, to be added to a worker
+struct NewClient {
+    int fd;
+    PcShmRegion_t *shm;
+    int bellFd;
+    int moteBellFd;
+};
+
+// A packet passed from one worker to another
+struct ShardItem {
+    Packet *packet;
+    unsigned clientId;  // receiver; 0 means all clients on the channel
+    unsigned originId;  // sender, not to be delivered to
+    PcCloudHeader_t header;
+};
+
+// Lock-free queue of packets from one worker to another
+struct ShardQueue {
+    alignas(64) std::atomic<unsigned> head; // written by the consumer
+    alignas(64) std::atomic<unsigned> tail; // written by the producer
+    ShardItem ring[SHARD_QUEUE_LENGTH];
+};
+
+struct Timer {
+    uint64_t time;    // microseconds, see nowUs()
+    void *arg;
+    bool operator>(const Timer &other) const { return time > other.time; }
+};
+
+// A mote waiting for its wakeup time (simulation mode only)
+struct Wakeup {
+    uint64_t time;
+    unsigned clientId;
+    bool operator>(const Wakeup &other) const { return time > other.time; }
+};
+
+// A radio packet sent during the current simulation step
+struct SimTransmission {
+    uint16_t address;
+    unsigned clientId;
+    Packet *packet;
+    bool operator<(const SimTransmission &other) const {
+        return address < other.address;
+    }
+};
+
+struct Worker {
+    int nr;
+    pthread_t thread;
+    int epollFd;
+    int wakeFd;   // eventfd, used to signal the worker from other threads
+    std::atomic<bool> wakePending;
+    int timerFd;  // armed to the earliest of timers
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers;
+
+    // clients owned by this worker
+    Client **clients;
+    int clientCount;
+    int clientCapacity;
+    std::atomic<int> activeClients; // read by other workers
+    std::unordered_map<unsigned, Client *> clientMap; // by id
+
+    // clients with pending output / closed during the current pass
+    Client **dirty;
+    int dirtyCount;
+    Client **closedList;
+    int closedCount;
+
+    // inbox[i] holds packets sent by worker i to this worker
+    ShardQueue *inbox[MAX_WORKERS];
+    // workers that have to be woken up after the current pass
+    bool notify[MAX_WORKERS];
+
+    // new connections passed by the acceptor thread
+    pthread_mutex_t newClientMutex;
+    NewClient *newClients;
+    int newClientCount;
+    int newClientCapacity;
+
+    // unused packet buffers are kept here instead of being freed
+    Packet *packetPool[PACKET_POOL_SIZE];
+    unsigned packetPoolCount;
+
+    unsigned long shardDropped;
+
+    // virtual time (simulation mode only)
+    int simRunning;   // introduced motes that have not gone idle yet
+    std::vector<unsigned> simRunList; // motes to run at the current time
+    std::priority_queue<Wakeup, std::vector<Wakeup>, std::greater<Wakeup> > simWakeups;
+    std::vector<SimTransmission> simTransmissions;
+};
+
+extern Worker *workers[MAX_WORKERS];
+extern int workerCount;
+extern bool verbose;
+// virtual time is used; there is a single worker then
+extern bool simulation;
+
+// monotonic (or virtual, in simulation mode) time in microseconds
+uint64_t nowUs();
+
+Packet *packetAlloc(Worker *w, const void *payload, unsigned len);
+void packetRelease(Worker *w, Packet *p);
+
+// queue the packet to a single client, owned by worker nr. workerNr
+void deliverToClient(Worker *w, int workerNr, unsigned clientId,
+        Packet *p, const PcCloudHeader_t *header);
+// queue the packet to all clients on header->channel, except originator
+void deliverBroadcast(Worker *w, Client *originator,
+        Packet *p, const PcCloudHeader_t *header);
+
+// call channelModel->timerExpired(w, arg) at the given time
+void workerAddTimer(Worker *w, uint64_t time, void *arg);
+
+#endif
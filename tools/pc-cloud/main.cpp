@@ -21,98 +21,206 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+//
+// pc-cloud: relays radio packets between "pc" platform motes.
+//
+// Every mote is connected with a TCP socket. The incoming byte stream
+// is split in PcRadioPackSize_t-framed packets; each complete packet is
+// stored once in a reference-counted buffer and queued to the clients
+// that receive it. Each client has its own send queue, so a slow client only
+// loses its own packets (when its backlog is full) and never stalls the
+// others.
+//
+// Clients are sharded between worker threads. Each worker owns its
+// clients and runs an edge-triggered epoll loop over them. A packet
+// received by one worker is passed to the other workers through
+// lock-free single-producer/single-consumer queues (one per ordered
+// worker pair); the main thread only accepts new connections.
+//
+// Motes on the same machine may instead connect to the Unix socket
+// PC_CLOUD_SHM_PATH and pass a shared memory region with two frame rings
+// (see shm_ring.h). The worker then reads and writes frames in place,
+// and system calls are only needed to wake up a side that sleeps.
+//
+// Which motes receive a packet is decided by the channel model
+// (see channel.h); by default all motes on the same radio channel do.
+//
+// In simulation mode ("-s") the cloud also keeps the virtual time of the
+// motes. A mote runs until it goes to sleep and tells until when
+// (PC_CLOUD_IDLE); when all motes are idle, the clock is advanced to the
+// next wakeup or channel model timer, and the motes concerned are told
+// to run (PC_CLOUD_CLOCK, PC_CLOUD_RUN). Packets sent in the same step
+// are passed to the channel model in the order of mote addresses, so that
+// a simulation with the same random seed is repeatable. There is a single
+// worker thread in this mode.
+//
+
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <arpa/inet.h>
-#include "radio_hal.h"
-
-enum {
-    MAX_CONN_COUNT = 128,
-    QUEUE_SIZE = 128 * 1024 // 128K
-};
+#include <algorithm>
+#include "cloud.h"
+#include "channel.h"
 
-pollfd fds[MAX_CONN_COUNT]; // polled sockets. listening socket as 0th
-int fdCount = 0;
+Worker *workers[MAX_WORKERS];
+int workerCount;
 int listenSock = 0;
-
-// ring-buffer, where received data is stored in
-unsigned char queue[QUEUE_SIZE];
-int queuePos; // position of last stored byte in the queue
-// each socket has position of last sent byte in queue
-int pos[MAX_CONN_COUNT];
+int shmListenSock = -1;
+bool verbose = false;
+bool simulation = false;
+// current virtual time (simulation mode only)
+static uint64_t simNow;
+// motes to wait for before the simulation is started
+static int simMoteCount;
+std::atomic<unsigned> nextClientId(1); // 0 is reserved
+// epoll tag of the timer descriptor (NULL is the wakeup eventfd)
+static char timerTag;
 
 int createListenSock(int port);
-void newClientConnected();
+int createShmListenSock();
+void newClientConnected(int nextWorker);
+void newShmClientConnected(int nextWorker);
+void passNewClient(int nextWorker, const NewClient *nc);
+void raiseFileLimit();
+
+Worker *workerCreate(int nr);
+void *workerThread(void *);
+void workerAddClients(Worker *w);
+void workerDrainInbox(Worker *w);
+void workerWakeUp(Worker *w);
+void workerFlush(Worker *w);
+void workerProcessTimers(Worker *w);
 
-// return:
-//  0 = nothing read, but no error
-// -1 = error or socket closed
-//  n = n bytes received (n > 0)
-int receiveData(int sockNr);
+// advance virtual time when all motes are idle (simulation mode only)
+void simulationStep(Worker *w);
+void simulationRun(Worker *w, Client *c);
+void simulationSendClock(Worker *w, Client *c);
 
-void sendData(int sockNr);
+// return -1 if the client was closed, 0 otherwise
+int receiveData(Worker *w, Client *c);
+int sendData(Worker *w, Client *c);
+int receiveShm(Worker *w, Client *c);
+int sendShm(Worker *w, Client *c);
+int processFrame(Worker *w, Client *c, const unsigned char *frame,
+        PcRadioPackSize_t len);
 
-void closeSocket(int sockNr);
+void closeClient(Worker *w, Client *c);
+void markDirty(Worker *w, Client *c);
 
-// set POLLOUT flag for all sockets except originator
-void kickOthers(int originatorSock);
+// queue the packet to local clients on header->channel, except originator
+void broadcastLocal(Worker *w, unsigned originatorId, Packet *p,
+        const PcCloudHeader_t *header);
+bool clientEnqueue(Worker *w, Client *c, Packet *p,
+        const PcCloudHeader_t *header);
+bool shardEnqueue(Worker *w, Worker *to, const ShardItem *item);
 
-int main()
+int main(int argc, char *argv[])
 {
+    const char *topologyFile = NULL;
+    unsigned bitrate = 250000;
+    unsigned seed = time(NULL);
+
+    workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            topologyFile = argv[++i];
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            bitrate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            seed = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s")) {
+            simulation = true;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            simMoteCount = atoi(argv[++i]);
+        } else {
+            printf("usage: %s [-v] [-s [-n <mote count>]] [-t <worker thread count>]\n"
+                    "    [-m <topology file> [-b <bitrate>] [-r <seed>]]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+    if (workerCount < 1) workerCount = 1;
+    if (workerCount > MAX_WORKERS) workerCount = MAX_WORKERS;
+    if (simulation) {
+        // the scheduler needs to see all motes
+        workerCount = 1;
+        printf("using virtual time\n");
+    }
+    if (bitrate == 0) bitrate = 250000;
+
+    if (topologyFile) {
+        channelModel = graphModelCreate(topologyFile, bitrate, seed);
+        if (!channelModel) return -1;
+        printf("using topology %s, bitrate %u, random seed %u\n",
+                topologyFile, bitrate, seed);
+    } else {
+        channelModel = broadcastModelCreate();
+    }
+
+    raiseFileLimit();
+
     listenSock = createListenSock(PROXY_SERVER_PORT);
     if (listenSock <= 0) return listenSock;
+    // optional: TCP works without it
+    shmListenSock = createShmListenSock();
 
-    fds[0].fd = listenSock;
-    fds[0].events = POLLIN;
-    fdCount = 1;
-
-    // reset queue
-    queuePos = -1;
+    for (int i = 0; i < workerCount; ++i) {
+        workers[i] = workerCreate(i);
+        if (!workers[i]) return -1;
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        for (int j = 0; j < workerCount; ++j) {
+            if (i == j) continue;
+            workers[i]->inbox[j] = new ShardQueue();
+        }
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        pthread_create(&workers[i]->thread, NULL, workerThread, workers[i]);
+    }
+    printf("%i worker thread(s) started\n", workerCount);
 
-    while (1)
-    {
-        // poll return value:
-        // 0  = means timeout (should not happen)
-        // -1 = error
-        // > 0 = count of sockets ready
-        //printf("polling %i sockets\n", fdCount);
-        int p = poll(fds, fdCount, -1);
-        if (p > 0)
-        {
-            // some sockets ready
-            //printf("some sockets ready\n");
-            if (fds[0].revents && fdCount < MAX_CONN_COUNT)
-            {
-                //printf("listenSock.revents = %i\n", fds[0].revents);
-                newClientConnected();
+    // accept new clients and distribute them between the workers
+    int nextWorker = 0;
+    pollfd pfd[2];
+    pfd[0].fd = listenSock;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = shmListenSock; // ignored by poll() if negative
+    pfd[1].events = POLLIN;
+    while (1) {
+        int p = poll(pfd, 2, -1);
+        if (p > 0) {
+            if (pfd[0].revents) {
+                newClientConnected(nextWorker);
+                nextWorker = (nextWorker + 1) % workerCount;
             }
-
-            for (int i = 1; i < fdCount; ++i)
-            {
-                if (fds[i].revents & POLLIN) {
-                    int r = receiveData(i);
-                    // something happened to this socket, it is now replaced
-                    // with last socket in fds array (if any) which has
-                    // to be checked
-                    if (r <= 0) --i;
-                }
-                if (fds[i].revents & POLLOUT) sendData(i);
+            if (pfd[1].revents) {
+                newShmClientConnected(nextWorker);
+                nextWorker = (nextWorker + 1) % workerCount;
             }
-
-        } else if (p < 0) {
-            // error
+        } else if (p < 0 && errno != EINTR) {
             printf("polling error: %s\n", strerror(errno));
             return -1;
-        } else {
-            // timeout - should not happen
-            printf("timeout? :O\n");
         }
     }
 
@@ -156,7 +264,7 @@ int createListenSock(int port)
     } else {
         printf("socket bound to port %i\n", port);
     }
-    if (listen(sock, MAX_CONN_COUNT))
+    if (listen(sock, SOMAXCONN))
     {
         printf("cannot start listening: %s\n", strerror(errno));
         return -1;
@@ -166,117 +274,940 @@ int createListenSock(int port)
     return sock;
 }
 
-void newClientConnected()
+int createShmListenSock()
+{
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        printf("cannot create shared memory socket: %s\n", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, PC_CLOUD_SHM_PATH, sizeof(addr.sun_path) - 1);
+    // left over if the cloud crashed
+    unlink(PC_CLOUD_SHM_PATH);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+            || listen(sock, SOMAXCONN) < 0
+            || fcntl(sock, F_SETFL, O_NONBLOCK) == -1) {
+        printf("cannot listen on %s: %s\n", PC_CLOUD_SHM_PATH,
+                strerror(errno));
+        close(sock);
+        return -1;
+    }
+    printf("listening for shared memory clients on %s\n", PC_CLOUD_SHM_PATH);
+    return sock;
+}
+
+// each mote takes a file descriptor; allow as many as the system permits
+void raiseFileLimit()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+void newClientConnected(int nextWorker)
 {
     // new connection started
-    //printf("new connection, accepting...\n");
     struct sockaddr_in clientAddr;
     socklen_t sinSize = sizeof(clientAddr);
     int clientSock = accept(listenSock, (struct sockaddr *) &clientAddr,
             &sinSize);
     if (clientSock <= 0) {
-        printf("cannot accept client socket: %s\n", strerror(errno));
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("cannot accept client socket: %s\n", strerror(errno));
+        }
+        return;
+    }
+    // a client must never block the relay
+    if (fcntl(clientSock, F_SETFL, O_NONBLOCK) == -1) {
+        printf("cannot make client socket non blocking: %s\n",
+                strerror(errno));
+        close(clientSock);
         return;
-    } else {
-        //printf("socket %i accepted\n", clientSock);
     }
-    int clientNr = fdCount++;
-    pollfd *newConn = &fds[clientNr];
-    newConn->fd = clientSock;
-    if (newConn->fd)
-    newConn->events = POLLIN;
-    newConn->revents = 0;
+    // radio packets are small; do not wait to coalesce them
+    int on = 1;
+    setsockopt(clientSock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    NewClient nc = { clientSock, NULL, -1, -1 };
+    passNewClient(nextWorker, &nc);
 
-    printf("connected client from %s, stored as %i\n",
-            inet_ntoa(clientAddr.sin_addr), clientNr);
+    printf("connected client from %s, passed to worker %i\n",
+            inet_ntoa(clientAddr.sin_addr), nextWorker);
 }
 
-// return:
-//  0 = nothing read, but no error
-// -1 = error or socket closed
-//  n = n bytes received (n > 0)
-int receiveData(int sockNr)
+void newShmClientConnected(int nextWorker)
 {
-    int buffStart = (queuePos == QUEUE_SIZE - 1) ? 0 : queuePos + 1;
-    int buffLen = QUEUE_SIZE - buffStart;
-//    printf("receiveData(%i), buffStart = %i, buffLen = %i\n",
-//            sockNr, buffStart, buffLen);
-    int r = read(fds[sockNr].fd, &queue[buffStart], buffLen);
-    if (r >= 1) {
-        kickOthers(sockNr);
-        queuePos = (queuePos + r) % QUEUE_SIZE;
-        //printf("%i bytes received, queuePos = %i\n", r, queuePos);
-        printf("[%i]>> %i byte(s)\n", sockNr, r);
-        return r;
-    } else if (r == 0) {
-        // socket closed on the remote end, close it here also
-        closeSocket(sockNr);
-        return -1;
-    } else if (errno == EAGAIN) {
-        printf("cannot read now, will try again later: %s\n", strerror(errno));
-        return 0;
-    } else {
-        printf("error while reading socket: %s\n", strerror(errno));
-        closeSocket(sockNr);
+    int clientSock = accept(shmListenSock, NULL, NULL);
+    if (clientSock < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("cannot accept shared memory client: %s\n",
+                    strerror(errno));
+        }
+        return;
+    }
+
+    // the mote sends the region and the doorbells right after connecting
+    int fds[3] = { -1, -1, -1 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    char dummy;
+    struct iovec iov = { &dummy, sizeof(dummy) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    pollfd pfd = { clientSock, POLLIN, 0 };
+    if (poll(&pfd, 1, 1000) > 0 && recvmsg(clientSock, &msg, 0) > 0) {
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_type == SCM_RIGHTS
+                && cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+    }
+    void *region = MAP_FAILED;
+    if (fds[0] >= 0) {
+        region = mmap(NULL, sizeof(PcShmRegion_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fds[0], 0);
+        close(fds[0]);
+    }
+    if (region == MAP_FAILED || fds[1] < 0 || fds[2] < 0) {
+        printf("invalid shared memory client\n");
+        if (fds[1] >= 0) close(fds[1]);
+        if (fds[2] >= 0) close(fds[2]);
+        close(clientSock);
+        return;
+    }
+    fcntl(clientSock, F_SETFL, O_NONBLOCK);
+    fcntl(fds[2], F_SETFL, O_NONBLOCK);
+
+    NewClient nc = { clientSock, (PcShmRegion_t *) region, fds[2], fds[1] };
+    passNewClient(nextWorker, &nc);
+
+    printf("connected shared memory client, passed to worker %i\n",
+            nextWorker);
+}
+
+void passNewClient(int nextWorker, const NewClient *nc)
+{
+    Worker *w = workers[nextWorker];
+    pthread_mutex_lock(&w->newClientMutex);
+    if (w->newClientCount == w->newClientCapacity) {
+        w->newClientCapacity = w->newClientCapacity
+                ? w->newClientCapacity * 2 : 16;
+        w->newClients = (NewClient *) realloc(w->newClients,
+                w->newClientCapacity * sizeof(NewClient));
+    }
+    w->newClients[w->newClientCount++] = *nc;
+    pthread_mutex_unlock(&w->newClientMutex);
+    workerWakeUp(w);
+}
+
+Worker *workerCreate(int nr)
+{
+    Worker *w = new Worker();
+    w->nr = nr;
+    w->epollFd = epoll_create1(0);
+    w->wakeFd = eventfd(0, EFD_NONBLOCK);
+    w->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (w->epollFd < 0 || w->wakeFd < 0 || w->timerFd < 0) {
+        printf("cannot create worker %i: %s\n", nr, strerror(errno));
+        return NULL;
+    }
+    pthread_mutex_init(&w->newClientMutex, NULL);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; // NULL means the wakeup eventfd
+    epoll_ctl(w->epollFd, EPOLL_CTL_ADD, w->wakeFd, &ev);
+    ev.data.ptr = &timerTag;
+    epoll_ctl(w->epollFd, EPOLL_CTL_ADD, w->timerFd, &ev);
+    return w;
+}
+
+void *workerThread(void *arg)
+{
+    Worker *w = (Worker *) arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(w->epollFd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            printf("worker %i: epoll error: %s\n", w->nr, strerror(errno));
+            return NULL;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            Client *c = (Client *) events[i].data.ptr;
+            if (!c) {
+                uint64_t value;
+                while (read(w->wakeFd, &value, sizeof(value)) > 0);
+                w->wakePending = false;
+                workerAddClients(w);
+                continue;
+            }
+            if ((void *) c == &timerTag) {
+                workerProcessTimers(w);
+                continue;
+            }
+            if (c->closed) continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                if (receiveData(w, c) < 0) continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                sendData(w, c);
+            }
+        }
+
+        // packets from other workers
+        workerDrainInbox(w);
+
+        if (simulation) simulationStep(w);
+
+        workerFlush(w);
+
+        for (int i = 0; i < w->closedCount; ++i) {
+            free(w->closedList[i]);
+        }
+        w->closedCount = 0;
+
+        // let other workers know there are packets for them
+        for (int i = 0; i < workerCount; ++i) {
+            if (w->notify[i]) {
+                w->notify[i] = false;
+                workerWakeUp(workers[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+// flush send queues of all clients that got new data
+void workerFlush(Worker *w)
+{
+    for (int i = 0; i < w->dirtyCount; ++i) {
+        Client *c = w->dirty[i];
+        c->dirty = false;
+        if (!c->closed) sendData(w, c);
+    }
+    w->dirtyCount = 0;
+}
+
+void workerWakeUp(Worker *w)
+{
+    // write to the eventfd only once until the worker wakes up
+    if (!w->wakePending.exchange(true)) {
+        uint64_t one = 1;
+        if (write(w->wakeFd, &one, sizeof(one)) < 0) {
+            printf("cannot wake up worker %i: %s\n", w->nr, strerror(errno));
+        }
+    }
+}
+
+void workerAddClients(Worker *w)
+{
+    pthread_mutex_lock(&w->newClientMutex);
+    for (int i = 0; i < w->newClientCount; ++i) {
+        const NewClient *nc = &w->newClients[i];
+        Client *c = (Client *) calloc(1, sizeof(Client));
+        if (!c) {
+            printf("out of memory for a new client\n");
+            close(nc->fd);
+            if (nc->shm) {
+                munmap(nc->shm, sizeof(PcShmRegion_t));
+                close(nc->bellFd);
+                close(nc->moteBellFd);
+            }
+            continue;
+        }
+        c->fd = nc->fd;
+        c->shm = nc->shm;
+        c->bellFd = nc->bellFd;
+        c->moteBellFd = nc->moteBellFd;
+        c->id = nextClientId++;
+        if (w->clientCount == w->clientCapacity) {
+            w->clientCapacity = w->clientCapacity ? w->clientCapacity * 2 : 64;
+            w->clients = (Client **) realloc(w->clients,
+                    w->clientCapacity * sizeof(Client *));
+            // closed clients stay in these lists until the end of the
+            // pass, while new ones may already take their place
+            w->dirty = (Client **) realloc(w->dirty,
+                    2 * w->clientCapacity * sizeof(Client *));
+            w->closedList = (Client **) realloc(w->closedList,
+                    2 * w->clientCapacity * sizeof(Client *));
+        }
+        c->index = w->clientCount++;
+        w->clients[c->index] = c;
+        w->activeClients = w->clientCount;
+        w->clientMap[c->id] = c;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        int r = epoll_ctl(w->epollFd, EPOLL_CTL_ADD, c->fd, &ev);
+        if (r == 0 && c->shm) {
+            // the socket only tells about disconnection;
+            // frames are announced by the doorbell
+            ev.events = EPOLLIN | EPOLLET;
+            r = epoll_ctl(w->epollFd, EPOLL_CTL_ADD, c->bellFd, &ev);
+        }
+        if (r < 0) {
+            printf("cannot add client to epoll: %s\n", strerror(errno));
+            closeClient(w, c);
+            continue;
+        }
+        if (verbose) printf("worker %i: client %u added\n", w->nr, c->id);
+        // frames written before the ring was watched ring no doorbell
+        if (c->shm) receiveShm(w, c);
+    }
+    w->newClientCount = 0;
+    pthread_mutex_unlock(&w->newClientMutex);
+}
+
+void workerDrainInbox(Worker *w)
+{
+    for (int i = 0; i < workerCount; ++i) {
+        ShardQueue *q = w->inbox[i];
+        if (!q) continue;
+        unsigned head = q->head.load(std::memory_order_relaxed);
+        unsigned tail = q->tail.load(std::memory_order_acquire);
+        while (head != tail) {
+            ShardItem *item = &q->ring[head % SHARD_QUEUE_LENGTH];
+            if (item->clientId) {
+                std::unordered_map<unsigned, Client *>::iterator it =
+                        w->clientMap.find(item->clientId);
+                // the client may have disconnected meanwhile
+                if (it != w->clientMap.end()
+                        && clientEnqueue(w, it->second, item->packet,
+                                &item->header)) {
+                    markDirty(w, it->second);
+                }
+            } else {
+                broadcastLocal(w, item->originId, item->packet,
+                        &item->header);
+            }
+            packetRelease(w, item->packet);
+            head++;
+            // do not let a burst pile up in the client queues
+            if (head % MAX_IOV_COUNT == 0) workerFlush(w);
+        }
+        q->head.store(head, std::memory_order_release);
+    }
+}
+
+// arm the timer descriptor to the earliest timer
+static void workerArmTimer(Worker *w)
+{
+    // in simulation mode timers are processed by simulationStep()
+    if (simulation) return;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (!w->timers.empty()) {
+        uint64_t time = w->timers.top().time;
+        if (time == 0) time = 1; // zero would disarm the timer
+        its.it_value.tv_sec = time / 1000000;
+        its.it_value.tv_nsec = (time % 1000000) * 1000;
+    }
+    timerfd_settime(w->timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void workerAddTimer(Worker *w, uint64_t time, void *arg)
+{
+    Timer t = { time, arg };
+    bool earliest = w->timers.empty() || time < w->timers.top().time;
+    w->timers.push(t);
+    if (earliest) workerArmTimer(w);
+}
+
+void workerProcessTimers(Worker *w)
+{
+    uint64_t expirations;
+    while (read(w->timerFd, &expirations, sizeof(expirations)) > 0);
+
+    uint64_t now = nowUs();
+    while (!w->timers.empty() && w->timers.top().time <= now) {
+        Timer t = w->timers.top();
+        w->timers.pop();
+        channelModel->timerExpired(w, t.arg);
+    }
+    workerArmTimer(w);
+}
+
+uint64_t nowUs()
+{
+    if (simulation) return simNow;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// return -1 if the client was closed, 0 otherwise
+int receiveData(Worker *w, Client *c)
+{
+    static __thread unsigned char buf[RECV_BUFFER_SIZE];
+
+    if (c->shm) return receiveShm(w, c);
+
+    // edge triggered: read until the socket is empty
+    while (1) {
+        int r = read(c->fd, buf, sizeof(buf));
+        if (r == 0) {
+            // socket closed on the remote end, close it here also
+            closeClient(w, c);
+            return -1;
+        } else if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            printf("error while reading socket: %s\n", strerror(errno));
+            closeClient(w, c);
+            return -1;
+        }
+        if (verbose) printf("[%u]>> %i byte(s)\n", c->id, r);
+
+        // split the received data in frames
+        unsigned char *p = buf;
+        unsigned left = r;
+        while (left) {
+            // frame header
+            if (c->rxLen < sizeof(PcRadioPackSize_t)) {
+                unsigned n = sizeof(PcRadioPackSize_t) - c->rxLen;
+                if (n > left) n = left;
+                memcpy(c->rxBuf + c->rxLen, p, n);
+                c->rxLen += n;
+                p += n;
+                left -= n;
+                continue;
+            }
+
+            PcRadioPackSize_t len;
+            memcpy(&len, c->rxBuf, sizeof(len));
+            if (len > MAX_PACKET_SIZE || len < sizeof(PcCloudHeader_t)) {
+                printf("[%u] invalid packet length %u, dropping client\n",
+                        c->id, len);
+                closeClient(w, c);
+                return -1;
+            }
+            unsigned frameSize = sizeof(PcRadioPackSize_t) + len;
+
+            int result;
+            if (c->rxLen == sizeof(PcRadioPackSize_t)
+                    && left >= len) {
+                // whole frame is in the read buffer; take it from there
+                result = processFrame(w, c, p, len);
+                p += len;
+                left -= len;
+            } else {
+                unsigned n = frameSize - c->rxLen;
+                if (n > left) n = left;
+                memcpy(c->rxBuf + c->rxLen, p, n);
+                c->rxLen += n;
+                p += n;
+                left -= n;
+                if (c->rxLen < frameSize) break; // wait for more data
+                result = processFrame(w, c,
+                        c->rxBuf + sizeof(PcRadioPackSize_t), len);
+            }
+            c->rxLen = 0;
+            if (result < 0) return -1;
+        }
+        // pass the data on before reading more, so that a fast sender
+        // does not fill up the queues of the others in a single burst
+        workerFlush(w);
+    }
+}
+
+// return -1 if the client was closed, 0 otherwise
+int receiveShm(Worker *w, Client *c)
+{
+    PcShmRing_t *r = &c->shm->toCloud;
+    char dummy;
+    if (recv(c->fd, &dummy, sizeof(dummy), MSG_DONTWAIT) == 0) {
+        // the mote has exited
+        closeClient(w, c);
         return -1;
     }
+    uint64_t value;
+    while (read(c->bellFd, &value, sizeof(value)) > 0);
+    pcShmRingWakeUp(r);
+
+    unsigned frames = 0;
+    while (1) {
+        const unsigned char *frame = pcShmRingPeek(r);
+        if (!frame) {
+            if (pcShmRingPrepareSleep(r)) break;
+            continue;
+        }
+        PcRadioPackSize_t len;
+        memcpy(&len, frame, sizeof(len));
+        if (len > MAX_PACKET_SIZE || len < sizeof(PcCloudHeader_t)) {
+            printf("[%u] invalid packet length %u, dropping client\n",
+                    c->id, len);
+            closeClient(w, c);
+            return -1;
+        }
+        // processed in place
+        int result = processFrame(w, c, frame + sizeof(len), len);
+        if (result < 0) return -1;
+        pcShmRingRelease(r, frame);
+        // pass the data on now and then, as receiveData() does
+        if (++frames % MAX_IOV_COUNT == 0) workerFlush(w);
+    }
+
+    // the doorbell also tells that the mote has made space for more
+    if (c->txCount) markDirty(w, c);
+    return 0;
 }
 
-void sendData(int sockNr)
+// return -1 if the client was closed, 0 otherwise
+int sendShm(Worker *w, Client *c)
 {
-    int buffStart = (pos[sockNr] == QUEUE_SIZE - 1) ? 0 : pos[sockNr] + 1;
-    int buffLen;
-    if (queuePos < buffStart) {
-        // queuePos overflow occured, send all data until the end of queue
-        // another packet will be sent afterwards
-        buffLen = QUEUE_SIZE - buffStart;
-    } else {
-        // send all data until queuePos
-        buffLen = queuePos - buffStart + 1;
-    }
-//    printf("sendData(%i), start = %i, len = %i, queuePos = %i\n",
-//            sockNr, buffStart, buffLen, queuePos);
-
-    int w = write(fds[sockNr].fd, &queue[buffStart], buffLen);
-    if (w >= 1) {
-        pos[sockNr] = (pos[sockNr] + w) % QUEUE_SIZE;
-//        printf("%i bytes sent, pos[i] = %i\n", w, pos[sockNr]);
-        printf("[%i]<< %i byte(s)\n", sockNr, w);
-        if (pos[sockNr] == queuePos) {
-//            printf("job done for socket %i\n", sockNr);
-            fds[sockNr].events &= ~(POLLOUT); // stop write poll for this socket
-        }
-    } else if (errno == EAGAIN) {
-        printf("cannot write now, will try again later: %s\n", strerror(errno));
-    } else {
-        printf("error while writing to socket: %s\n", strerror(errno));
-        closeSocket(sockNr);
+    PcShmRing_t *r = &c->shm->toMote;
+    bool written = false;
+
+    while (c->txCount) {
+        QueueEntry *e = &c->txQueue[c->txHead];
+        const void *pieces[2] = {
+            e->head + sizeof(PcRadioPackSize_t), e->packet->data
+        };
+        unsigned lengths[2] = { sizeof(PcCloudHeader_t), e->packet->length };
+        if (!pcShmRingPut(r, pieces, lengths, 2)) {
+            // the doorbell rings when the mote has read something
+            pcShmRingWaitForSpace(r);
+            if (!pcShmRingPut(r, pieces, lengths, 2)) break;
+        }
+        written = true;
+        c->txBytes -= FRAME_HEAD_SIZE + e->packet->length;
+        c->txHead = (c->txHead + 1) % CLIENT_QUEUE_LENGTH;
+        c->txCount--;
+        c->packetsSent++;
+        packetRelease(w, e->packet);
+    }
+
+    if (written && pcShmRingNeedsWakeup(r)) {
+        uint64_t one = 1;
+        if (write(c->moteBellFd, &one, sizeof(one)) < 0) {
+            printf("[%u] doorbell error: %s\n", c->id, strerror(errno));
+        }
+    }
+    return 0;
+}
+
+// handle a frame (header and payload) received from the client
+// return -1 if the client was closed, 0 otherwise
+int processFrame(Worker *w, Client *c, const unsigned char *frame,
+        PcRadioPackSize_t len)
+{
+    PcCloudHeader_t header;
+    memcpy(&header, frame, sizeof(header));
+    const unsigned char *payload = frame + sizeof(header);
+    unsigned payloadLen = len - sizeof(header);
+
+    switch (header.type) {
+    case PC_CLOUD_HELLO:
+        if (c->introduced || payloadLen < sizeof(c->address)) {
+            printf("[%u] invalid hello, dropping client\n", c->id);
+            closeClient(w, c);
+            return -1;
+        }
+        memcpy(&c->address, payload, sizeof(c->address));
+        c->channel = header.channel;
+        c->introduced = true;
+        channelModel->moteConnected(w, c);
+        if (simulation) {
+            // the mote waits for the first PC_CLOUD_RUN before starting
+            c->idle = true;
+            c->clock = ~0ULL;
+            c->runPending = true;
+            w->simRunList.push_back(c->id);
+        }
+        printf("client %u is mote 0x%04x on channel %u\n",
+                c->id, c->address, c->channel);
+        break;
+
+    case PC_CLOUD_SET_CHANNEL:
+        if (!c->introduced) break;
+        c->channel = header.channel;
+        channelModel->channelChanged(w, c);
+        break;
+
+    case PC_CLOUD_DATA: {
+        c->packetsReceived++;
+        if (!c->introduced) break;
+        Packet *pkt = packetAlloc(w, payload, payloadLen);
+        if (!pkt) break;
+        if (simulation) {
+            // passed to the channel model at the end of the step
+            SimTransmission t = { c->address, c->id, pkt };
+            w->simTransmissions.push_back(t);
+        } else {
+            channelModel->transmit(w, c, pkt);
+            packetRelease(w, pkt);
+        }
+        break;
+    }
+
+    case PC_CLOUD_IDLE:
+        if (!simulation || !c->introduced || c->idle) break;
+        if (payloadLen < sizeof(c->wakeup)) {
+            printf("[%u] invalid idle frame, dropping client\n", c->id);
+            closeClient(w, c);
+            return -1;
+        }
+        memcpy(&c->wakeup, payload, sizeof(c->wakeup));
+        c->idle = true;
+        w->simRunning--;
+        {
+            Wakeup wk = { c->wakeup, c->id };
+            w->simWakeups.push(wk);
+        }
+        break;
+
+    default:
+        if (verbose) printf("[%u] unknown frame type %u\n", c->id, header.type);
+        break;
     }
+    return 0;
 }
 
+// return -1 if the client was closed, 0 otherwise
+int sendData(Worker *w, Client *c)
+{
+    struct iovec iov[MAX_IOV_COUNT];
+
+    if (c->shm) return sendShm(w, c);
+
+    while (c->txCount) {
+        // gather as many queued frames as possible in a single system call;
+        // each frame takes two vectors: the head and the shared payload
+        int iovCount = 0;
+        unsigned idx = c->txHead;
+        unsigned offset = c->txOffset;
+        unsigned n = 0;
+        while (iovCount + 2 <= MAX_IOV_COUNT && n < c->txCount) {
+            QueueEntry *e = &c->txQueue[idx];
+            if (offset < FRAME_HEAD_SIZE) {
+                iov[iovCount].iov_base = e->head + offset;
+                iov[iovCount].iov_len = FRAME_HEAD_SIZE - offset;
+                iovCount++;
+                offset = 0;
+            } else {
+                offset -= FRAME_HEAD_SIZE;
+            }
+            if (e->packet->length) {
+                iov[iovCount].iov_base = e->packet->data + offset;
+                iov[iovCount].iov_len = e->packet->length - offset;
+                iovCount++;
+            }
+            offset = 0;
+            idx = (idx + 1) % CLIENT_QUEUE_LENGTH;
+            n++;
+        }
+
+        ssize_t wr = writev(c->fd, iov, iovCount);
+        if (wr < 0) {
+            if (errno == EINTR) continue;
+            // socket buffer full; EPOLLOUT will tell when to retry
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            printf("error while writing to socket: %s\n", strerror(errno));
+            closeClient(w, c);
+            return -1;
+        }
+        if (verbose) printf("[%u]<< %i byte(s)\n", c->id, (int) wr);
+
+        // release completely sent packets
+        c->txBytes -= wr;
+        while (wr > 0) {
+            QueueEntry *e = &c->txQueue[c->txHead];
+            unsigned rest = FRAME_HEAD_SIZE + e->packet->length - c->txOffset;
+            if ((size_t) wr < rest) {
+                c->txOffset += wr;
+                break;
+            }
+            wr -= rest;
+            c->txOffset = 0;
+            c->txHead = (c->txHead + 1) % CLIENT_QUEUE_LENGTH;
+            c->txCount--;
+            c->packetsSent++;
+            packetRelease(w, e->packet);
+        }
+    }
+    return 0;
+}
 
-void closeSocket(int sockNr) {
-    if (close(fds[sockNr].fd) < 0) {
+void closeClient(Worker *w, Client *c) {
+    if (c->shm) {
+        munmap(c->shm, sizeof(PcShmRegion_t));
+        c->shm = NULL;
+        close(c->bellFd);
+        close(c->moteBellFd);
+    }
+    if (close(c->fd) < 0) {
         printf("error closing socket: %s\n", strerror(errno));
     } else {
-        printf("socket %i closed\n", sockNr);
+        printf("client %u closed (%lu packet(s) received, %lu sent, "
+                "%lu dropped)\n", c->id, c->packetsReceived,
+                c->packetsSent, c->packetsDropped);
+    }
+    if (c->introduced) {
+        channelModel->moteDisconnected(w, c);
+        if (simulation && !c->idle) w->simRunning--;
+    }
+    while (c->txCount) {
+        packetRelease(w, c->txQueue[c->txHead].packet);
+        c->txHead = (c->txHead + 1) % CLIENT_QUEUE_LENGTH;
+        c->txCount--;
+    }
+
+    // move last client to this place
+    Client *last = w->clients[--w->clientCount];
+    last->index = c->index;
+    w->clients[c->index] = last;
+    w->activeClients = w->clientCount;
+    w->clientMap.erase(c->id);
+
+    // other events for this client may still be pending; free it later
+    c->closed = true;
+    w->closedList[w->closedCount++] = c;
+}
+
+void markDirty(Worker *w, Client *c) {
+    if (c->dirty) return;
+    c->dirty = true;
+    w->dirty[w->dirtyCount++] = c;
+}
+
+void deliverToClient(Worker *w, int workerNr, unsigned clientId,
+        Packet *p, const PcCloudHeader_t *header) {
+    if (workerNr == w->nr) {
+        std::unordered_map<unsigned, Client *>::iterator it =
+                w->clientMap.find(clientId);
+        if (it != w->clientMap.end() && clientEnqueue(w, it->second, p, header)) {
+            markDirty(w, it->second);
+        }
+        return;
+    }
+    ShardItem item;
+    item.packet = p;
+    item.clientId = clientId;
+    item.originId = 0;
+    item.header = *header;
+    shardEnqueue(w, workers[workerNr], &item);
+}
+
+void deliverBroadcast(Worker *w, Client *originator,
+        Packet *p, const PcCloudHeader_t *header) {
+    broadcastLocal(w, originator->id, p, header);
+
+    ShardItem item;
+    item.packet = p;
+    item.clientId = 0;
+    item.originId = originator->id;
+    item.header = *header;
+    for (int i = 0; i < workerCount; ++i) {
+        Worker *other = workers[i];
+        if (other == w) continue;
+        if (other->activeClients.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        shardEnqueue(w, other, &item);
+    }
+}
+
+void broadcastLocal(Worker *w, unsigned originatorId, Packet *p,
+        const PcCloudHeader_t *header) {
+    for (int i = 0; i < w->clientCount; ++i) {
+        Client *c = w->clients[i];
+        if (c->id == originatorId || !c->introduced
+                || c->channel != header->channel) continue;
+        if (clientEnqueue(w, c, p, header)) markDirty(w, c);
+    }
+}
+
+bool shardEnqueue(Worker *w, Worker *to, const ShardItem *item) {
+    ShardQueue *q = to->inbox[w->nr];
+    unsigned tail = q->tail.load(std::memory_order_relaxed);
+    unsigned head = q->head.load(std::memory_order_acquire);
+    if (tail - head == SHARD_QUEUE_LENGTH) {
+        // the other worker is overloaded
+        w->shardDropped++;
+        return false;
+    }
+    item->packet->refCount.fetch_add(1, std::memory_order_relaxed);
+    q->ring[tail % SHARD_QUEUE_LENGTH] = *item;
+    q->tail.store(tail + 1, std::memory_order_release);
+    w->notify[to->nr] = true;
+    return true;
+}
+
+bool clientEnqueue(Worker *w, Client *c, Packet *p,
+        const PcCloudHeader_t *header) {
+    if (simulation && header->type != PC_CLOUD_CLOCK) {
+        // the mote has to know the time before it gets the frame,
+        // and to process the frame before the time goes on
+        if (c->clock != simNow) simulationSendClock(w, c);
+        if (c->idle && !c->runPending) {
+            c->runPending = true;
+            w->simRunList.push_back(c->id);
+        }
+    }
+
+    unsigned size = FRAME_HEAD_SIZE + p->length;
+    // backpressure: do not let a slow client eat all memory.
+    // whole packets are dropped, so the stream stays correctly framed;
+    // control frames are never dropped, unless the queue is full
+    if (c->txCount == CLIENT_QUEUE_LENGTH
+            || (header->type == PC_CLOUD_DATA
+                    && c->txBytes + size > MAX_CLIENT_BACKLOG)) {
+        c->packetsDropped++;
+        if (header->type != PC_CLOUD_DATA) {
+            printf("[%u] control frame dropped\n", c->id);
+        }
+        return false;
+    }
+    unsigned tail = (c->txHead + c->txCount) % CLIENT_QUEUE_LENGTH;
+    QueueEntry *e = &c->txQueue[tail];
+    PcRadioPackSize_t len = sizeof(PcCloudHeader_t) + p->length;
+    e->packet = p;
+    memcpy(e->head, &len, sizeof(len));
+    memcpy(e->head + sizeof(len), header, sizeof(*header));
+    c->txCount++;
+    c->txBytes += size;
+    p->refCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+Packet *packetAlloc(Worker *w, const void *payload, unsigned len) {
+    Packet *p;
+    if (w->packetPoolCount) {
+        p = w->packetPool[--w->packetPoolCount];
+    } else {
+        p = (Packet *) malloc(sizeof(Packet));
+        if (!p) {
+            printf("out of memory for packet\n");
+            return NULL;
+        }
     }
-    if (fdCount > sockNr + 1) {
-        // move last pollfd to this place
-        fds[sockNr] = fds[fdCount - 1];
-        printf("fds[%i] <- fds[%i]\n", sockNr, fdCount -1);
+    p->refCount.store(1, std::memory_order_relaxed);
+    p->length = len;
+    if (len) memcpy(p->data, payload, len);
+    return p;
+}
+
+// packets may be released by any worker; they go to that worker's pool
+void packetRelease(Worker *w, Packet *p) {
+    if (p->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    if (w->packetPoolCount < PACKET_POOL_SIZE) {
+        w->packetPool[w->packetPoolCount++] = p;
+    } else {
+        free(p);
     }
-    --fdCount;
 }
 
-void kickOthers(int originatorSock) {
-    for (int i = 0; i < fdCount; ++i) {
-        if (i != originatorSock) {
-            if (!(fds[i].events & POLLOUT)) {
-                // socket not sending anything yet, set queue position
-                pos[i] = queuePos;
+void simulationStep(Worker *w) {
+    if (simMoteCount) {
+        // start when all motes are there, so that they start at the same time
+        if (w->simRunList.size() < (unsigned) simMoteCount) return;
+        simMoteCount = 0;
+    }
+    while (w->simRunning == 0) {
+        if (!w->simTransmissions.empty()) {
+            // all motes have done their work for the current time;
+            // put the packets on the air in a repeatable order
+            std::vector<SimTransmission> tx;
+            tx.swap(w->simTransmissions);
+            std::stable_sort(tx.begin(), tx.end());
+            for (size_t i = 0; i < tx.size(); ++i) {
+                std::unordered_map<unsigned, Client *>::iterator it =
+                        w->clientMap.find(tx[i].clientId);
+                if (it != w->clientMap.end()) {
+                    channelModel->transmit(w, it->second, tx[i].packet);
+                }
+                packetRelease(w, tx[i].packet);
+            }
+            continue;
+        }
+
+        if (w->simRunList.empty()) {
+            // nothing more happens now: advance to the next event
+            while (!w->simWakeups.empty()) {
+                const Wakeup &wk = w->simWakeups.top();
+                std::unordered_map<unsigned, Client *>::iterator it =
+                        w->clientMap.find(wk.clientId);
+                if (it != w->clientMap.end() && it->second->idle
+                        && it->second->wakeup == wk.time) break;
+                w->simWakeups.pop(); // outdated
+            }
+            if (w->timers.empty() && w->simWakeups.empty()) return;
+
+            uint64_t next = ~0ULL;
+            if (!w->timers.empty()) next = w->timers.top().time;
+            if (!w->simWakeups.empty() && w->simWakeups.top().time < next) {
+                next = w->simWakeups.top().time;
+            }
+            if (next > simNow) simNow = next;
+
+            while (!w->timers.empty() && w->timers.top().time <= simNow) {
+                Timer t = w->timers.top();
+                w->timers.pop();
+                channelModel->timerExpired(w, t.arg);
+            }
+            while (!w->simWakeups.empty()
+                    && w->simWakeups.top().time <= simNow) {
+                Wakeup wk = w->simWakeups.top();
+                w->simWakeups.pop();
+                std::unordered_map<unsigned, Client *>::iterator it =
+                        w->clientMap.find(wk.clientId);
+                if (it == w->clientMap.end()) continue;
+                Client *c = it->second;
+                if (!c->idle || c->runPending || c->wakeup != wk.time) continue;
+                c->runPending = true;
+                w->simRunList.push_back(c->id);
             }
-            fds[i].events |= POLLOUT;
+            continue;
         }
+
+        for (size_t i = 0; i < w->simRunList.size(); ++i) {
+            std::unordered_map<unsigned, Client *>::iterator it =
+                    w->clientMap.find(w->simRunList[i]);
+            if (it != w->clientMap.end()) simulationRun(w, it->second);
+        }
+        w->simRunList.clear();
+    }
+}
+
+void simulationRun(Worker *w, Client *c) {
+    PcCloudHeader_t header = { PC_CLOUD_RUN, c->channel, 0, 0 };
+    c->runPending = false;
+    if (c->clock != simNow) simulationSendClock(w, c);
+    // not idle while enqueuing, or the frame would schedule another run
+    c->idle = false;
+    Packet *p = packetAlloc(w, NULL, 0);
+    bool queued = p && clientEnqueue(w, c, p, &header);
+    if (p) packetRelease(w, p);
+    if (!queued) {
+        // the mote would wait for the frame forever, and the time with it
+        printf("[%u] cannot run, dropping client\n", c->id);
+        c->idle = true;
+        closeClient(w, c);
+        return;
     }
+    w->simRunning++;
+    markDirty(w, c);
+}
+
+void simulationSendClock(Worker *w, Client *c) {
+    PcCloudHeader_t header = { PC_CLOUD_CLOCK, c->channel, 0, 0 };
+    Packet *p = packetAlloc(w, &simNow, sizeof(simNow));
+    if (!p) return;
+    c->clock = simNow;
+    if (clientEnqueue(w, c, p, &header)) markDirty(w, c);
+    packetRelease(w, p);
 }
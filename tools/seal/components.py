@@ -2162,6 +2162,15 @@ class OutputUseCase(object):
             return result.strip('"')
         return result
 
+    def getUseFunction(self):
+        if isinstance(self, FileOutputUseCase):
+            return self.getNameCC() + "Print()"
+        if self.getParameterValue("batch", False):
+            # several packets per radio frame, sent by SEAL networking
+            componentRegister.additionalConfig.add("seal_aggregation")
+            return "sealNetSendAggregated(&{0}Packet, sizeof({0}Packet))".format(self.getNameCC())
+        return self.getParameterValue("useFunction")
+
     def generateVariables(self, outputFile):
         pass
 
@@ -2386,10 +2395,7 @@ class OutputUseCase(object):
             outputFile.write("    {0}Packet.crc = crc16((const uint8_t *) &{0}Packet + 4, sizeof({0}Packet) - 4);\n".format(
                     self.getNameCC()))
 
-        if isinstance(self, FileOutputUseCase):
-            useFunction = self.getNameCC() + "Print()"
-        else:
-            useFunction = self.getParameterValue("useFunction")
+        useFunction = self.getUseFunction()
         if useFunction:
             outputFile.write("    {0};\n".format(useFunction))
         outputFile.write("    {0}PacketInit();\n".format(self.getNameCC()))
@@ -2663,10 +2669,7 @@ class FromFileOutputUseCase(OutputUseCase):
             outputFile.write("        {0}Packet.crc = crc16((const uint8_t *) &{0}Packet + 4, sizeof({0}Packet) - 4);\n".format(
                     self.getNameCC()))
 
-        if isinstance(self, FileOutputUseCase):
-            useFunction = self.getNameCC() + "Print()"
-        else:
-            useFunction = self.getParameterValue("useFunction")
+        useFunction = self.getUseFunction()
         if useFunction:
             outputFile.write("        {0};\n".format(useFunction))
 
@@ -661,6 +661,8 @@ class RadioOutput(SealOutput):
     def __init__(self):
         super(RadioOutput, self).__init__("Radio")
         self.useFunction.value = "radioSend(&radioPacket, sizeof(radioPacket))"
+        # share radio frames between packets
+        self.batch = SealParameter(False, [False, True])
         # self.crc.value = True # true by default
         self.address.value = True # true by default
 
@@ -732,6 +734,8 @@ class NetworkOutput(SealOutput):
     }
     socketSend(&socket, &networkPacket, sizeof(networkPacket))"""
         self.protocol = SealParameter("NULL", ["NULL", "CSMA", "CSMA_ACK", "SAD"])
+        # share radio frames between packets
+        self.batch = SealParameter(False, [False, True])
         self.routing = SealParameter("DV", ["DV", "SAD"])
         self.extraIncludes.value = "#include <net/mac.h>"
         self.extraConfig.value = "USE_NET=y"
@@ -4,10 +4,11 @@
 
 from __future__ import print_function
 from wmp import *
-import os
+import os, re
 import configuration
 import time
 import utils
+import sensor_data
 
 # names of all platforms the web interface supports.
 # TODO: populate this from Makefiles?
@@ -229,6 +230,49 @@ class MoteConfig(object):
             return False # default
         return bool(args[1])
 
+    # fetch logged readings with timestamps in [timeFrom, timeTo]
+    # as a list of (epoch, time, sensor code, value) tuples.
+    # The time is reset at boot, the epoch tells the boots apart.
+    def wmpGetRecords(self, timeFrom, timeTo):
+        result = []
+        epoch = 0
+        skip = 0
+        while True:
+            args = utils.le32write(timeFrom) + utils.le32write(timeTo) \
+                + utils.le16write(epoch) + utils.le16write(skip)
+            (reply, ok) = self.wmpExchangeCommand(WMP_CMD_GET_RECORDS, args)
+            if not ok or len(reply) < 4 + WMP_LOG_RECORD_SIZE:
+                # an empty reply is the last one
+                break
+            # where to continue from
+            epoch = utils.le16read(reply)
+            skip = utils.le16read(reply[2:])
+            for i in range(4, len(reply) - WMP_LOG_RECORD_SIZE + 1, WMP_LOG_RECORD_SIZE):
+                sensor = utils.le16read(reply[i:])
+                recordEpoch = utils.le16read(reply[i + 4:])
+                t = utils.le32read(reply[i + 6:])
+                value = utils.le32read(reply[i + 10:])
+                if value >= 0x80000000: value -= 0x100000000
+                result.append((recordEpoch, t, sensor, value))
+        return result
+
+    # fetch the text log written to SD card by older versions
+    # as a list of (sensor name, value) tuples
+    def wmpGetTextLog(self):
+        text = ""
+        while True:
+            (reply, ok) = self.wmpExchangeCommand(WMP_CMD_GET_TEXT_LOG,
+                                                  utils.le32write(len(text)))
+            if not ok or len(reply) == 0:
+                break
+            text += "".join(map(chr, reply))
+        # the readings were written one after another: "name=value,crc"
+        result = []
+        for m in re.finditer("([A-Za-z0-9 ]+)=(-?[0-9]+),([0-9a-f]{2})", text):
+            if sensor_data.crc8(m.group(1) + "=" + m.group(2)) == int(m.group(3), 16):
+                result.append((m.group(1), int(m.group(2))))
+        return result
+
     def updateConfigValues(self, qs):
         if "set" not in qs:
             return (None, True)
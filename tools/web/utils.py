@@ -33,6 +33,14 @@ def toCamelCase(s):
         return s
     return s[0].lower() + s[1:]
 
+# read 2 bytes in little endian byteorder
+def le16read(args):
+    return (args[1] << 8) + args[0]
+
+# write 2 bytes in little endian byteorder
+def le16write(number):
+    return [number & 0xff, (number >> 8) & 0xff]
+
 # read 4 bytes in little endian byteorder
 def le32read(args):
     result = args[3] << 24
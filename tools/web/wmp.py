@@ -50,6 +50,13 @@ WMP_CMD_GET_FILE     = 12
 WMP_CMD_SET_DAC      = 13
 # get DAC channel value
 WMP_CMD_GET_DAC      = 14
+# get logged sensor readings from a time range
+WMP_CMD_GET_RECORDS  = 15
+# get the text log written to SD card by older versions
+WMP_CMD_GET_TEXT_LOG = 16
+
+# size of a logged sensor reading: sensor (2), crc (2), epoch (2), time (4), value (4)
+WMP_LOG_RECORD_SIZE  = 14
 
 # this bit is set in replies to commands
 WMP_CMD_REPLY_FLAG   = 0x80